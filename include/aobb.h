@@ -0,0 +1,1033 @@
+/*
+ * aobb.h
+ *
+ *  Created on: 15 Sep 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file aobb.h
+/// \brief AND/OR Branch-and-Bound search for IDs
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_AOBB_H_
+#define IBM_MERLIN_AOBB_H_
+
+#include "limid.h"
+#include "algorithm.h"
+#include "mbe.h"
+
+namespace merlin {
+
+/**
+ * AND/OR Branch-and-Bound (AOBB)
+ *
+ * Models supported: ID
+ *
+ * Depth-first AND/OR search over the pseudo tree induced by the constrained
+ * elimination order (the same order used by BE and MBE). OR nodes correspond
+ * to variables and AND nodes to their value assignments. The value of a node
+ * is a pair (p, u) where p is the probability mass and u is the (unnormalized)
+ * expected utility of the subproblem below it. Pairs are combined by
+ * (p1, u1) x (p2, u2) = (p1*p2, p1*u2 + p2*u1), chance OR nodes sum the values
+ * of their children and decision OR nodes keep the child with maximum u.
+ *
+ * The heuristic of an AND node X=x is compiled from the messages of a prior
+ * MBE run along the same order: all messages generated in the buckets below X
+ * and placed in the bucket of X or of one of its ancestors are evaluated at
+ * the current assignment (probability messages multiply, utility messages
+ * add). The heuristic of an OR node is the part of its parent's heuristic
+ * made of the messages generated in its subtree.
+ *
+ * Since MBE messages are upper bounds, the search prunes with the bounds of
+ * the whole current path, as in AND/OR Branch-and-Bound: each node on the
+ * path keeps what is known of its value apart from the branch being explored
+ * (the solved children of an AND node or the solved values of a chance node,
+ * and the heuristics of the remaining ones), so an upper bound on a branch
+ * gives an upper bound on the current child of every decision node above it.
+ * The branch is pruned as soon as that bound does not exceed the best solved
+ * child of one of these decision nodes (the incumbent), and the search then
+ * resumes at that node. The bound is checked before each value of a decision
+ * or chance node and before each child of an AND node, so the values solved
+ * below a chance node tighten it for its remaining ones.
+ *
+ * Utility factors are first shifted to be non-negative (as required by the
+ * mini-bucket bounds) and the shift is added back to the final values.
+ *
+ * OR nodes are cached by context, namely the assignment to their ancestors in
+ * the pseudo tree that are connected to their subtree. A cache table is
+ * allocated only for the variables whose full context table fits into the
+ * memory budget (smallest tables first), thus the search ranges from linear
+ * space (Memory=0) to the space of BE (unbounded budget). Variables whose
+ * context equals that of their parent plus the parent (dead caches) are never
+ * cached since their entries would not be reused. A node whose subtree was
+ * pruned by a bound from above it is not cached either, since its value is
+ * not known.
+ *
+ * Before the depth-first traversal, a probe
+ * follows the heuristically best value of each decision variable and returns
+ * the expected utility of that policy, which is the initial lower bound. The
+ * lower bound is raised whenever the search finds a better policy for a
+ * root of the pseudo tree (a better solved child of a root decision node, or
+ * a solved root), the other roots keeping their best known policies, and it
+ * is the MEU once the search completes.
+ *
+ */
+class aobb : public limid, public algorithm {
+public:
+	typedef limid::findex findex;        ///< Factor index
+	typedef limid::vindex vindex;        ///< Variable index
+	typedef limid::flist flist;          ///< Collection of factor indices
+	typedef std::pair<double, double> value_t; ///< Node value (probability, utility)
+
+	///
+	/// \brief Map v -> (a*p + c1, b*p + a*u + c2) of a value v = (p, u), the
+	///	form taken by combining with a constant value or adding one.
+	///
+	struct affine {
+		double a, b, c1, c2;
+
+		affine(double a = 1.0, double b = 0.0, double c1 = 0.0, double c2 = 0.0) :
+			a(a), b(b), c1(c1), c2(c2) {}
+		value_t operator()(const value_t& v) const {
+			return value_t(a * v.first + c1, b * v.first + a * v.second + c2);
+		}
+		affine operator*(const affine& g) const { // this after g
+			return affine(a * g.a, b * g.a + a * g.b, a * g.c1 + c1, b * g.c1 + a * g.c2 + c2);
+		}
+	};
+
+	///
+	/// \brief Entry of an input factor or message in the heuristic of a
+	///	variable X, laid out for evaluating it at every value of X.
+	///
+	struct lookup {
+		bool arc;						///< Input factor (arc label) or message
+		size_t id;						///< Index of the factor or message
+		size_t branch;					///< Child whose subtree generated the message
+		size_t stride;					///< Distance between consecutive values of X in the table
+		size_t begin, end;				///< Range of the other variables and their strides in m_index
+	};
+
+	///
+	/// \brief Node on the current path, with what is known of its value
+	///	apart from the branch being explored.
+	///
+	struct frame {
+		char type;						///< AND node ('a'), chance ('c') or decision ('d') OR node
+		value_t done;					///< Arc and solved children (AND), solved values (chance)
+		value_t rest;					///< Heuristic of the remaining children or values
+		value_t best;					///< Best solved child (decision)
+		affine up;						///< From the value of this node to the branch of the decision node above
+		size_t dec;						///< Level of the decision node above (or -1)
+		bool bounded;					///< Some decision node above has a solved child
+
+		frame(char t = 'a') : type(t), done(0.0, 0.0), rest(0.0, 0.0),
+			best(0.0, -std::numeric_limits<double>::infinity()), dec(size_t(-1)),
+			bounded(false) {}
+
+		///
+		/// \brief Value of the node given the value of the branch (AND and
+		///	chance nodes).
+		///
+		affine node() const {
+			if (type == 'a') {
+				value_t k(done.first * rest.first,
+						done.first * rest.second + rest.first * done.second);
+				return affine(k.first, k.second);
+			}
+			return affine(1.0, 0.0, done.first + rest.first, done.second + rest.second);
+		}
+	};
+
+	///
+	/// \brief State of a depth-first traversal of the search space.
+	///
+	struct search_state {
+		std::vector<size_t> assignment;	///< Current (partial) assignment
+		std::vector<frame> path;		///< Nodes on the current path (bounds)
+		size_t cut;						///< Level of the node where a pruned branch resumes (or -1)
+		size_t expanded;				///< Number of OR nodes expanded
+		size_t pruned;					///< Number of AND nodes pruned
+		size_t hits;					///< Number of cache hits
+		size_t misses;					///< Number of cache misses
+		bool timeout;					///< Time limit reached
+
+		search_state(size_t n = 0) : assignment(n, 0), cut(size_t(-1)), expanded(0),
+			pruned(0), hits(0), misses(0), timeout(false) {}
+	};
+
+	///
+	/// \brief Properties of the algorithm
+	///
+	MER_ENUM( Property , Order,Seed,iBound,Memory,TimeLimit,Debug );
+
+public:
+
+	///
+	/// \brief Default constructor.
+	///
+	aobb() : limid(), m_shift(0.0) {
+		set_properties();
+	}
+
+	///
+	/// \brief Constructor with a graphical model.
+	///
+	aobb(const limid& lm) : limid(lm), m_gmo(lm), m_shift(0.0) {
+		clear_factors();
+		set_properties();
+	}
+
+	///
+	/// \brief Clone the algorithm.
+	/// \return the pointer to the new object containing the cloned algorithm.
+	///
+	virtual aobb* clone() const {
+		aobb* lm = new aobb(*this);
+		return lm;
+	}
+
+	// Can be an optimization algorithm or a summation algorithm....
+	double ub() const {
+		return m_ub;
+	}
+	double lb() const {
+		return m_lb;
+	}
+	std::vector<size_t> best_config() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	double logZ() const {
+		throw std::runtime_error("Not implemented");
+	}
+	double logZub() const {
+		throw std::runtime_error("Not implemented");
+	}
+	double logZlb() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	// No beliefs defined currently
+	const factor& belief(size_t) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const factor& belief(variable) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const factor& belief(variable_set) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const vector<factor>& beliefs() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	///
+	/// \brief Set the mini-bucket i-bound of the heuristic.
+	///
+	void set_ibound(size_t i) {
+		m_ibound = i ? i : std::numeric_limits<size_t>::max();
+	}
+
+	///
+	/// \brief Get the mini-bucket i-bound of the heuristic.
+	///
+	size_t get_ibound() const {
+		return m_ibound;
+	}
+
+	///
+	/// \brief Set the variable elimination order.
+	///
+	void set_order(const variable_order_t& ord) {
+		m_order = ord;
+	}
+
+	///
+	/// \brief Get the number of cache hits of the last search.
+	///
+	size_t get_cache_hits() const {
+		return m_state.hits;
+	}
+
+	///
+	/// \brief Get the number of cache misses of the last search.
+	///
+	size_t get_cache_misses() const {
+		return m_state.misses;
+	}
+
+	///
+	/// \brief Get the memory used by the cache tables (in MBytes).
+	///
+	double get_cache_memory() const {
+		return m_cache_bytes / (1024.0 * 1024.0);
+	}
+
+	///
+	/// \brief Set the properties of the algorithm.
+	/// \param opt 	The string containing comma separated property value pairs
+	///
+	virtual void set_properties(std::string opt = std::string()) {
+		if (opt.length() == 0) {
+			set_properties("Order=MinFill,Seed=0,iBound=2,Memory=1024,TimeLimit=0,Debug=0");
+			return;
+		}
+		std::vector<std::string> strs = merlin::split(opt, ',');
+		for (size_t i = 0; i < strs.size(); ++i) {
+			std::vector<std::string> asgn = merlin::split(strs[i], '=');
+			switch (Property(asgn[0].c_str())) {
+			case Property::Order:
+				m_order.clear();
+				m_order_method = OrderMethod(asgn[1].c_str());
+				break;
+			case Property::Seed:
+				m_seed = strtoul(asgn[1].c_str(), NULL, 10);
+				break;
+			case Property::iBound:
+				set_ibound(atol(asgn[1].c_str()));
+				break;
+			case Property::Memory:
+				m_memory = atof(asgn[1].c_str());
+				break;
+			case Property::TimeLimit:
+				m_time_limit = atof(asgn[1].c_str());
+				break;
+			case Property::Debug:
+				m_debug = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	///
+	/// \brief Initialize the AND/OR search space and the heuristic.
+	///
+	void init() {
+
+		// Start the timer and store it
+		m_start_time = timeSystem();
+
+		bool islimid = m_gmo.islimid();
+		if (islimid) {
+			throw std::runtime_error(std::string(name()) + " is only supported for standard IDs.");
+		}
+
+		// Prologue
+		std::cout << "Initialize solver ..." << std::endl;
+		std::cout << " + models supported : ID" << std::endl;
+		std::cout << " + algorithm        : " << name() << std::endl;
+		std::cout << " + i-bound          : " << m_ibound << std::endl;
+		std::cout << " + cache memory     : " << m_memory << " MB" << std::endl;
+		std::cout << " + time limit       : " << m_time_limit << std::endl;
+
+		if (m_order.size() == 0) { // if we need to construct an elimination ordering
+			m_order = m_gmo.order(m_order_method, m_seed);
+		}
+
+		// Get the induced width of the order
+		size_t wstar = m_gmo.induced_width(m_order);
+		std::cout << " + elimination      : ";
+		std::copy(m_order.begin(), m_order.end(),
+				std::ostream_iterator<size_t>(std::cout, " "));
+		std::cout << std::endl;
+		std::cout << " + induced width    : " << wstar << std::endl;
+
+		// The mini-bucket bounds require non-negative utilities
+		m_shift += m_gmo.shift_utilities();
+		std::cout << " + utility shift    : " << m_shift << std::endl;
+
+		// Build the pseudo tree (search order is the reverse elimination order)
+		size_t n = m_gmo.nvar();
+		m_parents = m_gmo.pseudo_tree(m_order);
+		m_children.clear();
+		m_children.resize(n);
+		m_roots.clear();
+		for (vector<vindex>::const_reverse_iterator x = m_order.rbegin();
+				x != m_order.rend(); ++x) {
+			if (m_parents[*x] == vindex(-1)) {
+				m_roots.push_back(*x);
+			} else {
+				m_children[m_parents[*x]].push_back(*x);
+			}
+		}
+
+		m_depth.assign(n, 0);
+		size_t height = 0;
+		for (vector<vindex>::const_reverse_iterator x = m_order.rbegin();
+				x != m_order.rend(); ++x) {
+			if (m_parents[*x] != vindex(-1)) {
+				m_depth[*x] = m_depth[m_parents[*x]] + 1;
+				height = std::max(height, m_depth[*x]);
+			}
+		}
+		std::cout << " + pseudo tree      : " << m_roots.size()
+			<< " root(s), height " << height << std::endl;
+
+		// Place each input factor in the bucket of its earliest eliminated variable
+		std::vector<size_t> position(n);
+		for (size_t i = 0; i < m_order.size(); ++i) {
+			position[m_order[i]] = i;
+		}
+
+		m_functions.clear();
+		m_functions.resize(n);
+		m_const = value_t(1.0, 0.0);
+		const std::vector<factor>& fin = m_gmo.get_factors();
+		for (size_t i = 0; i < fin.size(); ++i) {
+			const variable_set& vs = fin[i].vars();
+			if (vs.size() == 0) {
+				if (fin[i].get_type() == factor::FactorType::Probability) {
+					m_const.first *= fin[i].max();
+				} else if (fin[i].get_type() == factor::FactorType::Utility) {
+					m_const.second += fin[i].max();
+				}
+				continue;
+			}
+
+			vindex b = vs[0].label();
+			for (size_t j = 1; j < vs.size(); ++j) {
+				if (position[vs[j].label()] < position[b]) b = vs[j].label();
+			}
+			m_functions[b].push_back(i);
+		}
+
+		// Compute the contexts, bottom up
+		m_contexts.clear();
+		m_contexts.resize(n);
+		for (size_t i = 0; i < m_order.size(); ++i) {
+			vindex x = m_order[i];
+			for (size_t j = 0; j < m_functions[x].size(); ++j) {
+				m_contexts[x] |= fin[m_functions[x][j]].vars();
+			}
+			for (size_t j = 0; j < m_children[x].size(); ++j) {
+				m_contexts[x] |= m_contexts[m_children[x][j]];
+			}
+			m_contexts[x] /= var(x);
+		}
+
+		// Allocate the cache tables that fit the memory budget
+		std::multimap<double, vindex> tables;
+		for (size_t x = 0; x < n; ++x) {
+			vindex p = m_parents[x];
+			if (p == vindex(-1)) continue; // roots are solved only once
+			if (m_contexts[x] == (m_contexts[p] | var(p))) continue; // dead cache
+			double sz = 1.0;
+			for (size_t j = 0; j < m_contexts[x].size(); ++j) {
+				sz *= m_contexts[x][j].states();
+			}
+			tables.insert(std::make_pair(sz, x));
+		}
+
+		m_cache.clear();
+		m_cache.resize(n);
+		m_cache_bytes = 0;
+		size_t ncached = 0;
+		double budget = m_memory * 1024.0 * 1024.0;
+		for (std::multimap<double, vindex>::iterator it = tables.begin();
+				it != tables.end(); ++it) {
+			double bytes = it->first * sizeof(value_t);
+			if (m_cache_bytes + bytes > budget) break;
+			m_cache[it->second].resize((size_t)it->first);
+			m_cache_bytes += (size_t)bytes;
+			++ncached;
+		}
+		std::cout << " + cached variables : " << ncached << " ("
+			<< get_cache_memory() << " MB)" << std::endl;
+
+		// Compile the mini-bucket heuristic along the same order
+		std::ostringstream oss;
+		oss << "iBound=" << m_ibound << ",Debug=0";
+		mbe h(m_gmo);
+		h.set_properties(oss.str());
+		h.set_order(m_order);
+		h.run();
+		m_ub = h.ub();
+
+		// A message generated in bucket S and placed in bucket T contributes
+		// to the heuristic of every variable on the path from parent(S) to T
+		// (and, below that variable, to the heuristic of the child on the path)
+		h.release_messages(m_messages);
+		const std::vector<vindex>& src = h.get_message_sources();
+		const std::vector<vindex>& dst = h.get_message_targets();
+		std::vector<size_t> rank(n, 0); // position among the siblings
+		for (size_t x = 0; x < n; ++x) {
+			for (size_t j = 0; j < m_children[x].size(); ++j) {
+				rank[m_children[x][j]] = j;
+			}
+		}
+		m_heuristic.clear();
+		m_heuristic.resize(n);
+		m_branch.clear();
+		m_branch.resize(n);
+		for (size_t i = 0; i < m_messages.size(); ++i) {
+			vindex c = src[i];
+			for (vindex y = m_parents[c]; y != vindex(-1); c = y, y = m_parents[y]) {
+				m_heuristic[y].push_back(i);
+				m_branch[y].push_back(rank[c]);
+				if (y == dst[i]) break;
+			}
+		}
+		m_lookup.clear();
+		m_lookup.resize(n);
+		m_index.clear();
+		for (size_t x = 0; x < n; ++x) {
+			for (size_t i = 0; i < m_functions[x].size(); ++i) {
+				add_lookup(x, true, m_functions[x][i], 0, fin[m_functions[x][i]].vars());
+			}
+			for (size_t i = 0; i < m_heuristic[x].size(); ++i) {
+				size_t j = m_heuristic[x][i];
+				add_lookup(x, false, j, m_branch[x][i], m_messages[j].vars());
+			}
+		}
+
+		m_state = search_state(n);
+
+		std::cout << "Initialization complete in "
+			<< (timeSystem() - m_start_time) << " seconds." << std::endl;
+	}
+
+	///
+	/// \brief Run AND/OR Branch-and-Bound search.
+	///
+	virtual void run() {
+
+		// Initialize the algorithm
+		init();
+
+		// Lower bound: expected utility of the heuristic (greedy) policy
+		std::cout << "Begin probing ..." << std::endl;
+		clear_cache();
+		m_incumbent.assign(m_gmo.nvar(), value_t(0.0, 0.0));
+		m_probe = true;
+		value_t v = solve(m_state);
+		m_probe = false;
+		m_lb = v.second + m_shift * v.first;
+		m_ub += m_shift * v.first;
+		std::cout << "End probing." << std::endl;
+		std::cout << "[" << (timeSystem() - m_start_time) << "] "
+			<< m_lb << " (lower bound), " << m_ub << " (upper bound)" << std::endl;
+
+		// Depth-first AND/OR search (raises the lower bound as it goes)
+		std::cout << "Begin AND/OR search ..." << std::endl;
+		clear_cache();
+		v = solve(m_state);
+		if (m_state.timeout == false) {
+			m_lb = m_ub = v.second + m_shift * v.first;
+		}
+		m_incumbent.clear();
+
+		std::cout << "End AND/OR search." << std::endl;
+		std::cout << "Nodes expanded: " << m_state.expanded << ", pruned: " << m_state.pruned << std::endl;
+		std::cout << "Cache hits: " << m_state.hits << ", misses: " << m_state.misses
+			<< ", hit rate: " << (m_state.hits + m_state.misses > 0 ?
+				(double)m_state.hits / (m_state.hits + m_state.misses) : 0.0)
+			<< ", memory: " << get_cache_memory() << " MB" << std::endl;
+		if (m_state.timeout) {
+			std::cout << "Time limit reached." << std::endl;
+			std::cout << "Lower Bound on MEU value is " << m_lb << "\n";
+			std::cout << "Upper Bound on MEU value is " << m_ub << "\n";
+		} else {
+			std::cout << "MEU value is " << m_lb << "\n";
+		}
+		std::cout << "CPU time is " << (timeSystem() - m_start_time) << " seconds" << std::endl;
+		std::cout << "Done." << std::endl << std::endl;
+	}
+
+protected:
+
+	///
+	/// \brief Name of the algorithm.
+	///
+	virtual const char* name() const {
+		return "AOBB";
+	}
+
+	///
+	/// \brief Combine the values of two independent subproblems.
+	///
+	static value_t combine(const value_t& a, const value_t& b) {
+		return value_t(a.first * b.first, a.first * b.second + b.first * a.second);
+	}
+
+	///
+	/// \brief Reset the cache tables and the cache statistics.
+	///
+	void clear_cache() {
+		for (size_t x = 0; x < m_cache.size(); ++x) {
+			std::fill(m_cache[x].begin(), m_cache[x].end(), value_t(-1.0, 0.0));
+		}
+		m_state.hits = 0;
+		m_state.misses = 0;
+	}
+
+	///
+	/// \brief Solve the whole problem (ie, the forest of pseudo trees).
+	///
+	value_t solve(search_state& st) {
+		value_t v = m_const;
+		for (size_t i = 0; i < m_roots.size(); ++i) {
+			value_t w = expand_or(m_roots[i], st);
+			v = combine(v, w);
+			if (m_incumbent.empty() == false) {
+				if (m_probe) {
+					m_incumbent[m_roots[i]] = w; // greedy policy of the root
+				} else if (st.timeout == false) {
+					improve(m_roots[i], w);
+				}
+			}
+		}
+		return v;
+	}
+
+	///
+	/// \brief Raise the lower bound with a better policy for a root of the
+	///	pseudo tree (the other roots keep their best known policies).
+	///
+	void improve(vindex r, const value_t& w) {
+		if (w.second <= m_incumbent[r].second) return;
+		m_incumbent[r] = w;
+		value_t v = m_const;
+		for (size_t i = 0; i < m_roots.size(); ++i) {
+			v = combine(v, m_incumbent[m_roots[i]]);
+		}
+		double lb = v.second + m_shift * v.first;
+		if (lb > m_lb) {
+			m_lb = lb;
+			std::cout << "[" << (timeSystem() - m_start_time) << "] "
+				<< m_lb << " (lower bound), " << m_ub << " (upper bound)" << std::endl;
+		}
+	}
+
+	///
+	/// \brief Add a node to the current path.
+	///
+	/// The AND and chance nodes between two decision nodes only combine the
+	/// branch with constants while it is explored, so the map from the value
+	/// of a node to the branch of the decision node above is composed once,
+	/// when the node is added. A node is linked to the path only if it is
+	/// tracked; otherwise no node above can prune it.
+	///
+	void push(search_state& st, char type) const {
+		frame f(type);
+		if (tracked(st)) {
+			const frame& p = st.path.back();
+			f.bounded = true;
+			if (p.type == 'd') {
+				f.dec = st.path.size() - 1;
+			} else {
+				f.up = p.up * p.node();
+				f.dec = p.dec;
+			}
+		}
+		st.path.push_back(f);
+	}
+
+	///
+	/// \brief Find a decision node on the current path whose best solved
+	///	child is at least as good as any completion of a branch worth at most v.
+	/// \param v 	Upper bound on the value of the branch below the path
+	/// \param st	The state of the search
+	/// \return the level of that node on the path (or -1 if there is none).
+	///
+	size_t dominated_at(value_t v, const search_state& st) const {
+		if (st.path.empty()) return size_t(-1);
+		size_t i = st.path.size() - 1;
+		if (st.path[i].type != 'd') {
+			v = st.path[i].up(st.path[i].node()(v));
+			i = st.path[i].dec;
+		}
+		for (; i != size_t(-1); i = st.path[i].dec) {
+			const frame& f = st.path[i];
+			if (v.second <= f.best.second) return i;
+			v = value_t(std::max(v.first, std::max(f.best.first, f.rest.first)),
+					std::max(v.second, std::max(f.best.second, f.rest.second)));
+			v = f.up(v);
+		}
+		return size_t(-1);
+	}
+
+	///
+	/// \brief Evaluate the functions labeling the arc to the AND node X=x.
+	///
+	value_t arc(vindex x, const std::vector<size_t>& a) const {
+		const std::vector<findex>& fs = m_functions[x];
+		double P = 1.0, U = 0.0;
+		for (size_t i = 0; i < fs.size(); ++i) {
+			const factor& f = m_gmo.get_factor(fs[i]);
+			double val = f[sub2ind(f.vars(), a)];
+			if (f.get_type() == factor::FactorType::Probability) {
+				P *= val;
+			} else if (f.get_type() == factor::FactorType::Utility) {
+				U += val;
+			}
+		}
+		return value_t(P, P * U);
+	}
+
+	///
+	/// \brief Evaluate the heuristic of the AND node X=x (including the arc).
+	/// \param x 	The variable
+	/// \param a 	The assignment
+	/// \param hc 	If not NULL, the heuristic of each child OR node (the
+	///	messages generated in its subtree) is stored there
+	///
+	value_t heuristic(vindex x, const std::vector<size_t>& a,
+			value_t* hc = NULL) const {
+		const std::vector<size_t>& ms = m_heuristic[x];
+		double P = 1.0, U = 0.0;
+		if (hc != NULL) {
+			std::fill(hc, hc + m_children[x].size(), value_t(1.0, 0.0));
+		}
+		for (size_t i = 0; i < ms.size(); ++i) {
+			const factor& f = m_messages[ms[i]];
+			double val = f[sub2ind(f.vars(), a)];
+			if (f.get_type() == factor::FactorType::Probability) {
+				P *= val;
+				if (hc != NULL) hc[m_branch[x][i]].first *= val;
+			} else if (f.get_type() == factor::FactorType::Utility) {
+				U += val;
+				if (hc != NULL) hc[m_branch[x][i]].second += val;
+			}
+		}
+		if (hc != NULL) {
+			for (size_t c = 0; c < m_children[x].size(); ++c) {
+				hc[c].second *= hc[c].first;
+			}
+		}
+		return combine(arc(x, a), value_t(P, P * U));
+	}
+
+	///
+	/// \brief Evaluate the heuristic of the AND nodes X=0, X=1, ... at once
+	///	(same as heuristic, but the index in each table is found once).
+	/// \param x 	The variable
+	/// \param a 	The assignment (the value of X is ignored)
+	/// \param h 	The heuristic of each value is stored there
+	/// \param hc 	If not NULL, the heuristic of the child OR nodes of each
+	///	value is stored there (one value after the other)
+	///
+	void heuristics(vindex x, const std::vector<size_t>& a,
+			value_t* h, value_t* hc = NULL) const {
+		size_t k = var(x).states(), nch = m_children[x].size();
+		std::vector<double> buf(4 * k); // arc and messages of each value
+		double *Pa = &buf[0], *Ua = Pa + k, *P = Ua + k, *U = P + k;
+		std::fill(Pa, Pa + k, 1.0);
+		std::fill(Ua, Ua + k, 0.0);
+		std::fill(P, P + k, 1.0);
+		std::fill(U, U + k, 0.0);
+		if (hc != NULL) {
+			std::fill(hc, hc + k * nch, value_t(1.0, 0.0));
+		}
+
+		const std::vector<lookup>& ls = m_lookup[x];
+		for (size_t i = 0; i < ls.size(); ++i) {
+			const lookup& l = ls[i];
+			const factor& f = (l.arc ? m_gmo.get_factor(l.id) : m_messages[l.id]);
+			const double* t = f.table();
+			size_t j = 0;
+			for (size_t r = l.begin; r < l.end; ++r) {
+				j += a[m_index[r].first] * m_index[r].second;
+			}
+			if (f.get_type() == factor::FactorType::Probability) {
+				double* p = (l.arc ? Pa : P);
+				for (size_t v = 0; v < k; ++v, j += l.stride) {
+					p[v] *= t[j];
+					if (hc != NULL && l.arc == false) hc[v * nch + l.branch].first *= t[j];
+				}
+			} else if (f.get_type() == factor::FactorType::Utility) {
+				double* u = (l.arc ? Ua : U);
+				for (size_t v = 0; v < k; ++v, j += l.stride) {
+					u[v] += t[j];
+					if (hc != NULL && l.arc == false) hc[v * nch + l.branch].second += t[j];
+				}
+			}
+		}
+
+		for (size_t v = 0; v < k; ++v) {
+			h[v] = combine(value_t(Pa[v], Pa[v] * Ua[v]), value_t(P[v], P[v] * U[v]));
+		}
+		if (hc != NULL) {
+			for (size_t c = 0; c < k * nch; ++c) {
+				hc[c].second *= hc[c].first;
+			}
+		}
+	}
+
+	///
+	/// \brief Add an input factor or message to the lookups of X.
+	///
+	void add_lookup(vindex x, bool arc, size_t id, size_t branch,
+			const variable_set& vs) {
+		lookup l;
+		l.arc = arc;
+		l.id = id;
+		l.branch = branch;
+		l.stride = 0;
+		l.begin = m_index.size();
+		size_t m = 1;
+		for (size_t v = 0; v < vs.size(); ++v) {
+			if (vs[v].label() == x) l.stride = m;
+			else m_index.push_back(std::make_pair(vs[v].label(), m));
+			m *= vs[v].states();
+		}
+		l.end = m_index.size();
+		m_lookup[x].push_back(l);
+	}
+
+	///
+	/// \brief Return the value of the subproblem rooted by an OR node (either
+	///	from the cache or by expanding the node).
+	///
+	value_t expand_or(vindex x, search_state& st) {
+		std::vector<value_t>& cache = m_cache[x];
+		if (cache.empty()) {
+			return solve_or(x, st);
+		}
+
+		size_t key = sub2ind(m_contexts[x], st.assignment);
+		std::unique_lock<std::mutex> lock;
+		if (m_locks) lock = std::unique_lock<std::mutex>(stripe(x, key));
+		value_t c = cache[key];
+		if (lock) lock.unlock();
+		if (c.first >= 0.0) {
+			++st.hits;
+			return c;
+		}
+
+		++st.misses;
+		value_t v = solve_or(x, st);
+		if (st.timeout == false && st.cut == size_t(-1)) { // only exact values are cached
+			if (m_locks) lock.lock();
+			cache[key] = v;
+		}
+		return v;
+	}
+
+	///
+	/// \brief Lock guarding a cache entry (shared caches only).
+	///
+	std::mutex& stripe(vindex x, size_t key) const {
+		return (*m_locks)[(key * 2654435761u + x) % m_locks->size()];
+	}
+
+	///
+	/// \brief Expand an OR node and return the value of its subproblem.
+	///
+	value_t solve_or(vindex x, search_state& st) {
+		++st.expanded;
+		if (m_time_limit > 0 && (st.expanded % 1000) == 0 &&
+				timeSystem() - m_start_time > m_time_limit) {
+			st.timeout = true;
+		}
+		if (st.timeout) return value_t(0.0, 0.0);
+
+		size_t k = var(x).states();
+		size_t nch = m_children[x].size();
+		size_t level = st.path.size();
+		std::vector<value_t> h, hc, rest;
+		if (m_vtypes[x] == 'c') { // chance: sum over the values
+			bool track = tracked(st);
+			if (track) {
+				h.resize(k);
+				hc.resize(k * nch);
+				rest.assign(k, value_t(0.0, 0.0));
+				heuristics(x, st.assignment, &h[0], nch ? &hc[0] : NULL);
+				for (size_t i = k - 1; i > 0; --i) { // heuristic of the values after i-1
+					rest[i - 1] = value_t(rest[i].first + h[i].first, rest[i].second + h[i].second);
+				}
+				push(st, 'c');
+			}
+
+			value_t v(0.0, 0.0);
+			for (size_t i = 0; i < k; ++i) {
+				if (track) {
+					st.path[level].done = v;
+					st.path[level].rest = rest[i];
+					st.cut = dominated_at(h[i], st);
+					if (st.cut != size_t(-1)) break;
+				}
+
+				st.assignment[x] = i;
+				value_t w = expand_and(x, st, track && nch ? &hc[i * nch] : NULL);
+				if (st.cut != size_t(-1)) break;
+				v.first += w.first;
+				v.second += w.second;
+			}
+			if (track) st.path.pop_back();
+			return v;
+		}
+
+		// decision: order the values by their heuristic, best first
+		bool track = (m_probe == false); // (the probe does not track the path)
+		h.resize(k);
+		if (track) hc.resize(k * nch);
+		heuristics(x, st.assignment, &h[0], track && nch ? &hc[0] : NULL);
+		std::vector<std::pair<double, size_t> > succ(k);
+		for (size_t i = 0; i < k; ++i) {
+			succ[i] = std::make_pair(-h[i].second, i);
+		}
+		std::stable_sort(succ.begin(), succ.end());
+
+		// largest heuristic of the values after each one
+		rest.assign(k, value_t(0.0, -std::numeric_limits<double>::infinity()));
+		for (size_t i = k - 1; i > 0; --i) {
+			const value_t& w = h[succ[i].second];
+			rest[i - 1] = value_t(std::max(rest[i].first, w.first), std::max(rest[i].second, w.second));
+		}
+		if (track) push(st, 'd');
+
+		value_t best(0.0, -std::numeric_limits<double>::infinity());
+		for (size_t i = 0; i < k; ++i) {
+			if (-succ[i].first <= best.second) { // remaining values cannot improve
+				st.pruned += (k - i);
+				break;
+			}
+
+			size_t j = succ[i].second;
+			if (track) { // or no value can improve a node above
+				st.path[level].best = best;
+				st.path[level].rest = rest[i];
+				st.cut = dominated_at(h[j], st);
+				if (st.cut != size_t(-1)) break;
+			}
+
+			st.assignment[x] = j;
+			value_t w = expand_and(x, st, track && nch ? &hc[j * nch] : NULL);
+			if (st.cut == level) { // the branch cannot improve this node
+				st.cut = size_t(-1);
+				++st.pruned;
+				continue;
+			} else if (st.cut != size_t(-1)) {
+				break;
+			}
+			if (w.second > best.second) {
+				best = w;
+				if (m_parents[x] == vindex(-1) && m_incumbent.empty() == false &&
+						m_probe == false && st.timeout == false) {
+					improve(x, best);
+				}
+			}
+
+			if (m_probe) break; // follow the heuristic policy only
+		}
+		if (track) st.path.pop_back();
+
+		if (m_debug) {
+			std::cout << "  OR(" << x << ") = (" << best.first << ", "
+				<< best.second << ")" << std::endl;
+		}
+
+		return best;
+	}
+
+	///
+	/// \brief Expand the AND node X=x (the value of X is already assigned).
+	/// \param x 	The variable
+	/// \param st	The state of the search
+	/// \param hc 	The heuristic of the child OR nodes (or NULL)
+	///
+	value_t expand_and(vindex x, search_state& st, const value_t* hc = NULL) {
+		value_t v = arc(x, st.assignment);
+		const std::vector<vindex>& ch = m_children[x];
+		size_t level = st.path.size();
+		bool track = (ch.empty() == false && tracked(st));
+		std::vector<value_t> h, rest;
+		if (track) {
+			if (hc == NULL) {
+				h.resize(ch.size());
+				heuristic(x, st.assignment, &h[0]);
+				hc = &h[0];
+			}
+			rest.assign(ch.size(), value_t(1.0, 0.0)); // product of the children after each one
+			for (size_t i = ch.size() - 1; i > 0; --i) {
+				rest[i - 1] = combine(rest[i], hc[i]);
+			}
+			push(st, 'a');
+		}
+
+		for (size_t i = 0; i < ch.size() && v.first > 0.0; ++i) {
+			if (track) { // bound with the children solved so far
+				st.path[level].done = v;
+				st.path[level].rest = rest[i];
+				if (i > 0) {
+					st.cut = dominated_at(hc[i], st);
+					if (st.cut != size_t(-1)) break;
+				}
+			}
+
+			v = combine(v, expand_or(ch[i], st));
+			if (st.cut != size_t(-1)) break;
+		}
+		if (track) st.path.pop_back();
+		if (v.first == 0.0 || st.cut != size_t(-1)) return value_t(0.0, 0.0); // dead end (or pruned)
+		return v;
+	}
+
+	///
+	/// \brief Whether a node is bounded by a decision node on the current
+	///	path (so it is worth adding to the path). Until a decision node has
+	///	a solved child, nothing below it can be pruned by it.
+	///
+	bool tracked(const search_state& st) const {
+		if (m_probe || st.path.empty()) return false;
+		const frame& f = st.path.back();
+		return (f.bounded || (f.type == 'd' &&
+				f.best.second > -std::numeric_limits<double>::infinity()));
+	}
+
+protected:
+	// Members:
+
+	size_t m_ibound;					///< Mini-bucket i-bound
+	limid m_gmo; 						///< Original influence diagram
+	double m_lb;						///< Lower bound on the MEU
+	double m_ub;						///< Upper bound on the MEU
+	OrderMethod m_order_method;			///< Variable ordering method
+	unsigned long m_seed;				///< Seed of the ordering tie-breaks
+	variable_order_t m_order;			///< Variable order
+	double m_time_limit;				///< Time limit in seconds (0 for none)
+	double m_shift;						///< Utility shift (non-negative utilities)
+	bool m_debug;						///< Internal debugging flag
+
+	std::vector<vindex> m_parents;		///< Pseudo tree
+	std::vector<std::vector<vindex> > m_children; ///< Children in the pseudo tree
+	std::vector<vindex> m_roots;		///< Roots of the pseudo tree (forest)
+	std::vector<size_t> m_depth;		///< Depth of each variable in the pseudo tree
+	std::vector<std::vector<findex> > m_functions; ///< Input factors of each variable (arc labels)
+	value_t m_const;					///< Constant input factors
+	std::vector<factor> m_messages;		///< Mini-bucket messages
+	std::vector<std::vector<size_t> > m_heuristic; ///< Messages making up the heuristic of each variable
+	std::vector<std::vector<size_t> > m_branch; ///< Child whose subtree generated each of these messages
+	std::vector<std::vector<lookup> > m_lookup; ///< Arc labels and heuristic of each variable, for heuristics
+	std::vector<std::pair<vindex, size_t> > m_index; ///< Variables and strides of the lookups
+	double m_memory;					///< Memory budget for caching (in MBytes)
+	std::vector<variable_set> m_contexts; ///< Context of each variable
+	std::vector<std::vector<value_t> > m_cache; ///< Cache tables (empty if not cached)
+	size_t m_cache_bytes;				///< Memory used by the cache tables
+	std::shared_ptr<std::vector<std::mutex> > m_locks; ///< Cache locks (if shared by threads)
+
+	search_state m_state;				///< State of the (sequential) search
+	bool m_probe;						///< Probe mode (follow the heuristic policy)
+	std::vector<value_t> m_incumbent;	///< Best known policy of each root (during run)
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_AOBB_H_ */
@@ -0,0 +1,476 @@
+/*
+ * aobf.h
+ *
+ *  Created on: 22 Sep 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file aobf.h
+/// \brief Best-first AND/OR search for IDs
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_AOBF_H_
+#define IBM_MERLIN_AOBF_H_
+
+#include "aobb.h"
+
+namespace merlin {
+
+/**
+ * Best-First AND/OR search (AOBF)
+ *
+ * Models supported: ID
+ *
+ * AO* style search over the context minimal AND/OR graph of the pseudo tree
+ * used by AOBB (OR nodes with the same context are merged). Every node keeps
+ * an upper bound value q (the MBE heuristic at the tips, see aobb) and a lower
+ * bound value l. At each step the best partial solution graph is traced from
+ * the root (following the child with the largest upper bound at decision nodes)
+ * and one of its tip nodes is expanded; the values of the new nodes are then
+ * revised bottom-up along all the ancestors of the expanded node.
+ *
+ * The lower bound of a tip node is the expected utility of the heuristic
+ * (greedy) policy below it, as computed by the AOBB probe, and the lower bound
+ * of a decision node is the largest one of its children. Therefore the upper
+ * bound of the root comes from the frontier and its lower bound from the best
+ * policy found so far; both are reported as the search progresses, and the
+ * search can be stopped (TimeLimit) with a certified gap.
+ *
+ * The explicated graph is kept in a node arena (a vector of nodes that refer
+ * to each other by their index). The children of a node are a contiguous
+ * range of a flat index array (they are all generated at once), and the
+ * parents of a node (several for a merged OR node) are a list threaded
+ * through a flat array of edges, so a node owns no heap memory. The search
+ * is also stopped with its current bounds once the explicated graph (nodes,
+ * edges and the context tables) exceeds the Memory budget, which bounds the
+ * size of the graph as well as that of the cache used by the probes.
+ *
+ */
+class aobf : public aobb {
+public:
+	typedef aobb::findex findex;        ///< Factor index
+	typedef aobb::vindex vindex;        ///< Variable index
+	typedef aobb::flist flist;          ///< Collection of factor indices
+	typedef aobb::value_t value_t;      ///< Node value (probability, utility)
+
+	///
+	/// \brief Node of the explicated AND/OR search graph.
+	///
+	struct node {
+		vindex var;						///< Variable (-1 for the dummy root)
+		size_t val;						///< Value (AND nodes) or context index (OR nodes)
+		bool is_and;					///< AND or OR node
+		bool expanded;					///< Children generated
+		bool solved;					///< Value is exact
+		size_t best;					///< Marked child (decision OR nodes)
+		value_t arc;					///< Arc weight (AND nodes)
+		value_t q;						///< Upper bound value
+		value_t l;						///< Lower bound value
+		size_t child;					///< First child (in the child array)
+		size_t num_children;			///< Number of children
+		size_t parent;					///< First parent edge (-1 if none)
+	};
+
+public:
+
+	///
+	/// \brief Default constructor.
+	///
+	aobf() : aobb() {
+	}
+
+	///
+	/// \brief Constructor with a graphical model.
+	///
+	aobf(const limid& lm) : aobb(lm) {
+	}
+
+	///
+	/// \brief Clone the algorithm.
+	/// \return the pointer to the new object containing the cloned algorithm.
+	///
+	virtual aobf* clone() const {
+		aobf* lm = new aobf(*this);
+		return lm;
+	}
+
+	///
+	/// \brief Get the number of nodes in the explicated search graph.
+	///
+	size_t get_num_nodes() const {
+		return m_nodes.size();
+	}
+
+	///
+	/// \brief Get the memory used by the explicated search graph (in MBytes).
+	///
+	double get_graph_memory() const {
+		size_t bytes = m_nodes.capacity() * sizeof(node)
+			+ m_child.capacity() * sizeof(size_t)
+			+ m_parent.capacity() * sizeof(std::pair<size_t, size_t>)
+			+ m_table.capacity() * sizeof(std::unordered_map<size_t, size_t>);
+		for (size_t y = 0; y < m_table.size(); ++y) { // buckets and entries
+			bytes += m_table[y].bucket_count() * sizeof(void*)
+				+ m_table[y].size() * (sizeof(std::pair<const size_t, size_t>) + sizeof(void*));
+		}
+		return bytes / (1024.0 * 1024.0);
+	}
+
+	///
+	/// \brief Run best-first AND/OR search.
+	///
+	virtual void run() {
+
+		// Initialize the algorithm
+		init();
+
+		m_steps = 0;
+		m_probe = true; // tip nodes are evaluated by probing
+		clear_cache();
+
+		// Total probability mass (needed to undo the utility shift)
+		std::cout << "Begin probing ..." << std::endl;
+		value_t v = solve(m_state);
+		m_mass = v.first;
+		m_lb = v.second + m_shift * v.first;
+		m_ub += m_shift * v.first;
+		std::cout << "End probing." << std::endl;
+
+		// Create the dummy root node (its children are the pseudo tree roots)
+		m_nodes.clear();
+		m_child.clear();
+		m_parent.clear();
+		m_table.clear();
+		m_table.resize(m_gmo.nvar());
+		node root;
+		root.var = vindex(-1);
+		root.val = 0;
+		root.is_and = true;
+		root.expanded = false;
+		root.solved = false;
+		root.best = 0;
+		root.arc = m_const;
+		root.q = root.l = m_const;
+		root.child = 0;
+		root.num_children = 0;
+		root.parent = size_t(-1);
+		m_nodes.push_back(root);
+
+		std::cout << "Begin best-first AND/OR search ..." << std::endl;
+		report();
+		bool memout = false;
+		while (m_nodes[0].solved == false) {
+			if (m_time_limit > 0 && timeSystem() - m_start_time > m_time_limit) {
+				m_state.timeout = true;
+				break;
+			}
+			if (m_steps % 100 == 0 && get_graph_memory() > m_memory) {
+				memout = true;
+				break;
+			}
+
+			size_t n = select();
+			expand(n);
+			revise(n);
+			++m_steps;
+
+			if (m_steps % 1000 == 0) {
+				report();
+			}
+		}
+
+		update_bounds();
+		std::cout << "End best-first AND/OR search." << std::endl;
+		std::cout << "Nodes expanded: " << m_steps << ", explicated: "
+			<< m_nodes.size() << " (" << get_graph_memory() << " MB)" << std::endl;
+		if (m_state.timeout || memout) {
+			std::cout << (memout ? "Memory limit reached." : "Time limit reached.") << std::endl;
+			std::cout << "Lower Bound on MEU value is " << m_lb << "\n";
+			std::cout << "Upper Bound on MEU value is " << m_ub << "\n";
+		} else {
+			std::cout << "MEU value is " << m_lb << "\n";
+		}
+		std::cout << "CPU time is " << (timeSystem() - m_start_time) << " seconds" << std::endl;
+		std::cout << "Done." << std::endl << std::endl;
+	}
+
+protected:
+
+	///
+	/// \brief Name of the algorithm.
+	///
+	virtual const char* name() const {
+		return "AOBF";
+	}
+
+	///
+	/// \brief Update the bounds on the MEU from the root node.
+	///
+	void update_bounds() {
+		const node& root = m_nodes[0];
+		if (root.expanded == false) return;
+		m_ub = std::min(m_ub, root.q.second + m_shift * m_mass);
+		m_lb = std::max(m_lb, root.l.second + m_shift * m_mass);
+		if (root.solved) {
+			m_lb = m_ub = root.q.second + m_shift * m_mass;
+		}
+	}
+
+	///
+	/// \brief Report the current bounds on the MEU (if changed).
+	///
+	void report() {
+		double lb = m_lb, ub = m_ub;
+		update_bounds();
+		if (m_steps == 0 || lb != m_lb || ub != m_ub) {
+			std::cout << "[" << (timeSystem() - m_start_time) << "] "
+				<< m_lb << " (lower bound), " << m_ub << " (upper bound), "
+				<< m_steps << " expansions, " << m_nodes.size() << " nodes"
+				<< std::endl;
+		}
+	}
+
+	///
+	/// \brief Set the current assignment to the context of an OR node.
+	///
+	void assign_context(size_t n) {
+		const node& nd = m_nodes[n];
+		const variable_set& ctx = m_contexts[nd.var];
+		size_t i = nd.val;
+		for (size_t j = 0; j < ctx.size(); ++j) {
+			size_t k = ctx[j].states();
+			m_state.assignment[ctx[j].label()] = i % k;
+			i /= k;
+		}
+	}
+
+	///
+	/// \brief Find a tip node of the best partial solution graph.
+	///
+	size_t select() const {
+		size_t n = 0;
+		while (true) {
+			const node& nd = m_nodes[n];
+			if (nd.is_and) {
+				if (nd.expanded == false) {
+					return n;
+				}
+				for (size_t i = 0; i < nd.num_children; ++i) {
+					if (m_nodes[child(nd, i)].solved == false) {
+						n = child(nd, i);
+						break;
+					}
+				}
+			} else if (m_vtypes[nd.var] == 'd') {
+				n = child(nd, nd.best);
+			} else { // the unsolved child with the largest upper bound
+				size_t c = nd.num_children;
+				for (size_t i = 0; i < nd.num_children; ++i) {
+					const node& ch = m_nodes[child(nd, i)];
+					if (ch.solved == false && (c == nd.num_children ||
+							ch.q.second > m_nodes[child(nd, c)].q.second)) {
+						c = i;
+					}
+				}
+				n = child(nd, c);
+			}
+		}
+	}
+
+	///
+	/// \brief Expand an AND node: generate (or retrieve) its OR children,
+	///	together with their AND children (the new tip nodes).
+	///
+	void expand(size_t n) {
+		vindex x = m_nodes[n].var;
+		const std::vector<vindex>& ch = (x == vindex(-1)) ? m_roots : m_children[x];
+		std::vector<size_t> kids(ch.size()); // appended once the OR nodes exist
+		for (size_t i = 0; i < ch.size(); ++i) {
+
+			// Restore the assignment of X and of its context
+			if (x != vindex(-1)) {
+				assign_context(m_parent[m_nodes[n].parent].first);
+				m_state.assignment[x] = m_nodes[n].val;
+			}
+
+			vindex y = ch[i];
+			size_t key = sub2ind(m_contexts[y], m_state.assignment);
+			std::unordered_map<size_t, size_t>::iterator it = m_table[y].find(key);
+			size_t c;
+			if (it != m_table[y].end()) {
+				c = it->second; // merge with an existing OR node
+			} else {
+				c = m_nodes.size();
+				m_table[y][key] = c;
+				node o;
+				o.var = y;
+				o.val = key;
+				o.is_and = false;
+				o.expanded = true;
+				o.solved = false;
+				o.best = 0;
+				o.child = m_child.size();
+				o.num_children = var(y).states();
+				o.parent = size_t(-1);
+				m_nodes.push_back(o);
+
+				// Generate the AND children (tip nodes)
+				for (size_t k = 0; k < var(y).states(); ++k) {
+					m_state.assignment[y] = k;
+					node a;
+					a.var = y;
+					a.val = k;
+					a.is_and = true;
+					a.expanded = false;
+					a.best = 0;
+					a.arc = arc(y, m_state.assignment);
+					a.child = 0;
+					a.num_children = 0;
+					a.parent = size_t(-1);
+					if (a.arc.first == 0.0) { // dead end
+						a.solved = true;
+						a.q = a.l = value_t(0.0, 0.0);
+					} else if (m_children[y].empty()) { // leaf
+						a.solved = true;
+						a.q = a.l = a.arc;
+					} else {
+						a.solved = false;
+						a.q = heuristic(y, m_state.assignment);
+						a.l = expand_and(y, m_state);	// probe (greedy policy)
+					}
+					m_child.push_back(m_nodes.size());
+					m_nodes.push_back(a);
+					add_parent(m_nodes.size() - 1, c);
+				}
+				evaluate(c);
+			}
+
+			add_parent(c, n);
+			kids[i] = c;
+		}
+
+		m_nodes[n].child = m_child.size();
+		m_nodes[n].num_children = kids.size();
+		m_child.insert(m_child.end(), kids.begin(), kids.end());
+		m_nodes[n].expanded = true;
+	}
+
+	///
+	/// \brief Get the i-th child of a node.
+	///
+	size_t child(const node& nd, size_t i) const {
+		return m_child[nd.child + i];
+	}
+
+	///
+	/// \brief Add an edge from a parent node to a node.
+	///
+	void add_parent(size_t n, size_t p) {
+		m_parent.push_back(std::make_pair(p, m_nodes[n].parent));
+		m_nodes[n].parent = m_parent.size() - 1;
+	}
+
+	///
+	/// \brief Recompute the values of a node from its children.
+	/// \return *true* if the node changed, *false* otherwise.
+	///
+	bool evaluate(size_t n) {
+		node& nd = m_nodes[n];
+		value_t q, l;
+		bool solved = true;
+		size_t best = nd.best;
+		if (nd.is_and) {
+			q = l = nd.arc;
+			for (size_t i = 0; i < nd.num_children; ++i) {
+				const node& ch = m_nodes[child(nd, i)];
+				q = combine(q, ch.q);
+				l = combine(l, ch.l);
+				solved = solved && ch.solved;
+			}
+		} else if (m_vtypes[nd.var] == 'd') {
+			best = 0;
+			size_t lbest = 0;
+			for (size_t i = 1; i < nd.num_children; ++i) {
+				const node& ch = m_nodes[child(nd, i)];
+				if (ch.q.second > m_nodes[child(nd, best)].q.second) best = i;
+				if (ch.l.second > m_nodes[child(nd, lbest)].l.second) lbest = i;
+			}
+			q = m_nodes[child(nd, best)].q;
+			l = m_nodes[child(nd, lbest)].l;
+			solved = m_nodes[child(nd, best)].solved;
+		} else {
+			q = l = value_t(0.0, 0.0);
+			for (size_t i = 0; i < nd.num_children; ++i) {
+				const node& ch = m_nodes[child(nd, i)];
+				q.first += ch.q.first;
+				q.second += ch.q.second;
+				l.first += ch.l.first;
+				l.second += ch.l.second;
+				solved = solved && ch.solved;
+			}
+		}
+
+		bool changed = (q != nd.q || l != nd.l || solved != nd.solved || best != nd.best);
+		nd.q = q;
+		nd.l = l;
+		nd.solved = solved;
+		nd.best = best;
+		return changed;
+	}
+
+	///
+	/// \brief Revise the values of the ancestors of a node (bottom-up).
+	///
+	void revise(size_t n) {
+		std::set<std::pair<size_t, size_t> > queue; // (level, node), deepest first
+		queue.insert(std::make_pair(level(n), n));
+		while (!queue.empty()) {
+			std::set<std::pair<size_t, size_t> >::iterator top = --queue.end();
+			size_t m = top->second;
+			queue.erase(top);
+			if (evaluate(m) || m == n) {
+				for (size_t e = m_nodes[m].parent; e != size_t(-1); e = m_parent[e].second) {
+					size_t p = m_parent[e].first;
+					queue.insert(std::make_pair(level(p), p));
+				}
+			}
+		}
+	}
+
+	///
+	/// \brief Level of a node in the search graph (the dummy root is 0).
+	///
+	size_t level(size_t n) const {
+		const node& nd = m_nodes[n];
+		if (nd.var == vindex(-1)) return 0;
+		return 2 * m_depth[nd.var] + (nd.is_and ? 2 : 1);
+	}
+
+protected:
+	// Members:
+
+	std::vector<node> m_nodes;			///< Explicated search graph (node arena)
+	std::vector<size_t> m_child;		///< Children of the nodes (a range for each node)
+	std::vector<std::pair<size_t, size_t> > m_parent; ///< Parent edges (parent, next edge of the same node)
+	std::vector<std::unordered_map<size_t, size_t> > m_table; ///< OR nodes by context (for each variable)
+	double m_mass;						///< Total probability mass
+	size_t m_steps;						///< Number of AND nodes expanded
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_AOBF_H_ */
@@ -50,6 +50,7 @@
 #include <iterator>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <functional>
 #include <algorithm>
 #include <deque>
@@ -64,6 +65,10 @@
 #include <limits>
 #include <numeric>
 #include <cmath>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 
 #endif /* IBM_MERLIN_BASE_H_ */
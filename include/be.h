@@ -28,6 +28,9 @@
 
 #include "limid.h"
 #include "algorithm.h"
+#include "checkpoint.h"
+#include "evaluator.h"
+#include "compressed_factor.h"
 
 namespace merlin {
 
@@ -55,6 +58,36 @@ namespace merlin {
  * order. Moreover, the parents sets of each decision variable are fixed and
  * given as input. The valuation algebra doesn't assume division.
  *
+ * With Checkpoint=<file> the messages of every processed bucket are appended
+ * to the file (flushed to disk every CheckpointInterval seconds), and with
+ * Resume=1 a run continues after the last bucket recorded in that file.
+ *
+ * With Scratch=<dir> the tables of at least ScratchThreshold MB are kept in
+ * memory-mapped files in that directory (see spill.h), so that the largest
+ * buckets may exceed the physical memory. The messages of a chance bucket
+ * are released as soon as the bucket is eliminated (only the decision
+ * buckets are needed afterwards, for the policy).
+ *
+ * With Compress=<eps> the messages waiting in a bucket are kept in compressed
+ * form (see compressed_factor.h, each entry within a relative error eps) and
+ * are combined into the products and sums of their bucket block by block,
+ * without ever being decompressed (see packed_tables). The utilities are then shifted
+ * to be non-negative, so that every table is non-negative and an entrywise
+ * bound L on |log x' - log x| can be carried through the elimination: a
+ * product or a ratio adds the bounds of its operands, a sum or a maximum
+ * keeps the largest one, and each compressed message adds its quantization
+ * error. The bounds of the root constants give an interval around the MEU,
+ * whose half-width is reported as the error bound (the policy factors are
+ * those of the shifted utilities and have the same argmax).
+ *
+ * With Sensitivity=1 the optimal policy is held fixed and one adjoint pass
+ * (see evaluator.h) gives the derivative of the MEU with respect to every
+ * entry of every input table, as one factor per input factor.
+ *
+ * With Output=<file> the policy is written to the file (see write_policy in
+ * writer.h), in binary form with Binary=1; the policy factors are printed
+ * to the log only with Debug=1.
+ *
  */
 class be : public limid, public algorithm {
 public:
@@ -65,7 +98,7 @@ public:
 	///
 	/// \brief Properties of the algorithm
 	///
-	MER_ENUM( Property , Order,Debug );
+	MER_ENUM( Property , Order,Seed,Debug,Checkpoint,CheckpointInterval,Resume,Scratch,ScratchThreshold,Sensitivity,Compress,Output,Binary,Relabel,Memo );
 	MER_ENUM( Operator , Sum,Max,Min );
 
 public:
@@ -73,14 +106,14 @@ public:
 	///
 	/// \brief Default constructor.
 	///
-	be() : limid() {
+	be() : limid(), m_meu_error(0.0) {
 		set_properties();
 	}
 
 	///
 	/// \brief Constructor with a graphical model.
 	///
-	be(const limid& lm) : limid(lm), m_gmo(lm) {
+	be(const limid& lm) : limid(lm), m_gmo(lm), m_meu_error(0.0) {
 		clear_factors();
 		set_properties();
 	}
@@ -96,10 +129,10 @@ public:
 
 	// Can be an optimization algorithm or a summation algorithm....
 	double ub() const {
-		throw std::runtime_error("Not implemented");
+		return m_meu;
 	}
 	double lb() const {
-		throw std::runtime_error("Not implemented");
+		return m_meu;
 	}
 	std::vector<size_t> best_config() const {
 		throw std::runtime_error("Not implemented");
@@ -129,13 +162,42 @@ public:
 		throw std::runtime_error("Not implemented");
 	}
 
+	///
+	/// \brief Set the variable elimination order.
+	///
+	void set_order(const variable_order_t& ord) {
+		m_order = ord;
+	}
+
+	///
+	/// \brief Get the optimal decision policy (one factor per decision).
+	///
+	const std::map<vindex, factor>& get_policy() const {
+		return m_policy;
+	}
+
+	///
+	/// \brief Get the derivatives of the MEU w.r.t. the input tables
+	/// (Sensitivity=1), aligned with the factors of the model.
+	///
+	const std::vector<factor>& get_sensitivity() const {
+		return m_sensitivity;
+	}
+
+	///
+	/// \brief Get the bound on the error of the MEU due to compression.
+	///
+	double get_error_bound() const {
+		return m_meu_error;
+	}
+
 	///
 	/// \brief Set the properties of the algorithm.
 	/// \param opt 	The string containing comma separated property value pairs
 	///
 	virtual void set_properties(std::string opt = std::string()) {
 		if (opt.length() == 0) {
-			set_properties("Order=MinFill,Debug=1");
+			set_properties("Order=MinFill,Seed=0,Debug=1,CheckpointInterval=60,Resume=0,ScratchThreshold=256,Sensitivity=0,Compress=0,Binary=0,Relabel=0,Memo=0");
 			return;
 		}
 		std::vector<std::string> strs = merlin::split(opt, ',');
@@ -146,9 +208,45 @@ public:
 				m_order.clear();
 				m_order_method = OrderMethod(asgn[1].c_str());
 				break;
+			case Property::Seed:
+				m_seed = strtoul(asgn[1].c_str(), NULL, 10);
+				break;
 			case Property::Debug:
 				m_debug = (atol(asgn[1].c_str()) == 0) ? false : true;
 				break;
+			case Property::Memo:
+				m_memo = atof(asgn[1].c_str());
+				break;
+			case Property::Checkpoint:
+				m_checkpoint = asgn.size() > 1 ? asgn[1] : std::string();
+				break;
+			case Property::CheckpointInterval:
+				m_checkpoint_interval = atof(asgn[1].c_str());
+				break;
+			case Property::Resume:
+				m_resume = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
+			case Property::Scratch:
+				m_scratch = asgn.size() > 1 ? asgn[1] : std::string();
+				break;
+			case Property::ScratchThreshold:
+				m_scratch_threshold = atof(asgn[1].c_str());
+				break;
+			case Property::Sensitivity:
+				m_do_sensitivity = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
+			case Property::Compress:
+				m_compress = atof(asgn[1].c_str());
+				break;
+			case Property::Output:
+				m_output = asgn.size() > 1 ? asgn[1] : std::string();
+				break;
+			case Property::Binary:
+				m_binary = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
+			case Property::Relabel:
+				m_relabel = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
 			default:
 				break;
 			}
@@ -193,8 +291,10 @@ public:
 		std::cout << " + models supported : ID" << std::endl;
 		std::cout << " + algorithm        : BE" << std::endl;
 
-		// Construct the elimination ordering
-		m_order = m_gmo.order(m_order_method);
+		// Construct the elimination ordering (unless given)
+		if (m_order.size() == 0) {
+			m_order = m_gmo.order(m_order_method, m_seed);
+		}
 
 		// Get the induced width of the order
 		size_t wstar = m_gmo.induced_width(m_order);
@@ -220,55 +320,78 @@ public:
 			<< (timeSystem() - m_start_time) << " seconds." << std::endl;
 	}
 
-	///
-	/// \brief Update the adjacencies with a new factor
-	///
-	void insert(std::vector<flist>& adj, findex fid, const factor& f,
-			vector<vindex>::const_iterator x,
-			const variable_order_t& ord) {
-		for (vector<vindex>::const_iterator y = x+1;
-				y != ord.end(); ++y) {
-			variable VY = var(*y);
-			if (f.vars().contains(VY)) {
-				adj[*y] |= fid;
-				break;
-			}
-		}
-	}
-
 
 	///
 	/// \brief Run bucket elimination for IDs.
 	///
 	virtual void run() {
 
+		// Products over the shared tables are memoized for this run only
+		factor::memo memo((size_t)(m_memo * 1024 * 1024));
+		factor::memo::scope active(m_memo > 0 ? &memo : NULL);
+
+		// Solve the model relabeled by the elimination order instead
+		if (m_relabel) {
+			run_relabeled();
+			return;
+		}
+
+		// Load the checkpoint (it also fixes the elimination order)
+		checkpoint ckpt;
+		std::vector<checkpoint::bucket> done;
+		bool resumed = false;
+		if (m_resume && !m_checkpoint.empty()) {
+			if (m_compress > 0) {
+				throw std::runtime_error("BE cannot resume a checkpoint with compression.");
+			}
+			resumed = ckpt.load(m_checkpoint, "BE", m_gmo, m_order, done);
+		}
+
+		// Spill the large tables of this run to the scratch directory
+		spill::scope spilled(m_scratch, (size_t)(m_scratch_threshold * 1024 * 1024));
+
 		// Initialize the algorithm
 		init();
 
 		// Get the input factors
 		std::vector<factor> fin(m_gmo.get_factors());
 		findex fid = fin.size();
+		double mem_usage = 0; // all tables, including the released ones (MB)
+		for (size_t i = 0; i < fin.size(); ++i) {
+			mem_usage += ((double)fin[i].numel() * sizeof(double) / (1024 * 1024));
+		}
 		flist roots; // constant factors
 		std::map<findex, int> ftypes; // factor types
 
+		// Compression: non-negative utilities and the error bound of each table
+		double shift = 0.0;
+		packed_tables packed(fin, m_compress);
+		std::vector<double> lerr(fin.size(), 0.0);
+		if (m_compress > 0) {
+			for (size_t i = 0; i < fin.size(); ++i) {
+				if (fin[i].get_type() == factor::FactorType::Utility && fin[i].min() < 0) {
+					double m = fin[i].min();
+					fin[i] -= m;
+					shift += m;
+				}
+			}
+		}
+
 		if (m_debug) {
 			std::cout << "Partition factors into buckets ..." << std::endl;
 		}
 
-		// Partition into buckets: mark factors depending on variable i
+		// Partition into buckets: each factor goes to its first variable
+		std::vector<size_t> position(m_gmo.nvar());
+		for (size_t i = 0; i < m_order.size(); ++i) {
+			position[m_order[i]] = i;
+		}
 		vector<flist> vin(m_gmo.nvar());
-		vector<bool> used(fin.size(), false);
+		for (size_t i = 0; i < fin.size(); ++i) {
+			place(fin[i].vars(), i, position, vin, roots);
+		}
 		for (vector<vindex>::const_iterator x = m_order.begin();
 				x != m_order.end(); ++x) {
-			// Mark all remaining factors depending on variable *x
-			variable VX = var(*x);
-			for (size_t i = 0; i < fin.size(); ++i) {
-				if (used[i] == false && fin[i].vars().contains(VX)) {
-					vin[*x] |= i;
-					used[i] = true;
-				}
-			}
-
 			if (m_debug) {
 				std::cout << " Bucket " << *x << ":   ";
 				std::copy(vin[*x].begin(), vin[*x].end(),
@@ -284,126 +407,165 @@ public:
 			std::cout << "Finished initializing the buckets." << std::endl;
 		}
 
+		// Replay the messages of the buckets completed before the checkpoint
+		size_t start = 0;
+		for (size_t k = 0; k < done.size(); ++k) {
+			for (size_t j = 0; j < done[k].messages.size(); ++j) {
+				const factor& f = done[k].messages[j];
+				fin.push_back(f);
+				lerr.push_back(0.0);
+				place(f.vars(), fid, position, vin, roots);
+				fid++;
+				mem_usage += ((double)f.numel() * sizeof(double) / (1024 * 1024));
+			}
+			start = done[k].position + 1;
+		}
+		for (size_t k = 0; k < start; ++k) {
+			vindex y = m_order[k];
+			if (m_vtypes[y] == 'c') {
+				for (flist::const_iterator i = vin[y].begin(); i != vin[y].end(); ++i) {
+					fin[*i] = factor(); // already eliminated
+				}
+			}
+		}
+		if (resumed) {
+			std::cout << "Resumed from checkpoint " << m_checkpoint << " after "
+				<< start << " of " << m_order.size() << " buckets." << std::endl;
+		}
+		if (!m_checkpoint.empty()) {
+			ckpt.open(m_checkpoint, "BE", m_gmo, m_order,
+				m_checkpoint_interval, resumed);
+		}
+
 		// Forward pass: eliminate variables one at a time
 		std::cout << "Begin variable elimination ..." << std::endl;
-		for (vector<vindex>::const_iterator x = m_order.begin();
+		for (vector<vindex>::const_iterator x = m_order.begin() + start;
 				x != m_order.end(); ++x) {
 
 			// Get the corresponding variable object
 			variable VX = var(*x);
 			if (vin[*x].size() == 0)
 				continue;  // check that we have some factors over this variable
+			findex first = fid; // first message generated by this bucket
 
 			// Partition the factors into probabilities (phi's) and utilities (psi's)
 			flist ids = vin[*x];  // list of all factor IDs contained in this bucket
 			flist phi, psi;
 			for (flist::const_iterator i = ids.begin(); i != ids.end(); ++i) {
 				findex id = *i;
-				if (fin[id].get_type() == factor::FactorType::Probability) {
+				if (packed.get_type(id) == factor::FactorType::Probability) {
 					phi |= id;
-				} else if (fin[id].get_type() == factor::FactorType::Utility) {
+				} else if (packed.get_type(id) == factor::FactorType::Utility) {
 					psi |= id;
 				}
 			}
 
 			// Process the bucket of the current variable
+			std::vector<factor> out;
 			if (m_vtypes[*x] == 'c') { // chance variable
-
 				std::cout << "  Eliminating (C) variable " << *x << std::endl;
 
-				// Multiply all probability factors
-				factor comb(1.0);
+				// Error of the product of the probability factors
+				double lcomb = 0.0;
 				for (flist::const_iterator i = phi.begin(); i != phi.end(); ++i) {
-					comb *= fin[*i];
+					lcomb += lerr[*i];
 				}
-
-				// Eliminate chance variable by summation
-				factor f = elim(comb, VX, Operator::Sum); // eliminate by summation
-				f.set_type(factor::FactorType::Probability); // probability factor
-				fin.push_back(f); // store the new factor
-				insert(vin, fid, f, x, m_order); // recompute and update adjacency
-				if (fin[fid].nvar() == 0) roots |= fid; // keep track of constants separately
-				fid++;
-
-				if (m_debug) {
-					std::cout << "    Prob: " << f << std::endl;
-				}
-
-				// Process each utility factor separately
+				eliminate_bucket(packed, phi, psi, VX, out);
+				lerr.push_back(lcomb);
 				for (flist::const_iterator j = psi.begin(); j != psi.end(); ++j) {
-					factor g = comb * fin[*j];
-					g = elim(g, VX, Operator::Sum);	// eliminate by summation
-					g = g / f; // divide by the previously computed probability
-					g.set_type(factor::FactorType::Utility); // utility factor
-					fin.push_back(g);				// store the new factor
-					insert(vin, fid, g, x, m_order); 	// recompute and update adjacency
-					if (fin[fid].nvar() == 0) roots |= fid; // keep track of constants separately
-					fid++;
-
-					if (m_debug) {
-						std::cout << "    Util: " << g << std::endl;
-					}
+					lerr.push_back(2 * lcomb + lerr[*j]);
 				}
 			} else if (m_vtypes[*x] == 'd') { // decision variable
-
 				std::cout << "  Eliminating (D) variable " << *x << std::endl;
 
-				// Process each probability factor separately
+				// Error of the sum of the utility factors
+				double lsum = 0.0;
+				for (flist::const_iterator j = psi.begin(); j != psi.end(); ++j) {
+					lsum = std::max(lsum, lerr[*j]);
+				}
+				eliminate_bucket(packed, phi, psi, VX, out);
 				for (flist::const_iterator i = phi.begin(); i != phi.end(); ++i) {
-					factor f = fin[*i].slice(VX, 0); // condition on any value
-					f.set_type(factor::FactorType::Probability); // probability factor
-					fin.push_back(f); // store the new factor
-					insert(vin, fid, f, x, m_order);  // recompute and update adjacency
-					if (fin[fid].nvar() == 0) roots |= fid; // keep track of constants separately
-					fid++;
-
-					if (m_debug) {
-						std::cout << "    Prob: " << f << std::endl;
-					}
+					lerr.push_back(lerr[*i]);
 				}
+				lerr.push_back(lsum);
+			}
 
-				// Process the utility factors
-				factor comb(0.0);
-				for (flist::const_iterator j = psi.begin(); j != psi.end(); ++j) {
-					comb += fin[*j];
-				}
-				factor g = comb.max(VX); 	// eliminate by maximization
-				g.set_type(factor::FactorType::Utility); // utility factor
-				fin.push_back(g);			// store the new factor
-				insert(vin, fid, g, x, m_order); // recompute and update adjacency
-				if (fin[fid].nvar() == 0) roots |= fid; // keep track of constants separately
+			// Store the new messages in their buckets
+			for (size_t j = 0; j < out.size(); ++j) {
+				fin.push_back(out[j]);
+				place(out[j].vars(), fid, position, vin, roots);
 				fid++;
 
 				if (m_debug) {
-					std::cout << "    Util: " << g << std::endl;
+					std::cout << (out[j].get_type() == factor::FactorType::Probability ?
+							"    Prob: " : "    Util: ") << out[j] << std::endl;
+				}
+			}
+
+			// Append the new messages to the checkpoint
+			ckpt.write(x - m_order.begin(), fin.begin() + first, fin.end());
+			for (findex i = first; i < fid; ++i) {
+				const compressed_factor* c = packed.pack(i);
+				if (c != NULL) {
+					lerr[i] += c->error();
+					mem_usage += ((double)c->bytes() / (1024 * 1024));
+				} else {
+					mem_usage += ((double)fin[i].numel() * sizeof(double) / (1024 * 1024));
+				}
+			}
+
+			// Release the tables of an eliminated chance bucket
+			if (m_vtypes[*x] == 'c') {
+				for (flist::const_iterator i = ids.begin(); i != ids.end(); ++i) {
+					packed.release(*i);
 				}
 			}
 		} // end for
+		ckpt.close();
 
 		// Compute the maximum expected utility by combining all constant
 		// probability and utility factors residing at the root(s)
 		factor P(1.0), U(0.0);
+		double lp = 0.0, lu = 0.0;
 		for (size_t i = 0; i < roots.size(); ++i) {
 			findex id = roots[i];
 			if (fin[id].get_type() == factor::FactorType::Probability) {
 				P *= fin[id];
+				lp += lerr[id];
 			} else if (fin[id].get_type() == factor::FactorType::Utility) {
 				U += fin[id];
+				lu = std::max(lu, lerr[id]);
 			}
 		}
 		factor F = P*U;
 		m_meu = F.max();
 
+		// Undo the shift; the MEU is within the corners of the error bounds
+		m_meu_error = 0.0;
+		if (m_compress > 0) {
+			double p = P.max(), u = U.max();
+			m_meu = p * (u + shift);
+			for (int a = -1; a <= 1; a += 2) {
+				for (int b = -1; b <= 1; b += 2) {
+					double c = p * std::exp(a * lp) * (u * std::exp(b * lu) + shift);
+					m_meu_error = std::max(m_meu_error, std::fabs(c - m_meu));
+				}
+			}
+		}
+
 		std::cout << "End variable elimination." << std::endl;
 		std::cout << "MEU value is " << m_meu << "\n";
+		if (m_compress > 0) {
+			std::cout << "MEU error bound (compression) is " << m_meu_error << std::endl;
+		}
 		std::cout << "CPU time is " << timeSystem() - m_start_time << " seconds" << std::endl;
 
 		// Memory usage
-		double mem_usage = 0;
-		for (size_t i = 0; i < fin.size(); ++i) {
-			mem_usage += ((double)fin[i].numel() * sizeof(double) / (1024 * 1024)); // MB
-		}
 		std::cout << "Memory usage is " << mem_usage << " MBytes" << std::endl;
+		if (!m_scratch.empty()) {
+			std::cout << "Scratch usage is " << (double)spilled.peak_bytes() / (1024 * 1024)
+				<< " MBytes (peak)" << std::endl;
+		}
 
 		// Assemble the decision policy by going backward.
 		std::cout << "Begin building optimal policy ..." << std::endl;
@@ -423,15 +585,17 @@ public:
 			factor P(1.0), U(0.0);
 			for (flist::const_iterator i = ids.begin(); i != ids.end(); ++i) {
 				findex id = *i;
-				if (fin[id].get_type() == factor::FactorType::Probability) {
-					P *= fin[id];
-				} else if (fin[id].get_type() == factor::FactorType::Utility) {
-					U += fin[id];
+				if (packed.get_type(id) == factor::FactorType::Probability) {
+					packed.multiply_into(P, id);
+				} else if (packed.get_type(id) == factor::FactorType::Utility) {
+					packed.add_into(U, id);
 				}
 			}
 
 			factor F = P*U;
-			std::cout << "  Policy for decision " << *x << " is: " << F << std::endl;
+			if (m_debug) {
+				std::cout << "  Policy for decision " << *x << " is: " << F << std::endl;
+			}
 			m_policy[*x] = F;
 			mem_usage += ((double)F.numel() * sizeof(double) / (1024*1024)); // MBytes
 		}
@@ -439,6 +603,76 @@ public:
 		std::cout << "End building optimal policy." << std::endl;
 		std::cout << "Estimated memory usage is " << mem_usage << " MBytes" << std::endl;
 		std::cout << "Done." << std::endl << std::endl;
+
+		finish();
+	}
+
+	///
+	/// \brief Run bucket elimination over the model relabeled by the
+	/// elimination order, then map the policy back to the original labels.
+	///
+	/// The i-th variable of the order becomes variable i (see limid::relabel),
+	/// so the variable of a bucket is the first one, ie the one that changes
+	/// the fastest, in the scopes of all its factors: summing or maximizing
+	/// it out reduces contiguous runs of entries.
+	///
+	void run_relabeled() {
+		if (!m_checkpoint.empty()) {
+			throw std::runtime_error("BE cannot checkpoint a relabeled model.");
+		}
+
+		// Elimination order and renaming
+		if (m_order.size() == 0) {
+			m_order = m_gmo.order(m_order_method, m_seed);
+		}
+		const size_t n = m_gmo.nvar();
+		std::vector<vindex> to(n), from(n);
+		variable_order_t identity(n);
+		for (size_t k = 0; k < n; ++k) {
+			to[m_order[k]] = k;
+			from[k] = m_order[k];
+			identity[k] = k;
+		}
+
+		std::cout << "Relabeled the variables by elimination order (variable i is the i-th eliminated)" << std::endl;
+		be s(m_gmo.relabel(to));
+		s.set_order(identity);
+		s.m_debug = m_debug;
+		s.m_memo = m_memo;
+		s.m_scratch = m_scratch;
+		s.m_scratch_threshold = m_scratch_threshold;
+		s.m_compress = m_compress;
+		s.run();
+
+		m_meu = s.m_meu;
+		m_meu_error = s.m_meu_error;
+		m_policy.clear();
+		for (std::map<vindex, factor>::const_iterator pi = s.m_policy.begin();
+				pi != s.m_policy.end(); ++pi) {
+			m_policy[from[pi->first]] = pi->second.relabel(from);
+		}
+
+		finish();
+	}
+
+	///
+	/// \brief Write the policy and compute the sensitivities (if requested).
+	///
+	void finish() {
+		if (!m_output.empty()) {
+			write_policy(m_output.c_str(), m_policy, m_binary);
+			std::cout << "Policy written to " << m_output << std::endl;
+		}
+
+		// Derivatives of the MEU for the optimal policy
+		m_sensitivity.clear();
+		if (m_do_sensitivity && !m_gmo.islimid()) {
+			evaluator ev(m_gmo);
+			ev.set_properties(m_debug ? "Sensitivity=1,Debug=1" : "Sensitivity=1");
+			ev.set_policy(m_policy);
+			ev.run();
+			m_sensitivity = ev.get_sensitivity();
+		}
 	}
 
 
@@ -449,8 +683,22 @@ protected:
 	double m_meu;						///< Log maximum expected utility
 	std::map<vindex, factor> m_policy;	///< Optimal decision policy
 	OrderMethod m_order_method;			///< Variable ordering method
+	unsigned long m_seed;				///< Seed of the ordering tie-breaks
 	variable_order_t m_order;			///< Variable order
 	bool m_debug;						///< Internal debugging flag
+	double m_memo;						///< Memory for memoized products (MB, 0 if off)
+	std::string m_checkpoint;			///< Checkpoint file (empty if none)
+	double m_checkpoint_interval;		///< Seconds between checkpoint flushes
+	bool m_resume;						///< Resume from the checkpoint file
+	std::string m_scratch;				///< Scratch directory for large tables
+	double m_scratch_threshold;			///< Tables spilled from this size up (MB)
+	bool m_do_sensitivity;				///< Compute the MEU sensitivities
+	double m_compress;					///< Relative error of compressed messages (0 if off)
+	double m_meu_error;					///< Error bound on the MEU (compression)
+	std::string m_output;				///< Policy output file (empty if none)
+	bool m_binary;						///< Binary policy output file
+	bool m_relabel;						///< Relabel the variables by elimination order
+	std::vector<factor> m_sensitivity;	///< Derivatives w.r.t. the input tables
 
 };
 
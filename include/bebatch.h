@@ -0,0 +1,408 @@
+/*
+ * bebatch.h
+ *
+ *  Created on: 17 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file bebatch.h
+/// \brief Bucket elimination for several scenarios of an ID at once
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_BEBATCH_H_
+#define IBM_MERLIN_BEBATCH_H_
+
+#include "limid.h"
+#include "algorithm.h"
+#include "factor_lanes.h"
+
+namespace merlin {
+
+/**
+ * Batched bucket elimination (BE) over K scenarios
+ *
+ * Models supported: ID
+ *
+ * A scenario is a variant of the ID that differs only in the values of its
+ * tables (same variables, same factors with the same scopes and types, in the
+ * same order). The first scenario is the model given to the constructor and
+ * the others are added with add_scenario() or listed in the property
+ * Scenarios=<file1>:<file2>:...
+ *
+ * Each table holds the K variants of its entries (see factor_lanes.h) and
+ * the buckets are processed exactly as in BE, so the order, the bucket
+ * partition, the scopes of the messages and the index traversals are computed
+ * once for all scenarios, while the sums, divisions and maximizations are
+ * done lane by lane. The result is one MEU and one optimal policy per
+ * scenario (the argmax of lane k of a policy factor is the decision rule of
+ * scenario k).
+ *
+ */
+class bebatch : public limid, public algorithm {
+public:
+	typedef limid::findex findex;        ///< Factor index
+	typedef limid::vindex vindex;        ///< Variable index
+	typedef limid::flist flist;          ///< Collection of factor indices
+
+	///
+	/// \brief Properties of the algorithm
+	///
+	MER_ENUM( Property , Order,Seed,Scenarios,Debug,Memo );
+
+public:
+
+	///
+	/// \brief Default constructor.
+	///
+	bebatch() : limid() {
+		set_properties();
+	}
+
+	///
+	/// \brief Constructor with a graphical model (the first scenario).
+	///
+	bebatch(const limid& lm) : limid(lm), m_gmo(lm) {
+		clear_factors();
+		set_properties();
+	}
+
+	///
+	/// \brief Clone the algorithm.
+	/// \return the pointer to the new object containing the cloned algorithm.
+	///
+	virtual bebatch* clone() const {
+		bebatch* lm = new bebatch(*this);
+		return lm;
+	}
+
+	// MEU of the first scenario
+	double ub() const {
+		return m_meu.at(0);
+	}
+	double lb() const {
+		return m_meu.at(0);
+	}
+	std::vector<size_t> best_config() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	double logZ() const {
+		throw std::runtime_error("Not implemented");
+	}
+	double logZub() const {
+		throw std::runtime_error("Not implemented");
+	}
+	double logZlb() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	// No beliefs defined currently
+	const factor& belief(size_t) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const factor& belief(variable) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const factor& belief(variable_set) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const vector<factor>& beliefs() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	///
+	/// \brief Set the variable elimination order.
+	///
+	void set_order(const variable_order_t& ord) {
+		m_order = ord;
+	}
+
+	///
+	/// \brief Add a scenario (a variant of the tables of the model).
+	///
+	void add_scenario(const limid& lm) {
+		const std::vector<factor>& fs = m_gmo.get_factors();
+		const std::vector<factor>& gs = lm.get_factors();
+		bool match = (lm.nvar() == m_gmo.nvar() && gs.size() == fs.size());
+		for (size_t i = 0; match && i < fs.size(); ++i) {
+			match = (gs[i].vars() == fs[i].vars() &&
+					(gs[i].get_type() == factor::FactorType::Utility) ==
+					(fs[i].get_type() == factor::FactorType::Utility));
+		}
+		if (!match) {
+			throw std::runtime_error("Scenario does not match the structure of the model.");
+		}
+		m_scenarios.push_back(gs);
+	}
+
+	///
+	/// \brief Get the number of scenarios.
+	///
+	size_t num_scenarios() const {
+		return m_scenarios.size() + 1;
+	}
+
+	///
+	/// \brief Get the MEU of each scenario.
+	///
+	const std::vector<double>& get_meu() const {
+		return m_meu;
+	}
+
+	///
+	/// \brief Get the optimal decision policy of a scenario.
+	///
+	const std::map<vindex, factor>& get_policy(size_t k) const {
+		return m_policy.at(k);
+	}
+
+	///
+	/// \brief Set the properties of the algorithm.
+	/// \param opt 	The string containing comma separated property value pairs
+	///
+	virtual void set_properties(std::string opt = std::string()) {
+		if (opt.length() == 0) {
+			set_properties("Order=MinFill,Seed=0,Debug=0,Memo=0");
+			return;
+		}
+		std::vector<std::string> strs = merlin::split(opt, ',');
+		for (size_t i = 0; i < strs.size(); ++i) {
+			std::vector<std::string> asgn = merlin::split(strs[i], '=');
+			switch (Property(asgn[0].c_str())) {
+			case Property::Order:
+				m_order.clear();
+				m_order_method = OrderMethod(asgn[1].c_str());
+				break;
+			case Property::Seed:
+				m_seed = strtoul(asgn[1].c_str(), NULL, 10);
+				break;
+			case Property::Scenarios:
+				m_files = (asgn.size() > 1) ? merlin::split(asgn[1], ':') :
+					std::vector<std::string>();
+				break;
+			case Property::Debug:
+				m_debug = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
+			case Property::Memo:
+				m_memo = atof(asgn[1].c_str());
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	///
+	/// \brief Initialize the algorithm.
+	///
+	void init() {
+
+		// Start the timer and store it
+		m_start_time = timeSystem();
+
+		if (m_gmo.islimid()) {
+			throw std::runtime_error("Batched BE is only supported for standard IDs.");
+		}
+
+		// Read the scenarios listed in the properties
+		for (size_t i = 0; i < m_files.size(); ++i) {
+			limid lm;
+			lm.read(m_files[i].c_str());
+			add_scenario(lm);
+		}
+		m_files.clear();
+
+		// Prologue
+		std::cout << "Initialize solver ..." << std::endl;
+		std::cout << " + models supported : ID" << std::endl;
+		std::cout << " + algorithm        : BE (batched)" << std::endl;
+		std::cout << " + scenarios        : " << num_scenarios() << std::endl;
+
+		// Construct the elimination ordering (unless given)
+		if (m_order.size() == 0) {
+			m_order = m_gmo.order(m_order_method, m_seed);
+		}
+		std::cout << " + elimination      : ";
+		std::copy(m_order.begin(), m_order.end(),
+				std::ostream_iterator<size_t>(std::cout, " "));
+		std::cout << std::endl;
+		std::cout << " + induced width    : " << m_gmo.induced_width(m_order) << std::endl;
+
+		std::cout << "Initialization complete in "
+			<< (timeSystem() - m_start_time) << " seconds." << std::endl;
+	}
+
+	///
+	/// \brief Run bucket elimination on all scenarios at once.
+	///
+	virtual void run() {
+
+		// Products over the shared tables are memoized for this run only
+		factor::memo memo((size_t)(m_memo * 1024 * 1024));
+		factor::memo::scope active(m_memo > 0 ? &memo : NULL);
+
+		// Initialize the algorithm
+		init();
+
+		// Input factors, one lane per scenario
+		const size_t K = num_scenarios();
+		const std::vector<factor>& fs = m_gmo.get_factors();
+		std::vector<factor_lanes> fin;
+		for (size_t i = 0; i < fs.size(); ++i) {
+			std::vector<factor> variants(1, fs[i]);
+			for (size_t k = 0; k + 1 < K; ++k) {
+				variants.push_back(m_scenarios[k][i]);
+			}
+			fin.push_back(factor_lanes(variants));
+		}
+
+		// Partition into buckets: each factor goes to its first variable
+		std::vector<size_t> position(m_gmo.nvar());
+		for (size_t i = 0; i < m_order.size(); ++i) {
+			position[m_order[i]] = i;
+		}
+		std::vector<flist> vin(m_gmo.nvar());
+		flist roots;
+		for (findex i = 0; i < fin.size(); ++i) {
+			place(fin[i].vars(), i, position, vin, roots);
+		}
+
+		// Forward pass: eliminate variables one at a time
+		std::cout << "Begin variable elimination ..." << std::endl;
+		std::vector<vindex> decisions;
+		for (size_t p = 0; p < m_order.size(); ++p) {
+			vindex x = m_order[p];
+			variable VX = var(x);
+			if (m_vtypes[x] == 'd') {
+				decisions.push_back(x);
+			}
+			if (vin[x].size() == 0)
+				continue;
+
+			flist phi, psi;
+			for (flist::const_iterator i = vin[x].begin(); i != vin[x].end(); ++i) {
+				if (fin[*i].get_type() == factor::FactorType::Probability) {
+					phi |= *i;
+				} else {
+					psi |= *i;
+				}
+			}
+
+			std::vector<factor_lanes> out;
+			if (m_debug) {
+				std::cout << "  Eliminating (" << (m_vtypes[x] == 'c' ? 'C' : 'D')
+					<< ") variable " << x << std::endl;
+			}
+			eliminate_bucket(lanes(fin, K), phi, psi, VX, out);
+
+			// Release an eliminated chance bucket
+			if (m_vtypes[x] == 'c') {
+				for (flist::const_iterator i = vin[x].begin(); i != vin[x].end(); ++i) {
+					fin[*i] = factor_lanes();
+				}
+			}
+
+			for (size_t j = 0; j < out.size(); ++j) {
+				fin.push_back(out[j]);
+				place(fin.back().vars(), fin.size() - 1, position, vin, roots);
+			}
+		}
+
+		// MEU of each scenario from the constants at the root(s)
+		factor_lanes P(1.0, K), U(0.0, K);
+		for (flist::const_iterator i = roots.begin(); i != roots.end(); ++i) {
+			if (fin[*i].get_type() == factor::FactorType::Probability) {
+				P *= fin[*i];
+			} else {
+				U += fin[*i];
+			}
+		}
+		factor_lanes F = P * U;
+		m_meu.assign(F[0], F[0] + K);
+
+		std::cout << "End variable elimination." << std::endl;
+		for (size_t k = 0; k < K; ++k) {
+			std::cout << "MEU value of scenario " << k << " is " << m_meu[k] << std::endl;
+		}
+
+		// Policies: the decision buckets, split into one factor per scenario
+		m_policy.assign(K, std::map<vindex, factor>());
+		for (size_t j = 0; j < decisions.size(); ++j) {
+			vindex x = decisions[j];
+			factor_lanes P(1.0, K), U(0.0, K);
+			for (flist::const_iterator i = vin[x].begin(); i != vin[x].end(); ++i) {
+				if (fin[*i].get_type() == factor::FactorType::Probability) {
+					P *= fin[*i];
+				} else {
+					U += fin[*i];
+				}
+			}
+			factor_lanes F = P * U;
+			for (size_t k = 0; k < K; ++k) {
+				m_policy[k][x] = F.lane(k);
+			}
+			if (m_debug) {
+				std::cout << "  Policy for decision " << x << " is: " << F.lane(0) << std::endl;
+			}
+		}
+
+		std::cout << "CPU time is " << timeSystem() - m_start_time << " seconds" << std::endl;
+		std::cout << "Done." << std::endl << std::endl;
+	}
+
+protected:
+
+	///
+	/// \brief The tables of all scenarios, as combined by eliminate_bucket.
+	///
+	struct lanes {
+		const std::vector<factor_lanes>& fin;	///< Tables (one lane per scenario)
+		size_t k;								///< Number of scenarios
+
+		lanes(const std::vector<factor_lanes>& f, size_t k) : fin(f), k(k) {};
+		factor_lanes constant(double val) const {
+			return factor_lanes(val, k);
+		}
+		void multiply_into(factor_lanes& F, findex i) const {
+			F *= fin[i];
+		}
+		void add_into(factor_lanes& F, findex i) const {
+			F += fin[i];
+		}
+		factor_lanes slice(findex i, const variable& VX, size_t state) const {
+			return fin[i].condition(VX, state);
+		}
+	};
+
+	// Members:
+
+	limid m_gmo; 						///< Original influence diagram (first scenario)
+	std::vector<std::vector<factor> > m_scenarios;	///< Tables of the other scenarios
+	std::vector<std::string> m_files;	///< Scenario files (from the properties)
+	std::vector<double> m_meu;			///< Maximum expected utility of each scenario
+	std::vector<std::map<vindex, factor> > m_policy;	///< Optimal policy of each scenario
+	OrderMethod m_order_method;			///< Variable ordering method
+	unsigned long m_seed;				///< Seed of the ordering tie-breaks
+	variable_order_t m_order;			///< Variable order
+	bool m_debug;						///< Internal debugging flag
+	double m_memo;						///< Memory for memoized products (MB, 0 if off)
+
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_BEBATCH_H_ */
@@ -0,0 +1,374 @@
+/*
+ * checkpoint.h
+ *
+ *  Created on: 13 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file checkpoint.h
+/// \brief Checkpoint file for the bucket elimination schemes
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_CHECKPOINT_H_
+#define IBM_MERLIN_CHECKPOINT_H_
+
+#include "limid.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+namespace merlin {
+
+/**
+ * Checkpoint of the forward (elimination) pass of BE and MBE
+ *
+ * The file is an append-only log. A header identifies the algorithm, the
+ * model (domain sizes, number of input factors and a digest of their types,
+ * scopes and tables, so that a model whose values changed is not resumed)
+ * and the elimination order; then, for each processed bucket, a record holds the position of
+ * the bucket in the order followed by the messages it generated:
+ *
+ *   'B' <position> <count> <factor>... 'C' <position>
+ *
+ * A factor is stored as its type, its scope (labels and domain sizes) and
+ * its raw table. The input factors are not stored because they are read
+ * from the model and partitioned into the same buckets again on resume;
+ * replaying the messages in order (placed in buckets as the algorithm does)
+ * rebuilds the message list and the bucket contents exactly as they were.
+ *
+ * The messages are streamed to the file as soon as a bucket is processed,
+ * so each table is written once and the elimination never waits on a full
+ * dump of its state. Only the flush to disk (fsync) is periodic. A record
+ * that is cut short (eg, by a kill during a write) has no 'C' marker and is
+ * dropped on resume, together with anything that follows it.
+ */
+class checkpoint {
+public:
+	///
+	/// \brief Bucket record: the position of the bucket in the order and
+	/// the messages it generated.
+	///
+	struct bucket {
+		size_t position;
+		std::vector<factor> messages;
+	};
+
+	///
+	/// \brief Default constructor.
+	///
+	checkpoint() : m_file(NULL), m_interval(60), m_last_sync(0), m_valid_end(0) {};
+
+	///
+	/// \brief Destroy the checkpoint (flushes the file).
+	///
+	~checkpoint() {
+		close();
+	};
+
+	///
+	/// \brief Read a checkpoint file.
+	///
+	/// Loads the elimination order and the completed bucket records. If the
+	/// file does not exist nothing is loaded, and if it does not match the
+	/// algorithm or the model an exception is thrown.
+	/// \param path 	The checkpoint file
+	/// \param tag		The algorithm tag (eg, "BE" or "MBE i=4")
+	/// \param gm		The model
+	/// \param order	The elimination order (output)
+	/// \param buckets	The completed bucket records (output)
+	/// \return true if a checkpoint was loaded, false otherwise.
+	///
+	bool load(const std::string& path, const std::string& tag,
+			const graphical_model& gm, variable_order_t& order,
+			std::vector<bucket>& buckets) {
+
+		FILE* in = fopen(path.c_str(), "rb");
+		if (in == NULL) {
+			return false;
+		}
+
+		try {
+			read_header(in, tag, gm, order);
+			long end = ftell(in);
+			buckets.clear();
+			while (true) {
+				bucket b;
+				if (!read_bucket(in, gm, b)) break;
+				buckets.push_back(b);
+				end = ftell(in);
+			}
+			m_valid_end = end;
+		} catch (...) {
+			fclose(in);
+			throw;
+		}
+
+		fclose(in);
+		return true;
+	}
+
+	///
+	/// \brief Open the checkpoint for writing.
+	///
+	/// If \p append is true, the file is the one just loaded and is cut back
+	/// to the last complete bucket record; otherwise it is (re)created.
+	/// \param path 	The checkpoint file
+	/// \param tag		The algorithm tag
+	/// \param gm		The model
+	/// \param order	The elimination order
+	/// \param interval	The number of seconds between flushes to disk
+	/// \param append	Continue a loaded checkpoint
+	///
+	void open(const std::string& path, const std::string& tag,
+			const graphical_model& gm, const variable_order_t& order,
+			double interval, bool append) {
+
+		close();
+		m_interval = interval;
+		m_last_sync = timeSystem();
+		if (append) {
+			if (truncate(path.c_str(), m_valid_end) != 0 ||
+				(m_file = fopen(path.c_str(), "r+b")) == NULL) {
+				throw std::runtime_error("Cannot open checkpoint file " + path);
+			}
+			fseek(m_file, 0, SEEK_END);
+		} else {
+			m_file = fopen(path.c_str(), "wb");
+			if (m_file == NULL) {
+				throw std::runtime_error("Cannot open checkpoint file " + path);
+			}
+			write_header(tag, gm, order);
+			sync();
+		}
+	}
+
+	///
+	/// \brief Check if the checkpoint is open for writing.
+	///
+	bool is_open() const {
+		return (m_file != NULL);
+	}
+
+	///
+	/// \brief Append the record of a processed bucket.
+	/// \param position		The position of the bucket in the order
+	/// \param first		The first message generated by the bucket
+	/// \param last			Past the last message generated by the bucket
+	///
+	void write(size_t position, std::vector<factor>::const_iterator first,
+			std::vector<factor>::const_iterator last) {
+
+		if (m_file == NULL) return;
+
+		put_byte('B');
+		put_u64(position);
+		put_u64(last - first);
+		for (; first != last; ++first) {
+			put_factor(*first);
+		}
+		put_byte('C');
+		put_u64(position);
+		if (ferror(m_file)) {
+			throw std::runtime_error("Cannot write the checkpoint file.");
+		}
+
+		if (timeSystem() - m_last_sync >= m_interval) {
+			sync();
+		}
+	}
+
+	///
+	/// \brief Flush the checkpoint to disk.
+	///
+	void sync() {
+		if (m_file == NULL) return;
+		fflush(m_file);
+		fsync(fileno(m_file));
+		m_last_sync = timeSystem();
+	}
+
+	///
+	/// \brief Flush and close the checkpoint file.
+	///
+	void close() {
+		if (m_file != NULL) {
+			sync();
+			fclose(m_file);
+			m_file = NULL;
+		}
+	}
+
+private:
+	static const uint32_t s_version = 2;	///< File format version
+
+	// Writing
+
+	void put_byte(uint8_t b) {
+		fwrite(&b, 1, 1, m_file);
+	}
+	void put_u32(uint32_t v) {
+		fwrite(&v, sizeof(v), 1, m_file);
+	}
+	void put_u64(uint64_t v) {
+		fwrite(&v, sizeof(v), 1, m_file);
+	}
+	void put_factor(const factor& f) {
+		put_byte(f.get_type() == factor::FactorType::Utility ? 'U' : 'P');
+		put_u32(f.nvar());
+		const variable_set& vs = f.vars();
+		for (variable_set::const_iterator v = vs.begin(); v != vs.end(); ++v) {
+			put_u32(v->label());
+			put_u32(v->states());
+		}
+		put_u64(f.numel());
+		fwrite(f.table(), sizeof(double), f.numel(), m_file);
+	}
+
+	///
+	/// \brief Digest of the input factors (FNV-1a over their types, scopes
+	///	and the bits of their values).
+	///
+	static uint64_t digest(const graphical_model& gm) {
+		uint64_t h = 14695981039346656037ULL;
+		for (size_t i = 0; i < gm.num_factors(); ++i) {
+			const factor& f = gm.get_factor(i);
+			h = (h ^ (f.get_type() == factor::FactorType::Utility ? 'U' : 'P')) * 1099511628211ULL;
+			const variable_set& vs = f.vars();
+			for (variable_set::const_iterator v = vs.begin(); v != vs.end(); ++v) {
+				h = (h ^ v->label()) * 1099511628211ULL;
+			}
+			const double* x = f.table();
+			for (size_t j = 0; j < f.numel(); ++j) {
+				uint64_t bits = 0;
+				memcpy(&bits, &x[j], sizeof(bits));
+				h = (h ^ bits) * 1099511628211ULL;
+			}
+		}
+		return h;
+	}
+
+	void write_header(const std::string& tag, const graphical_model& gm,
+			const variable_order_t& order) {
+		fwrite("MERLCKPT", 1, 8, m_file);
+		put_u32(s_version);
+		put_u32(tag.size());
+		fwrite(tag.data(), 1, tag.size(), m_file);
+		put_u64(gm.nvar());
+		for (size_t i = 0; i < gm.nvar(); ++i) {
+			put_u32(gm.var(i).states());
+		}
+		put_u64(gm.num_factors());
+		put_u64(digest(gm));
+		put_u64(order.size());
+		for (size_t i = 0; i < order.size(); ++i) {
+			put_u32(order[i]);
+		}
+	}
+
+	// Reading
+
+	static bool get(FILE* in, void* p, size_t n) {
+		return (fread(p, 1, n, in) == n);
+	}
+	static uint32_t get_u32(FILE* in) {
+		uint32_t v;
+		if (!get(in, &v, sizeof(v))) throw std::runtime_error("Truncated checkpoint header.");
+		return v;
+	}
+	static uint64_t get_u64(FILE* in) {
+		uint64_t v;
+		if (!get(in, &v, sizeof(v))) throw std::runtime_error("Truncated checkpoint header.");
+		return v;
+	}
+
+	static void read_header(FILE* in, const std::string& tag,
+			const graphical_model& gm, variable_order_t& order) {
+		char magic[8];
+		if (!get(in, magic, 8) || std::string(magic, 8) != "MERLCKPT") {
+			throw std::runtime_error("Not a checkpoint file.");
+		}
+		if (get_u32(in) != s_version) {
+			throw std::runtime_error("Unsupported checkpoint version.");
+		}
+		std::string t(get_u32(in), ' ');
+		if (!get(in, &t[0], t.size()) || t != tag) {
+			throw std::runtime_error("Checkpoint was written by another algorithm (" + t + ").");
+		}
+		bool match = (get_u64(in) == gm.nvar());
+		for (size_t i = 0; match && i < gm.nvar(); ++i) {
+			match = (get_u32(in) == gm.var(i).states());
+		}
+		match = match && (get_u64(in) == gm.num_factors());
+		if (!match) {
+			throw std::runtime_error("Checkpoint does not match the model.");
+		}
+		if (get_u64(in) != digest(gm)) {
+			throw std::runtime_error("Checkpoint does not match the values of the model's tables.");
+		}
+		order.resize(get_u64(in));
+		for (size_t i = 0; i < order.size(); ++i) {
+			order[i] = get_u32(in);
+			if (order[i] >= gm.nvar()) {
+				throw std::runtime_error("Checkpoint does not match the model.");
+			}
+		}
+	}
+
+	// Read a complete bucket record; false at the end or on a partial record
+	static bool read_bucket(FILE* in, const graphical_model& gm, bucket& b) {
+		uint8_t tag;
+		uint64_t pos, count, numel;
+		if (!get(in, &tag, 1) || tag != 'B') return false;
+		if (!get(in, &pos, 8) || !get(in, &count, 8)) return false;
+		b.position = pos;
+		b.messages.resize(count);
+		for (size_t k = 0; k < count; ++k) {
+			uint8_t type;
+			uint32_t nv;
+			if (!get(in, &type, 1) || !get(in, &nv, 4)) return false;
+			variable_set vs;
+			for (size_t j = 0; j < nv; ++j) {
+				uint32_t label, states;
+				if (!get(in, &label, 4) || !get(in, &states, 4)) return false;
+				if (label >= gm.nvar() || states != gm.var(label).states()) return false;
+				vs |= gm.var(label);
+			}
+			if (!get(in, &numel, 8) || numel != vs.num_states()) return false;
+			factor f(vs, 0.0);
+			if (!get(in, &f[0], numel * sizeof(double))) return false;
+			f.set_type(type == 'U' ? factor::FactorType::Utility :
+					factor::FactorType::Probability);
+			b.messages[k] = f;
+		}
+		if (!get(in, &tag, 1) || tag != 'C') return false;
+		if (!get(in, &pos, 8) || pos != b.position) return false;
+		return true;
+	}
+
+private:
+	// Members:
+
+	FILE* m_file;				///< Checkpoint file (when writing)
+	double m_interval;			///< Seconds between flushes to disk
+	double m_last_sync;			///< Time of the last flush
+	long m_valid_end;			///< End of the last complete record (when loaded)
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_CHECKPOINT_H_ */
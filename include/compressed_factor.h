@@ -0,0 +1,376 @@
+/*
+ * compressed_factor.h
+ *
+ *  Created on: 18 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file compressed_factor.h
+/// \brief Lossy compressed storage of factor tables
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_COMPRESSED_FACTOR_H_
+#define IBM_MERLIN_COMPRESSED_FACTOR_H_
+
+#include "factor.h"
+
+#include <map>
+#include <functional>
+#include <stdint.h>
+
+namespace merlin {
+
+/**
+ * Compressed factor
+ *
+ * The table is cut into blocks of block_size entries and each block is
+ * quantized in the log domain: an entry is stored as a 16-bit code, a sign bit
+ * and 15 bits for log|x| on a uniform grid between the smallest and largest
+ * log|x| of its block (code 0 is an exact zero). The relative error of every
+ * entry is then bounded by half a grid step, ie |log x' - log x| <= step/2.
+ * A block whose dynamic range is too wide for the requested error bound is
+ * kept as raw doubles, so the bound always holds; error() is the largest
+ * log-domain error actually used by the quantized blocks.
+ *
+ * Only the quantized blocks have codes (at a per-block offset, as the raw
+ * blocks have their values). The table is decoded one block at a time
+ * (decode): apply() combines it into a factor and slice() conditions it on a
+ * variable while holding only a few decoded blocks, and decompress() gives
+ * back an ordinary factor.
+ */
+class compressed_factor {
+public:
+	typedef double value;						///< Type of the values
+	typedef factor::FactorType FactorType;		///< Type of the factor
+
+	static const size_t block_size = 256;		///< Entries per block
+
+	///
+	/// \brief Default constructor (an empty table).
+	///
+	compressed_factor() : m_numel(0), m_error(0.0), m_type(FactorType::Probability) {};
+
+	///
+	/// \brief Compress a factor.
+	/// \param f 	The factor
+	/// \param eps	The largest relative error of an entry
+	///
+	compressed_factor(const factor& f, double eps) :
+		m_v(f.vars()), m_numel(f.numel()), m_error(0.0), m_type(f.get_type()) {
+
+		double bound = std::log1p(eps); // allowed |log x' - log x|
+		size_t nb = (m_numel + block_size - 1) / block_size;
+		m_lo.resize(nb);
+		m_step.resize(nb);
+		m_raw.assign(nb, -1);
+		m_code.assign(nb, -1);
+		const value* t = f.table();
+		for (size_t b = 0; b < nb; ++b) {
+			size_t first = b * block_size, last = std::min(m_numel, first + block_size);
+
+			double lo = infty(), hi = -infty();
+			for (size_t i = first; i < last; ++i) {
+				if (t[i] != 0) {
+					double l = std::log(std::fabs(t[i]));
+					lo = std::min(lo, l);
+					hi = std::max(hi, l);
+				}
+			}
+			double step = (hi > lo) ? (hi - lo) / (s_levels - 1) : 0.0;
+			if (step / 2 > bound || (lo <= hi && !std::isfinite(hi - lo))) {
+				m_raw[b] = m_values.size(); // keep the block exact
+				m_values.insert(m_values.end(), t + first, t + last);
+				continue;
+			}
+
+			m_lo[b] = lo;
+			m_step[b] = step;
+			m_error = std::max(m_error, step / 2);
+			m_code[b] = m_codes.size();
+			for (size_t i = first; i < last; ++i) {
+				if (t[i] == 0) {
+					m_codes.push_back(0);
+					continue;
+				}
+				double l = std::log(std::fabs(t[i]));
+				uint16_t c = (step > 0) ?
+					(uint16_t)(1 + (size_t)((l - lo) / step + 0.5)) : 1;
+				m_codes.push_back((t[i] < 0) ? (c | 0x8000) : c);
+			}
+		}
+	}
+
+	// Accessors
+
+	const variable_set& vars() const { return m_v; }
+	size_t numel() const { return m_numel; }
+	bool empty() const { return m_numel == 0; }
+	FactorType get_type() const { return m_type; }
+
+	///
+	/// \brief Largest log-domain error of an entry (|log x' - log x|).
+	///
+	double error() const {
+		return m_error;
+	}
+
+	///
+	/// \brief Number of bytes used by the compressed table.
+	///
+	size_t bytes() const {
+		return m_codes.size() * sizeof(uint16_t) + m_values.size() * sizeof(value)
+			+ m_lo.size() * (2 * sizeof(double) + 2 * sizeof(long));
+	}
+
+	///
+	/// \brief Decode a block of the table.
+	/// \param b 	The block
+	/// \param out	The entries of the block (at most block_size)
+	///
+	void decode(size_t b, value* out) const {
+		size_t first = b * block_size, last = std::min(m_numel, first + block_size);
+		if (m_raw[b] >= 0) {
+			std::copy(&m_values[m_raw[b]], &m_values[m_raw[b]] + (last - first), out);
+			return;
+		}
+		double lo = m_lo[b], step = m_step[b];
+		const uint16_t* code = &m_codes[m_code[b]];
+		for (size_t i = first; i < last; ++i, ++out) {
+			uint16_t c = *code++;
+			if (c == 0) {
+				*out = 0.0;
+			} else {
+				double x = std::exp(lo + (double)((c & 0x7fff) - 1) * step);
+				*out = (c & 0x8000) ? -x : x;
+			}
+		}
+	}
+
+	///
+	/// \brief Decompress the table into a factor.
+	///
+	factor decompress() const {
+		factor f(m_v, 0.0);
+		f.set_type(m_type);
+		size_t nb = m_lo.size();
+		for (size_t b = 0; b < nb; ++b) {
+			decode(b, &f[b * block_size]);
+		}
+		return f;
+	}
+
+	///
+	/// \brief Combine the table into a factor, one block at a time.
+	///
+	/// Every entry of F becomes Op(F[i], x), where x is the entry of this
+	/// table that agrees with it; the scope of F must include the scope of
+	/// the table. If the scopes differ, the entries of the table are reached
+	/// out of order and the last few decoded blocks are kept (cache_blocks).
+	/// \param F 	The factor
+	/// \param Op 	The binary operation
+	///
+	template<typename Function>
+	void apply(factor& F, Function Op) const {
+		assert(F.vars() >> m_v);
+		value* f = &F[0];
+		size_t nb = m_lo.size();
+		if (F.vars() == m_v) {
+			value buf[block_size];
+			for (size_t b = 0; b < nb; ++b) {
+				size_t first = b * block_size, n = std::min(m_numel - first, (size_t)block_size);
+				decode(b, buf);
+				for (size_t k = 0; k < n; ++k) {
+					f[first + k] = Op(f[first + k], buf[k]);
+				}
+			}
+			return;
+		}
+
+		std::vector<value> cache(cache_blocks * block_size);
+		std::vector<long> tag(cache_blocks, -1);
+		subindex s(F.vars(), m_v);
+		for (size_t i = 0; i < F.numel(); ++i, ++s) {
+			size_t j = s, b = j / block_size, slot = b % cache_blocks;
+			value* buf = &cache[slot * block_size];
+			if (tag[slot] != (long)b) {
+				decode(b, buf);
+				tag[slot] = b;
+			}
+			f[i] = Op(f[i], buf[j % block_size]);
+		}
+	}
+
+	///
+	/// \brief Condition on a single variable, one block at a time.
+	/// \param VX 		The variable to be conditioned on
+	/// \param state	The value of the variable
+	/// \return the factor over the other variables (as factor::slice).
+	///
+	factor slice(const variable& VX, size_t state) const {
+		size_t stride = 1;
+		for (size_t k = 0; k < m_v.nvar() && m_v[k] != VX; ++k) {
+			stride *= m_v[k].states();
+		}
+		factor F(m_v - VX, 0.0);
+		F.set_type(m_type);
+		value* f = &F[0];
+		value buf[block_size];
+		size_t nb = m_lo.size(), d = VX.states();
+		for (size_t b = 0; b < nb; ++b) {
+			size_t first = b * block_size, n = std::min(m_numel - first, (size_t)block_size);
+			decode(b, buf);
+			for (size_t k = 0; k < n; ++k) {
+				if (((first + k) / stride) % d == state) *f++ = buf[k];
+			}
+		}
+		return F;
+	}
+
+private:
+	static const size_t s_levels = 32767;		///< Codes of a non-zero magnitude
+	static const size_t cache_blocks = 16;		///< Decoded blocks kept by apply
+
+	// Members:
+
+	variable_set m_v;					///< Scope of the factor
+	size_t m_numel;						///< Number of entries
+	double m_error;						///< Largest log-domain error
+	FactorType m_type;					///< Type of the factor
+	std::vector<double> m_lo;			///< Smallest log|x| of each block
+	std::vector<double> m_step;			///< Grid step of each block
+	std::vector<long> m_raw;			///< Offset of a raw block in m_values (or -1)
+	std::vector<long> m_code;			///< Offset of a quantized block in m_codes (or -1)
+	std::vector<uint16_t> m_codes;		///< Codes of the quantized blocks
+	std::vector<value> m_values;		///< Entries of the raw blocks
+};
+
+/**
+ * Packed tables of a bucket elimination
+ *
+ * Wraps the tables of an elimination (the vector of factors indexed by the
+ * buckets): a table of at least block_size entries may be packed, which
+ * replaces its factor by a compressed_factor, and a packed table is then
+ * combined into the factors of its bucket block by block (multiply_into,
+ * add_into, slice) rather than decompressed.
+ */
+class packed_tables {
+public:
+	typedef compressed_factor::FactorType FactorType;	///< Type of a table
+
+	///
+	/// \brief Constructor.
+	/// \param fin 	The tables (kept by reference, they may grow)
+	/// \param eps 	The largest relative error of an entry (0 to never pack)
+	///
+	packed_tables(std::vector<factor>& fin, double eps) : m_fin(fin), m_eps(eps) {};
+
+	///
+	/// \brief Pack a table if it is large enough.
+	/// \return the compressed table, or NULL if the table is kept as is.
+	///
+	const compressed_factor* pack(size_t i) {
+		if (m_eps <= 0 || m_fin[i].numel() < compressed_factor::block_size) {
+			return NULL;
+		}
+		compressed_factor& c = m_packed[i];
+		c = compressed_factor(m_fin[i], m_eps);
+		m_fin[i] = factor();
+		return &c;
+	}
+
+	///
+	/// \brief Release a table (packed or not).
+	///
+	void release(size_t i) {
+		m_fin[i] = factor();
+		m_packed.erase(i);
+	}
+
+	const variable_set& vars(size_t i) const {
+		const compressed_factor* c = find(i);
+		return c ? c->vars() : m_fin[i].vars();
+	}
+	FactorType get_type(size_t i) const {
+		const compressed_factor* c = find(i);
+		return c ? c->get_type() : m_fin[i].get_type();
+	}
+
+	///
+	/// \brief Multiply a table into a factor (whose scope grows if needed).
+	///
+	void multiply_into(factor& F, size_t i) const {
+		const compressed_factor* c = find(i);
+		if (c == NULL) {
+			F *= m_fin[i];
+		} else {
+			if (!(F.vars() >> c->vars())) F = F.embed(F.vars() + c->vars());
+			c->apply(F, std::multiplies<double>());
+		}
+	}
+
+	///
+	/// \brief Add a table into a factor (whose scope grows if needed).
+	///
+	void add_into(factor& F, size_t i) const {
+		const compressed_factor* c = find(i);
+		if (c == NULL) {
+			F += m_fin[i];
+		} else {
+			if (!(F.vars() >> c->vars())) F = F.embed(F.vars() + c->vars());
+			c->apply(F, std::plus<double>());
+		}
+	}
+
+	///
+	/// \brief Condition a table on a single variable.
+	///
+	factor slice(size_t i, const variable& VX, size_t state) const {
+		const compressed_factor* c = find(i);
+		return c ? c->slice(VX, state) : m_fin[i].slice(VX, state);
+	}
+
+	///
+	/// \brief A constant factor (the unit of a product or of a sum).
+	///
+	factor constant(double val) const {
+		return factor(val);
+	}
+
+	///
+	/// \brief A copy of a table (decompressed if packed).
+	///
+	factor get(size_t i) const {
+		const compressed_factor* c = find(i);
+		return c ? c->decompress() : m_fin[i];
+	}
+
+private:
+	const compressed_factor* find(size_t i) const {
+		std::map<size_t, compressed_factor>::const_iterator pi = m_packed.find(i);
+		return (pi == m_packed.end()) ? NULL : &pi->second;
+	}
+
+	// Members:
+
+	std::vector<factor>& m_fin;						///< Tables (those not packed)
+	double m_eps;									///< Relative error of an entry
+	std::map<size_t, compressed_factor> m_packed;	///< Packed tables
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_COMPRESSED_FACTOR_H_ */
@@ -0,0 +1,175 @@
+/*
+ * cow_vector.h
+ *
+ *  Created on: 20 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file cow_vector.h
+/// \brief Reference-counted vector with copy-on-write
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_COW_VECTOR_H_
+#define IBM_MERLIN_COW_VECTOR_H_
+
+#include <vector>
+#include <memory>
+#include <stdexcept>
+
+namespace merlin {
+
+/**
+ * Copy-on-write vector
+ *
+ * Copies of a cow_vector share the same elements (a reference-counted
+ * std::vector), so copying a factor, a model or a solver copies pointers
+ * rather than tables. The elements are copied only when a shared vector is
+ * about to be modified: every non-const accessor first makes its vector
+ * private (detach). The const accessors never copy.
+ *
+ * A reference or pointer obtained from a non-const accessor writes to the
+ * private vector of that object only as long as the object is not copied;
+ * after a copy it must be obtained again.
+ *
+ * A vector can be marked (eg as owned by a table pool). Copies keep the mark,
+ * and a write access to a marked vector first copies its elements (even if
+ * they are not shared) and drops the mark, so marked elements are never
+ * modified; a table pool may then hold a weak reference to them (weak, lock).
+ */
+template<typename T, typename Alloc = std::allocator<T> >
+class cow_vector {
+public:
+	typedef std::vector<T, Alloc> vector_type;						///< Shared vector
+	typedef T value_type;											///< Type of the elements
+	typedef typename vector_type::iterator iterator;				///< Iterator
+	typedef typename vector_type::const_iterator const_iterator;	///< Const iterator
+	typedef std::weak_ptr<vector_type> weak_type;					///< Weak reference
+
+	///
+	/// \brief Empty vector.
+	///
+	cow_vector() : m_mark(false) {};
+
+	///
+	/// \brief Vector of n copies of a value.
+	///
+	explicit cow_vector(size_t n, const T& v = T()) :
+		m_p(std::make_shared<vector_type>(n, v)), m_mark(false) {};
+
+	// Read access (shared)
+
+	size_t size() const { return m_p ? m_p->size() : 0; }
+	bool empty() const { return size() == 0; }
+	const T& operator[](size_t i) const { return (*m_p)[i]; }
+	const T& at(size_t i) const { check(i); return (*m_p)[i]; }
+	const T* data() const { return m_p ? m_p->data() : NULL; }
+	const_iterator begin() const { return m_p ? m_p->begin() : const_iterator(); }
+	const_iterator end() const { return m_p ? m_p->end() : const_iterator(); }
+
+	// Write access (private)
+
+	T& operator[](size_t i) { detach(); return (*m_p)[i]; }
+	T& at(size_t i) { check(i); detach(); return (*m_p)[i]; }
+	T* data() { detach(); return m_p ? m_p->data() : NULL; }
+	iterator begin() { detach(); return m_p ? m_p->begin() : iterator(); }
+	iterator end() { detach(); return m_p ? m_p->end() : iterator(); }
+
+	///
+	/// \brief Resize the vector (new elements are value-initialized).
+	///
+	void resize(size_t n) {
+		if (!m_p) {
+			m_p = std::make_shared<vector_type>(n);
+			m_mark = false;
+		} else if (n != m_p->size()) {
+			detach();
+			m_p->resize(n);
+		}
+	}
+
+	///
+	/// \brief Exchange the contents with another vector.
+	///
+	void swap(cow_vector& v) {
+		m_p.swap(v.m_p);
+		std::swap(m_mark, v.m_mark);
+	}
+
+	///
+	/// \brief Check if the elements are shared with another vector.
+	///
+	bool shared() const {
+		return m_p && m_p.use_count() > 1;
+	}
+
+	///
+	/// \brief Identity of the shared elements (null if empty).
+	///
+	const void* id() const {
+		return m_p.get();
+	}
+
+	///
+	/// \brief Mark the vector (the mark is dropped by a write access).
+	///
+	void mark() { m_mark = true; }
+	bool marked() const { return m_mark; }
+
+	///
+	/// \brief Weak reference to the elements (see lock).
+	///
+	weak_type weak() const {
+		return m_p;
+	}
+
+	///
+	/// \brief Vector sharing the elements of a weak reference (empty if they
+	/// were released).
+	///
+	static cow_vector lock(const weak_type& w) {
+		cow_vector v;
+		v.m_p = w.lock();
+		return v;
+	}
+
+	///
+	/// \brief Make the elements private (copy them if they are shared).
+	///
+	void detach() {
+		if (m_p && (m_mark || m_p.use_count() > 1)) {
+			m_p = std::make_shared<vector_type>(*m_p);
+		}
+		m_mark = false;
+	}
+
+protected:
+
+	void check(size_t i) const {
+		if (i >= size()) {
+			throw std::out_of_range("cow_vector index out of range");
+		}
+	}
+
+	// Members:
+
+	std::shared_ptr<vector_type> m_p;	///< Shared elements (null if empty)
+	bool m_mark;						///< Marked (see mark)
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_COW_VECTOR_H_ */
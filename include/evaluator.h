@@ -0,0 +1,606 @@
+/*
+ * evaluator.h
+ *
+ *  Created on: 16 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file evaluator.h
+/// \brief Expected utility of a decision policy in IDs
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_EVALUATOR_H_
+#define IBM_MERLIN_EVALUATOR_H_
+
+#include "limid.h"
+#include "algorithm.h"
+#include "mbe.h"
+#include "is.h"
+
+namespace merlin {
+
+/**
+ * Policy evaluation
+ *
+ * Models supported: ID
+ *
+ * Computes the expected utility of a decision policy (one factor for each
+ * decision, as built by BE or MBE, whose argmax over the decision is the
+ * decision rule). If no policy is given, the policy of a MBE run is used and
+ * its MEU upper bound is kept, so that the evaluator reports both ends of the
+ * MEU: the value of the policy is a lower bound and the MBE bound an upper one.
+ *
+ * Each decision rule becomes a deterministic conditional probability table of
+ * the decision given its parents, and the model becomes a Bayesian network
+ * with utilities. Its expected utility is computed exactly by sum-product
+ * bucket elimination along an unconstrained order (the chance buckets of BE:
+ * a probability message and a conditional expected utility message per
+ * utility). If the induced width of that order exceeds MaxWidth, the expected
+ * utility is estimated by importance sampling instead (see is.h), and the
+ * lower bound is that of IS, which holds with probability at least
+ * Confidence (by Markov's inequality).
+ *
+ * With Sensitivity=1 the evaluator also returns the derivative of the expected
+ * utility with respect to every entry of every input table, with the decision
+ * rules held fixed (for the optimal policy of BE this is the sensitivity of
+ * the MEU, as long as the changes do not alter the argmax). The policy network
+ * is eliminated in the expectation semiring, where a value is a pair (p, u)
+ * and (p1,u1)(p2,u2) = (p1 p2, p1 u2 + u1 p2): a probability table enters as
+ * (P, 0), a utility table as (1, U), and the expected utility is the u part of
+ * the product of the root messages. A backward pass over the same buckets
+ * then computes, for each table, the (outside) pair (a, b) of everything else
+ * summed down to its scope; the derivative is b for a probability table and
+ * a for a utility table (the joint probability of its scope). The cost is
+ * that of a second elimination, and both passes are exact, so the policy
+ * network must be within MaxWidth (there is no sampling fallback for the
+ * derivatives and the evaluator fails otherwise).
+ *
+ */
+class evaluator : public limid, public algorithm {
+public:
+	typedef limid::findex findex;        ///< Factor index
+	typedef limid::vindex vindex;        ///< Variable index
+	typedef limid::flist flist;          ///< Collection of factor indices
+
+	///
+	/// \brief Properties of the algorithm
+	///
+	MER_ENUM( Property , Order,iBound,MaxWidth,Samples,Threads,Seed,Confidence,Sensitivity,Debug );
+
+public:
+
+	///
+	/// \brief Default constructor.
+	///
+	evaluator() : limid() {
+		set_properties();
+	}
+
+	///
+	/// \brief Constructor with a graphical model.
+	///
+	evaluator(const limid& lm) : limid(lm), m_gmo(lm) {
+		clear_factors();
+		set_properties();
+	}
+
+	///
+	/// \brief Clone the algorithm.
+	/// \return the pointer to the new object containing the cloned algorithm.
+	///
+	virtual evaluator* clone() const {
+		evaluator* lm = new evaluator(*this);
+		return lm;
+	}
+
+	// Lower bound (value of the policy) and upper bound (MBE) on the MEU
+	double ub() const {
+		if (m_given.empty() == false) {
+			throw std::runtime_error("No upper bound for a given policy.");
+		}
+		return m_ub;
+	}
+	double lb() const {
+		return m_lb;
+	}
+	std::vector<size_t> best_config() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	double logZ() const {
+		throw std::runtime_error("Not implemented");
+	}
+	double logZub() const {
+		throw std::runtime_error("Not implemented");
+	}
+	double logZlb() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	// No beliefs defined currently
+	const factor& belief(size_t) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const factor& belief(variable) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const factor& belief(variable_set) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const vector<factor>& beliefs() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	///
+	/// \brief Set the (constrained) elimination order used by MBE and IS.
+	///
+	void set_order(const variable_order_t& ord) {
+		m_order = ord;
+	}
+
+	///
+	/// \brief Set the policy to be evaluated (empty for the MBE policy).
+	///
+	void set_policy(const std::map<vindex, factor>& policy) {
+		m_given = policy;
+	}
+
+	///
+	/// \brief Get the expected utility of the policy (exact or estimated).
+	///
+	double get_value() const {
+		return m_value;
+	}
+
+	///
+	/// \brief Check if the expected utility was computed exactly.
+	///
+	bool is_exact() const {
+		return m_exact;
+	}
+
+	///
+	/// \brief Get the derivatives of the expected utility (Sensitivity=1).
+	///
+	/// One factor per input factor of the model (in the same order and with
+	/// the same scope), whose entries are the derivatives of the expected
+	/// utility with respect to the corresponding entries of the input table.
+	///
+	const std::vector<factor>& get_sensitivity() const {
+		return m_sensitivity;
+	}
+
+	///
+	/// \brief Set the properties of the algorithm.
+	/// \param opt 	The string containing comma separated property value pairs
+	///
+	virtual void set_properties(std::string opt = std::string()) {
+		if (opt.length() == 0) {
+			set_properties("Order=MinFill,iBound=2,MaxWidth=20,Samples=100000,Threads=0,Seed=0,Confidence=0.95,Sensitivity=0,Debug=0");
+			return;
+		}
+		std::vector<std::string> strs = merlin::split(opt, ',');
+		for (size_t i = 0; i < strs.size(); ++i) {
+			std::vector<std::string> asgn = merlin::split(strs[i], '=');
+			switch (Property(asgn[0].c_str())) {
+			case Property::Order:
+				m_order.clear();
+				m_order_method = OrderMethod(asgn[1].c_str());
+				break;
+			case Property::iBound:
+				m_ibound = atol(asgn[1].c_str());
+				break;
+			case Property::MaxWidth:
+				m_max_width = atol(asgn[1].c_str());
+				break;
+			case Property::Samples:
+				m_samples = atol(asgn[1].c_str());
+				break;
+			case Property::Threads:
+				m_threads = atol(asgn[1].c_str());
+				break;
+			case Property::Seed:
+				m_seed = strtoul(asgn[1].c_str(), NULL, 10);
+				break;
+			case Property::Confidence:
+				m_confidence = atof(asgn[1].c_str());
+				if (m_confidence <= 0.0 || m_confidence >= 1.0) {
+					throw std::runtime_error("Confidence must be in (0, 1).");
+				}
+				break;
+			case Property::Sensitivity:
+				m_do_sensitivity = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
+			case Property::Debug:
+				m_debug = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	///
+	/// \brief Deterministic table of the decision rule of a policy factor.
+	/// \param f 	The policy factor (over the decision and its parents)
+	/// \param d 	The decision variable
+	/// \return the factor that is 1 for the best value of the decision
+	/// 	(the first one in case of ties) given each parent configuration.
+	/// 	A policy that does not depend on the decision picks its first value.
+	///
+	factor decision_rule(const factor& f, vindex d) const {
+		const variable_set& vs = f.vars();
+		size_t stride = 1, k = 0;
+		for (; k < vs.size() && vs[k].label() != d; ++k) {
+			stride *= vs[k].states();
+		}
+		if (k == vs.size()) { // indifferent: the first value
+			factor rule(variable_set(var(d)), 0.0);
+			rule.set_type(factor::FactorType::Probability);
+			rule[0] = 1.0;
+			return rule;
+		}
+
+		size_t nd = vs[k].states();
+		factor rule(vs, 0.0);
+		rule.set_type(factor::FactorType::Probability);
+		for (size_t i = 0; i < f.numel(); ++i) {
+			if ((i / stride) % nd != 0) continue; // one entry per parent configuration
+			size_t best = 0;
+			for (size_t v = 1; v < nd; ++v) {
+				if (f[i + v * stride] > f[i + best * stride]) best = v;
+			}
+			rule[i + best * stride] = 1.0;
+		}
+		return rule;
+	}
+
+	///
+	/// \brief Expected utility of a Bayesian network with utilities.
+	///
+	/// Sum-product bucket elimination where each bucket sends a probability
+	/// message and, for each utility, the expected utility given the rest.
+	/// \param fs 	The probability and utility factors
+	/// \param ord 	The elimination order
+	/// \param nv	The number of variables
+	/// \return the expected utility.
+	///
+	double eliminate(const std::vector<factor>& fs, const variable_order_t& ord,
+			size_t nv) const {
+
+		std::vector<size_t> position(nv, ord.size());
+		for (size_t i = 0; i < ord.size(); ++i) {
+			position[ord[i]] = i;
+		}
+
+		// Partition into buckets: each factor goes to its first variable
+		std::vector<factor> fin(fs);
+		std::vector<flist> vin(nv);
+		flist roots;
+		for (findex i = 0; i < fin.size(); ++i) {
+			place(fin[i].vars(), i, position, vin, roots, ord.size());
+		}
+
+		for (size_t p = 0; p < ord.size(); ++p) {
+			vindex x = ord[p];
+			if (vin[x].size() == 0) continue;
+			variable VX = var(x);
+
+			factor comb(1.0);
+			flist psi;
+			for (flist::const_iterator i = vin[x].begin(); i != vin[x].end(); ++i) {
+				if (fin[*i].get_type() == factor::FactorType::Probability) {
+					comb *= fin[*i];
+				} else {
+					psi |= *i;
+				}
+			}
+
+			factor f = comb.sum(VX);
+			f.set_type(factor::FactorType::Probability);
+			for (flist::const_iterator j = psi.begin(); j != psi.end(); ++j) {
+				factor g = (comb * fin[*j]).sum(VX);
+				g /= f; // 0 where the bucket has no probability mass
+				g.set_type(factor::FactorType::Utility);
+				fin.push_back(g);
+				place(fin.back().vars(), fin.size() - 1, position, vin, roots, ord.size());
+			}
+			fin.push_back(f);
+			place(fin.back().vars(), fin.size() - 1, position, vin, roots, ord.size());
+
+			// Release the eliminated bucket
+			for (flist::const_iterator i = vin[x].begin(); i != vin[x].end(); ++i) {
+				fin[*i] = factor();
+			}
+		}
+
+		double P = 1.0, U = 0.0;
+		for (flist::const_iterator i = roots.begin(); i != roots.end(); ++i) {
+			if (fin[*i].get_type() == factor::FactorType::Probability) {
+				P *= fin[*i][0];
+			} else {
+				U += fin[*i][0];
+			}
+		}
+		return P * U;
+	}
+
+	///
+	/// \brief Expected utility and its derivatives (forward and adjoint pass).
+	///
+	/// Bucket elimination of (probability, expected utility) pairs followed
+	/// by the backward pass that computes the outside pair of every input.
+	/// \param fs 	The probability and utility factors
+	/// \param ord 	The elimination order
+	/// \param nv		The number of variables
+	/// \param n		The number of leading factors whose derivatives are needed
+	/// \param grad	The derivatives of the first \p n factors (output)
+	/// \return the expected utility.
+	///
+	double adjoint(const std::vector<factor>& fs, const variable_order_t& ord,
+			size_t nv, size_t n, std::vector<factor>& grad) const {
+
+		std::vector<size_t> position(nv, ord.size());
+		for (size_t i = 0; i < ord.size(); ++i) {
+			position[ord[i]] = i;
+		}
+
+		// The inputs as pairs, partitioned into buckets
+		std::vector<pair> items;
+		std::vector<flist> vin(nv);
+		flist roots;
+		for (findex i = 0; i < fs.size(); ++i) {
+			const variable_set& vs = fs[i].vars();
+			if (fs[i].get_type() == factor::FactorType::Utility) {
+				items.push_back(pair(factor(vs, 1.0), fs[i]));
+			} else {
+				items.push_back(pair(fs[i], factor(vs, 0.0)));
+			}
+			place(fs[i].vars(), i, position, vin, roots, ord.size());
+		}
+
+		// Forward pass: one message per bucket, kept for the backward pass
+		std::vector<findex> message(nv, findex(-1));
+		for (size_t p = 0; p < ord.size(); ++p) {
+			vindex x = ord[p];
+			if (vin[x].size() == 0) continue;
+			pair comb(factor(1.0), factor(0.0));
+			for (flist::const_iterator i = vin[x].begin(); i != vin[x].end(); ++i) {
+				comb = combine(comb, items[*i]);
+			}
+			variable_set vs = comb.first.vars() - var(x);
+			message[x] = items.size();
+			items.push_back(pair(comb.first.marginal(vs), comb.second.marginal(vs)));
+			place(items.back().first.vars(), message[x], position, vin, roots, ord.size());
+		}
+
+		// Backward pass: outside pairs, from the roots down to the first bucket
+		std::vector<pair> outside(items.size());
+		double value = 0.0;
+		for (flist::const_iterator i = roots.begin(); i != roots.end(); ++i) {
+			pair rest(factor(1.0), factor(0.0));
+			for (flist::const_iterator j = roots.begin(); j != roots.end(); ++j) {
+				if (j != i) rest = combine(rest, items[*j]);
+			}
+			outside[*i] = spread(rest, items[*i].first.vars());
+			if (i == roots.begin()) {
+				value = combine(rest, items[*i]).second[0];
+			}
+		}
+		for (size_t p = ord.size(); p-- > 0; ) {
+			vindex x = ord[p];
+			if (vin[x].size() == 0) continue;
+			for (flist::const_iterator i = vin[x].begin(); i != vin[x].end(); ++i) {
+				pair rest = outside[message[x]];
+				for (flist::const_iterator j = vin[x].begin(); j != vin[x].end(); ++j) {
+					if (j != i) rest = combine(rest, items[*j]);
+				}
+				outside[*i] = spread(rest, items[*i].first.vars());
+			}
+		}
+
+		// d(p_i u_i)/dP = b for probabilities (P,0) and a for utilities (1,U)
+		grad.resize(n);
+		for (findex i = 0; i < n; ++i) {
+			grad[i] = (fs[i].get_type() == factor::FactorType::Utility) ?
+					outside[i].first : outside[i].second;
+			grad[i].set_type(fs[i].get_type());
+		}
+		return value;
+	}
+
+	///
+	/// \brief Initialize the policy to be evaluated.
+	///
+	void init() {
+
+		// Start the timer and store it
+		m_start_time = timeSystem();
+
+		if (m_gmo.islimid()) {
+			throw std::runtime_error("Policy evaluation is only supported for standard IDs.");
+		}
+
+		// Prologue
+		std::cout << "Initialize solver ..." << std::endl;
+		std::cout << " + models supported : ID" << std::endl;
+		std::cout << " + algorithm        : EVAL" << std::endl;
+		std::cout << " + max width        : " << m_max_width << std::endl;
+
+		if (m_order.size() == 0) {
+			m_order = m_gmo.order(m_order_method, m_seed);
+		}
+
+		// The policy: given or from MBE (whose bound is kept)
+		m_ub = infty();
+		m_policy = m_given;
+		if (m_policy.empty()) {
+			std::ostringstream oss;
+			oss << "iBound=" << m_ibound << ",Debug=0";
+			mbe h(m_gmo);
+			h.set_properties(oss.str());
+			h.set_order(m_order);
+			h.run();
+			m_policy = h.get_policy();
+			m_ub = h.ub();
+			std::cout << " + policy           : MBE (i-bound " << m_ibound << ")" << std::endl;
+		} else {
+			std::cout << " + policy           : given" << std::endl;
+		}
+
+		// Decision rules can only look at the past
+		std::vector<size_t> when(m_gmo.nvar());
+		for (size_t i = 0; i < m_porder.size(); ++i) {
+			when[m_porder[i]] = i;
+		}
+		for (vindex d = 0; d < m_gmo.nvar(); ++d) {
+			if (m_vtypes[d] != 'd') continue;
+			std::map<vindex, factor>::const_iterator pi = m_policy.find(d);
+			if (pi == m_policy.end()) {
+				std::ostringstream err;
+				err << "No policy for decision " << d << ".";
+				throw std::runtime_error(err.str());
+			}
+			const variable_set& vs = pi->second.vars();
+			for (size_t j = 0; j < vs.size(); ++j) {
+				if (when[vs[j].label()] > when[d]) {
+					std::ostringstream err;
+					err << "Policy of decision " << d << " depends on variable "
+						<< vs[j].label() << " which is not observed before it.";
+					throw std::runtime_error(err.str());
+				}
+			}
+		}
+
+		std::cout << "Initialization complete in "
+			<< (timeSystem() - m_start_time) << " seconds." << std::endl;
+	}
+
+	///
+	/// \brief Evaluate the policy.
+	///
+	virtual void run() {
+
+		// Initialize the algorithm
+		init();
+
+		// Bayesian network of the policy
+		std::vector<factor> fs(m_gmo.get_factors());
+		for (std::map<vindex, factor>::const_iterator pi = m_policy.begin();
+				pi != m_policy.end(); ++pi) {
+			fs.push_back(decision_rule(pi->second, pi->first));
+		}
+		graphical_model bn(fs);
+		variable_order_t ord = bn.order(m_order_method, m_seed);
+		size_t wstar = bn.induced_width(ord);
+		std::cout << " + induced width    : " << wstar << " (policy network)" << std::endl;
+
+		m_exact = (wstar <= m_max_width);
+		if (!m_exact && m_do_sensitivity) {
+			std::ostringstream err;
+			err << "Sensitivity requires exact evaluation, but the induced width "
+				<< wstar << " exceeds MaxWidth=" << m_max_width << ".";
+			throw std::runtime_error(err.str());
+		}
+		if (m_exact) {
+			std::cout << "Begin exact evaluation ..." << std::endl;
+			m_value = eliminate(fs, ord, bn.nvar());
+			m_lb = m_value;
+		} else {
+			std::cout << "Begin sampling (induced width exceeds " << m_max_width << ") ..." << std::endl;
+			std::ostringstream oss;
+			oss << "iBound=" << m_ibound << ",Samples=" << m_samples
+				<< ",Threads=" << m_threads << ",Seed=" << m_seed
+				<< ",Confidence=" << m_confidence << ",Debug=0";
+			is s(m_gmo);
+			s.set_properties(oss.str());
+			s.set_order(m_order);
+			s.set_policy(m_policy);
+			s.run();
+			m_value = s.get_estimate();
+			m_lb = s.lb();
+		}
+
+		m_sensitivity.clear();
+		if (m_do_sensitivity) {
+			std::cout << "Begin sensitivity analysis ..." << std::endl;
+			adjoint(fs, ord, bn.nvar(), m_gmo.num_factors(), m_sensitivity);
+			if (m_debug) {
+				for (size_t i = 0; i < m_sensitivity.size(); ++i) {
+					std::cout << "  Sensitivity of factor " << i << " is: "
+						<< m_sensitivity[i] << std::endl;
+				}
+			}
+		}
+
+		std::cout << "Expected utility of the policy is " << m_value
+			<< (m_exact ? " (exact)" : " (estimate)") << std::endl;
+		std::cout << "MEU lower bound is " << m_lb;
+		if (!m_exact) std::cout << " (with probability " << m_confidence << ")";
+		std::cout << std::endl;
+		if (m_given.empty()) {
+			std::cout << "MEU upper bound is " << m_ub << " (MBE)" << std::endl;
+		}
+		std::cout << "CPU time is " << timeSystem() - m_start_time << " seconds" << std::endl;
+		std::cout << "Done." << std::endl << std::endl;
+	}
+
+protected:
+
+	typedef std::pair<factor, factor> pair;	///< (probability, expected utility)
+
+	///
+	/// \brief Product of two pairs in the expectation semiring.
+	///
+	static pair combine(const pair& x, const pair& y) {
+		return pair(x.first * y.first, x.first * y.second + x.second * y.first);
+	}
+
+	///
+	/// \brief Sum a pair down to a scope (constant over the missing variables).
+	///
+	static pair spread(const pair& x, const variable_set& vs) {
+		return pair(factor(vs, 1.0) * x.first.marginal(vs),
+				factor(vs, 1.0) * x.second.marginal(vs));
+	}
+
+	// Members:
+
+	limid m_gmo; 						///< Original influence diagram
+	double m_lb;						///< Lower bound on the MEU (value of the policy)
+	double m_ub;						///< Upper bound on the MEU (MBE)
+	double m_value;						///< Expected utility of the policy
+	bool m_exact;						///< Exact evaluation (or sampling)
+	size_t m_ibound;					///< Mini-bucket i-bound (MBE policy, proposal)
+	size_t m_max_width;					///< Largest induced width evaluated exactly
+	size_t m_samples;					///< Number of samples (sampling fallback)
+	size_t m_threads;					///< Number of sampling threads
+	unsigned long m_seed;				///< Seed of the random streams
+	double m_confidence;				///< Probability that the lower bound holds (sampling)
+	OrderMethod m_order_method;			///< Variable ordering method
+	variable_order_t m_order;			///< Variable order (MBE and IS)
+	bool m_debug;						///< Internal debugging flag
+	std::map<vindex, factor> m_given;	///< Policy given by the user
+	std::map<vindex, factor> m_policy;	///< Policy to be evaluated
+	bool m_do_sensitivity;				///< Compute the derivatives of the value
+	std::vector<factor> m_sensitivity;	///< Derivatives w.r.t. the input tables
+
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_EVALUATOR_H_ */
@@ -34,6 +34,9 @@
 #include "util.h"
 #include "variable_set.h"
 #include "index.h"
+#include "spill.h"
+#include "cow_vector.h"
+#include "table_pool.h"
 
 namespace merlin {
 
@@ -66,13 +69,17 @@ public:
 	typedef double value;					///< A real value.
 	typedef variable_set::vindex vindex;	///< Variable identifiers (0...N-1)
 	typedef variable_set::vsize vsize;    	///< Variable values (0...K-1)
+	typedef cow_vector<value, spill_allocator<value> > storage; ///< Table storage (shared until written, large ones may be spilled)
+	typedef table_pool<storage> pool;		///< Pool of shared tables (see intern)
+	typedef table_memo<storage> memo;		///< Memoized operations on shared tables
 
 	// Constructors and destructor:
 
 	///
 	/// \brief Copy-constructor.
 	///
-	/// Constructs a copy from an object of the same type.
+	/// Constructs a copy from an object of the same type. The table is shared
+	/// with \p f until one of them is modified (see cow_vector).
 	///
 	factor(factor const& f) :
 			m_v(f.m_v), m_t(f.m_t), m_type(f.m_type) {
@@ -126,14 +133,14 @@ public:
 	///
 	/// \brief Assignment operator.
 	///
-	/// The operator performs a deep copy of the object.
+	/// The operator shares the table of the object (copy-on-write).
 	///	\param rhs	A factor object of the same type
 	///	\return a reference to the current factor whose content was copied from 
 	/// the factor received as argument.
 	///
 	factor& operator=(factor const& rhs) {
 		if (this != &rhs) {
-			std::vector<double> tmp;
+			storage tmp;
 			m_t.swap(tmp);                    // force vector to release memory
 			m_v = rhs.m_v;
 			m_t = rhs.m_t;
@@ -172,6 +179,18 @@ public:
 	void set_dims() {
 	};
 
+	///
+	/// \brief Share the table with an equal one from the pool of tables.
+	///
+	/// Interned tables are shared by all the factors with the same values
+	/// (whatever their scopes), and the products and marginals of interned
+	/// tables are memoized by the active memo of the thread (if any).
+	/// \return true if the table was found in the pool.
+	///
+	bool intern() {
+		return pool::instance().intern(m_t);
+	};
+
 	// Accessor functions:
 
 	///
@@ -218,7 +237,7 @@ public:
 	/// corresponds to a particular configuration of the scope variables.
 	///
 	const value* table() const {
-		return &m_t[0];
+		return m_t.data();
 	};
 
 	///
@@ -632,10 +651,30 @@ public:
 	template<typename Function> factor binaryOp(const factor& B,
 			Function Op) const {
 		variable_set v = m_v + B.m_v;  						// expand scope to union
+		memo* M = memo::active();
+		memo::key k;
+		if (M != NULL && memo_code(Op) && memo_operands(B)) { // interned operands
+			if (m_t.marked() == false) { // (or a constant, interned here)
+				factor A = *this;
+				A.intern();
+				return A.binaryOp(B, Op);
+			} else if (B.m_t.marked() == false) {
+				factor C = B;
+				C.intern();
+				return binaryOp(C, Op);
+			}
+			k = memo_key(memo_code(Op), &B, v);
+			factor F;
+			if (M->find(k, F.m_t)) {
+				F.m_v = v;
+				F.set_dims();
+				return F;
+			}
+		}
 		factor F(v);             					//  and create target factor
-		subindex s1(v, m_v), s2(v, B.m_v); 	// index over A and B & do the op
-		for (size_t i = 0; i < F.num_states(); ++i, ++s1, ++s2)
-			F[i] = Op(m_t[s1], B[s2]);
+		value* f = F.m_t.data();				// (private table, written directly)
+		combine(f, v, table(), m_v, B.table(), B.m_v, Op); // index over A and B & do the op
+		if (k.op) M->insert(k, m_t, B.m_t, F.m_t);
 		return F; 										// return the new copy
 	};
 
@@ -670,12 +709,11 @@ public:
 	template<typename Function> factor& binaryOpIP(const factor& B,
 			Function Op) {
 		variable_set v = m_v + B.m_v;  							// expand scope to union
-		if (v != m_v)
+		if (v != m_v || (memo_code(Op) && memo::active() != NULL && memo_operands(B)))
 			*this = binaryOp(B, Op); // if A's scope is too small, call binary op
 		else {
-			subindex s2(m_v, B.m_v);       		// otherwise create index over B
-			for (size_t i = 0; i < num_states(); ++i, ++s2)
-				Op.IP(m_t[i], B[s2]);	// and do the operations
+			value* t = m_t.data();					// copy the table once if shared
+			combine_ip(t, m_v, B.table(), B.m_v, Op);	// otherwise index over B
 		}
 		return *this;
 	};
@@ -690,8 +728,9 @@ public:
 	/// 	operation between  the input factor A and scalar value B.
 	///
 	template<typename Function> factor& binaryOpIP(const value B, Function Op) {
+		value* t = m_t.data();
 		for (size_t i = 0; i < num_states(); i++)
-			Op.IP(m_t[i], B);
+			Op.IP(t[i], B);
 		return *this;	// simplifies for scalar args
 	};
 
@@ -980,10 +1019,11 @@ public:
 		factor F(v_keep, 0.0);
 		//superindex sup(src,vKeep,vState); size_t N=vKeep.nrStates();
 		//for (size_t i=0;i<N;++i,++sup) F[i]=m_t[sup];
+		value* f = F.m_t.data();
 		subindex src(vars(), v_rem), dst(vars(), v_keep);
 		for (size_t i = 0; i < num_states(); ++i, ++src, ++dst)
 			if (src == v_state)
-				F[dst] = m_t[i];  // !!! terrible; needs supindex
+				f[dst] = m_t[i];  // !!! terrible; needs supindex
 		return F;
 	};
 
@@ -998,6 +1038,89 @@ public:
 		return condition(v_rem, v_state);
 	};
 
+	///
+	/// \brief Rename the variables of the factor.
+	///
+	/// The variable with label v becomes the variable with label to[v] (with
+	/// the same domain), and the table is permuted to the order of the new
+	/// labels.
+	/// \param to 	The new label of each variable
+	/// \return a copy of the factor over the renamed variables.
+	///
+	factor relabel(const std::vector<vindex>& to) const {
+		const size_t n = m_v.nvar();
+		variable_set vs;
+		for (size_t i = 0; i < n; ++i) {
+			vs |= variable(to[m_v[i].label()], m_v[i].states());
+		}
+		factor F(vs, 0.0);
+		F.m_type = m_type;
+
+		// stride in this table, stride in the new one and domain of each
+		// variable of the new scope; pos[i] is the new place of m_v[i]
+		std::vector<size_t> stride(n), nstride(n), dims(n), pos(n);
+		for (size_t i = 0, s = 1; i < n; s *= m_v[i].states(), ++i) {
+			size_t j = 0;
+			while (vs[j].label() != to[m_v[i].label()]) ++j;
+			stride[j] = s;
+			dims[j] = m_v[i].states();
+			pos[i] = j;
+		}
+		for (size_t j = 0, s = 1; j < n; s *= dims[j], ++j) {
+			nstride[j] = s;
+		}
+
+		// A copy in the order of either table reads or writes the other at
+		// large strides. Instead, the leading variables of both tables form a
+		// small block whose offsets are listed once; it is copied for each
+		// configuration of the remaining variables.
+		std::vector<bool> inner(n, false);
+		size_t block = 1;
+		for (size_t j = 0; j < n && block < 64; ++j) {
+			inner[j] = true;
+			block *= dims[j];
+		}
+		for (size_t i = 0, run = 1; i < n && run < 64; run *= dims[pos[i]], ++i) {
+			if (inner[pos[i]]) continue;
+			if (block * dims[pos[i]] > 4096) break;
+			inner[pos[i]] = true;
+			block *= dims[pos[i]];
+		}
+
+		std::vector<size_t> soff(block), doff(block), idx(n, 0);
+		for (size_t k = 0, o = 0, d = 0; k < block; ++k) {
+			soff[k] = o;
+			doff[k] = d;
+			for (size_t j = 0; j < n; ++j) { // next configuration of the block
+				if (!inner[j]) continue;
+				o += stride[j];
+				d += nstride[j];
+				if (++idx[j] < dims[j]) break;
+				o -= stride[j] * dims[j];
+				d -= nstride[j] * dims[j];
+				idx[j] = 0;
+			}
+		}
+
+		value* f = F.m_t.data();
+		const value* t = table();
+		for (size_t c = 0, o = 0, d = 0; c < F.num_states(); c += block) {
+			for (size_t k = 0; k < block; ++k) {
+				f[d + doff[k]] = t[o + soff[k]];
+			}
+			for (size_t j = 0; j < n; ++j) { // next configuration of the others
+				if (inner[j]) continue;
+				o += stride[j];
+				d += nstride[j];
+				if (++idx[j] < dims[j]) break;
+				o -= stride[j] * dims[j];
+				d -= nstride[j] * dims[j];
+				idx[j] = 0;
+			}
+		}
+		return F;
+	};
+
 	///
 	/// \brief Embed extra variables in the factor.
 	///
@@ -1038,10 +1161,21 @@ public:
 	/// \return a copy of the factor resulting from marginalization.
 	///
 	factor marginal(variable_set const& target) const {
-		factor F(target & vars(), 0.0);
-		subindex s(m_v, F.vars());
-		for (size_t i = 0; i < num_states(); ++i, ++s)
-			F[s] += m_t[i];
+		variable_set v = target & vars();
+		memo* M = memo::active();
+		memo::key k;
+		if (M != NULL && m_t.marked()) { // interned table
+			k = memo_key(memo_marginal, NULL, v);
+			factor F;
+			if (M->find(k, F.m_t)) {
+				F.m_v = v;
+				F.set_dims();
+				return F;
+			}
+		}
+		factor F(v, 0.0);
+		reduce_into(F, binOpPlus());
+		if (k.op) M->insert(k, m_t, storage(), F.m_t);
 		return F;
 	};
 
@@ -1061,13 +1195,56 @@ public:
 			factor FF = *this;
 			FF ^= (1.0/w);
 			factor F(target & vars(), 0.0);
-			subindex s(m_v, F.vars());
-			for (size_t i = 0; i < num_states(); ++i, ++s)
-				F[s] += FF[i];
+			FF.reduce_into(F, binOpPlus());
 			return F;
 		}
 	};
 
+	///
+	/// \brief Weighted marginals of several single variables.
+	///
+	/// Compute the weighted marginal of each variable in a set with a single
+	/// traversal of the table: the configuration of the scope is tracked as a
+	/// counter and every entry is added to the marginal of each target.
+	/// \param target 	The variables (each must be in the factor's scope)
+	/// \param w 		The weight used by the weighted sum operator
+	/// \return the marginals, in the order of the target variables.
+	///
+	std::vector<factor> marginals(variable_set const& target, const value w) const {
+		const size_t n = m_v.nvar(), m = target.nvar();
+		std::vector<factor> F(m);
+		std::vector<size_t> pos(m);  // position of each target in the scope
+		for (size_t k = 0, j = 0; k < m; ++k) {
+			while (j < n && m_v[j] != target[k]) ++j;
+			assert(j < n);
+			pos[k] = j;
+			F[k] = factor(variable_set(target[k]), (w == infty()) ? -infty() : 0.0);
+		}
+		std::vector<value*> f(m);
+		for (size_t k = 0; k < m; ++k) f[k] = F[k].m_t.data();
+		std::vector<size_t> idx(n, 0);
+		const value* t = m_t.data();
+		const value p = 1.0 / w;
+		for (size_t i = 0; i < num_states(); ++i) {
+			if (w == infty()) {
+				for (size_t k = 0; k < m; ++k) {
+					value& x = f[k][idx[pos[k]]];
+					x = (x > t[i]) ? x : t[i];
+				}
+			} else {
+				value x = (p == 1.0) ? t[i] : std::pow(t[i], p);
+				for (size_t k = 0; k < m; ++k) {
+					f[k][idx[pos[k]]] += x;
+				}
+			}
+			for (size_t j = 0; j < n; ++j) { // next configuration
+				if (++idx[j] < m_v[j].states()) break;
+				idx[j] = 0;
+			}
+		}
+		return F;
+	};
+
 	///
 	/// \brief Max-Marginal over a set of varibles.
 	///
@@ -1078,9 +1255,7 @@ public:
 	///
 	factor maxmarginal(variable_set const& target) const {
 		factor F(target & vars(), -infty());
-		subindex s(m_v, F.vars());
-		for (size_t i = 0; i < num_states(); ++i, ++s)
-			F[s] = (F[s] > m_t[i]) ? F[s] : m_t[i];
+		reduce_into(F, opMax());
 		return F;
 	};
 
@@ -1094,9 +1269,7 @@ public:
 	///	
 	factor minmarginal(variable_set const& target) const {
 		factor F(target & vars(), infty());
-		subindex s(m_v, F.vars());
-		for (size_t i = 0; i < num_states(); ++i, ++s)
-			F[s] = (F[s] > m_t[i]) ? m_t[i] : F[s];
+		reduce_into(F, opMin());
 		return F;
 	}
 	;
@@ -1322,8 +1495,171 @@ public:
 
 protected:
 
+	// Kernels over the tables. A scope of binary variables is indexed with
+	// a binary_subindex, any other with a subindex one block of values of the
+	// first variable at a time; the blocks of 2, 3 and 4 values are unrolled.
+
+	struct opMax {
+		value operator()(value a, value b) const { return (a > b) ? a : b; }
+	};
+	struct opMin {
+		value operator()(value a, value b) const { return (a > b) ? b : a; }
+	};
+
+	///
+	/// \brief f = Op(a, b) where f has scope v (the union of va and vb).
+	///
+	template<typename Function>
+	static void combine(value* __restrict f, const variable_set& v,
+			const value* a, const variable_set& va,
+			const value* b, const variable_set& vb, Function Op) {
+		size_t n = v.num_states();
+		if (binary_subindex::applies(v)) {
+			binary_subindex s1(v, va), s2(v, vb);
+			for (size_t i = 0; i < n; ++i, ++s1, ++s2)
+				f[i] = Op(a[s1], b[s2]);
+			return;
+		}
+		subindex s1(v, va), s2(v, vb);
+		switch (v.dims()[0]) {
+		case 2: combine_blocks<2>(f, n, 2, a, s1, b, s2, Op); break;
+		case 3: combine_blocks<3>(f, n, 3, a, s1, b, s2, Op); break;
+		case 4: combine_blocks<4>(f, n, 4, a, s1, b, s2, Op); break;
+		default: combine_blocks<0>(f, n, v.dims()[0], a, s1, b, s2, Op);
+		}
+	};
+	template<size_t D, typename Function>
+	static void combine_blocks(value* __restrict f, size_t n, size_t d0,
+			const value* a, subindex& s1, const value* b, subindex& s2, Function Op) {
+		const size_t d = D ? D : d0, st1 = s1.stride0(), st2 = s2.stride0();
+		for (size_t i = 0; i < n; i += d, s1.next_block(), s2.next_block()) {
+			const value* x = a + (size_t)s1;
+			const value* y = b + (size_t)s2;
+			for (size_t j = 0; j < d; ++j)
+				f[i + j] = Op(x[j * st1], y[j * st2]);
+		}
+	};
+
+	///
+	/// \brief Op.IP(f, b) where f has scope v (which includes vb).
+	///
+	template<typename Function>
+	static void combine_ip(value* f, const variable_set& v,
+			const value* b, const variable_set& vb, Function Op) {
+		size_t n = v.num_states();
+		if (binary_subindex::applies(v)) {
+			binary_subindex s2(v, vb);
+			for (size_t i = 0; i < n; ++i, ++s2)
+				Op.IP(f[i], b[s2]);
+			return;
+		}
+		subindex s2(v, vb);
+		switch (v.dims()[0]) {
+		case 2: combine_ip_blocks<2>(f, n, 2, b, s2, Op); break;
+		case 3: combine_ip_blocks<3>(f, n, 3, b, s2, Op); break;
+		case 4: combine_ip_blocks<4>(f, n, 4, b, s2, Op); break;
+		default: combine_ip_blocks<0>(f, n, v.dims()[0], b, s2, Op);
+		}
+	};
+	template<size_t D, typename Function>
+	static void combine_ip_blocks(value* f, size_t n, size_t d0,
+			const value* b, subindex& s2, Function Op) {
+		const size_t d = D ? D : d0, st2 = s2.stride0();
+		for (size_t i = 0; i < n; i += d, s2.next_block()) {
+			const value* y = b + (size_t)s2;
+			for (size_t j = 0; j < d; ++j)
+				Op.IP(f[i + j], y[j * st2]);
+		}
+	};
+
+	///
+	/// \brief Eliminate into F (whose scope is included): F[s] = Op(F[s], t[i]).
+	///
+	template<typename Function>
+	void reduce_into(factor& F, Function Op) const {
+		value* __restrict f = F.m_t.data();
+		const value* __restrict t = table();
+		size_t n = num_states();
+		if (nvar() > 0 && F.nvar() + 1 == nvar() && F.m_v.contains(m_v[0]) == false) {
+			// the first variable is eliminated: reduce contiguous runs of the
+			// table (eg when the variables are labeled by elimination order)
+			const size_t d = m_v[0].states();
+			for (size_t j = 0; j < n / d; ++j) {
+				value x = f[j];
+				for (size_t k = 0; k < d; ++k)
+					x = Op(x, t[j * d + k]);
+				f[j] = x;
+			}
+			return;
+		}
+		if (binary_subindex::applies(m_v)) {
+			binary_subindex s(m_v, F.m_v);
+			for (size_t i = 0; i < n; ++i, ++s) {
+				value& x = f[s];
+				x = Op(x, t[i]);
+			}
+			return;
+		}
+		subindex s(m_v, F.m_v);
+		switch (m_v.dims()[0]) {
+		case 2: reduce_blocks<2>(f, t, n, 2, s, Op); break;
+		case 3: reduce_blocks<3>(f, t, n, 3, s, Op); break;
+		case 4: reduce_blocks<4>(f, t, n, 4, s, Op); break;
+		default: reduce_blocks<0>(f, t, n, m_v.dims()[0], s, Op);
+		}
+	};
+	template<size_t D, typename Function>
+	static void reduce_blocks(value* __restrict f, const value* __restrict t,
+			size_t n, size_t d0, subindex& s, Function Op) {
+		const size_t d = D ? D : d0, st = s.stride0();
+		for (size_t i = 0; i < n; i += d, s.next_block()) {
+			value* x = f + (size_t)s;
+			for (size_t j = 0; j < d; ++j)
+				x[j * st] = Op(x[j * st], t[i + j]);
+		}
+	};
+
+	// Memoized operations on interned tables (see intern)
+
+	enum { memo_none, memo_times, memo_marginal };
+	template<typename Function> static int memo_code(const Function&) {
+		return memo_none;
+	};
+	static int memo_code(const binOpTimes&) {
+		return memo_times;
+	};
+
+	///
+	/// \brief Check if an operation with B can be memoized: both tables are
+	/// interned, or one of them is and the other one is a constant.
+	///
+	bool memo_operands(const factor& B) const {
+		return (m_t.marked() || nvar() == 0) && (B.m_t.marked() || B.nvar() == 0)
+			&& (m_t.marked() || B.m_t.marked());
+	};
+
+	///
+	/// \brief Key of an operation with B (or none) whose result has scope v.
+	///
+	/// The shape lists, for each variable of the union of the scopes, its
+	/// domain size and in which of them it appears.
+	///
+	memo::key memo_key(int op, const factor* B, const variable_set& v) const {
+		memo::key k;
+		k.op = op;
+		k.a = m_t.id();
+		k.b = B ? B->m_t.id() : NULL;
+		variable_set all = B ? m_v + B->m_v + v : m_v + v;
+		k.shape.reserve(all.nvar());
+		for (variable_set::const_iterator vi = all.begin(); vi != all.end(); ++vi) {
+			k.shape.push_back(vi->states() * 8 + (m_v.contains(*vi) ? 4 : 0)
+				+ ((B && B->m_v.contains(*vi)) ? 2 : 0) + (v.contains(*vi) ? 1 : 0));
+		}
+		return k;
+	};
+
 	variable_set m_v;				///< Variable list vector (*scope*).
-	std::vector<value> m_t;			///< Table of values.
+	storage m_t;					///< Table of values.
 	FactorType m_type;				///< Factor type (Probability, Utility, Decision)
 
 	///
@@ -0,0 +1,304 @@
+/*
+ * factor_lanes.h
+ *
+ *  Created on: 17 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file factor_lanes.h
+/// \brief Factors holding several variants of the same table
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_FACTOR_LANES_H_
+#define IBM_MERLIN_FACTOR_LANES_H_
+
+#include "factor.h"
+
+namespace merlin {
+
+/**
+ * Factor with K lanes
+ *
+ * A factor whose entries are vectors of K values, one per variant (lane) of
+ * the table. All lanes share the scope, so the index computations of an
+ * operation (the subindex walk over the scope of the result) are done once
+ * for all of them. The K values of an entry are contiguous, so the inner loop
+ * of each kernel runs over the lanes with unit stride and no aliasing, which
+ * the compiler turns into SIMD code.
+ */
+class factor_lanes {
+public:
+	typedef double value;						///< Type of the values
+	typedef factor::FactorType FactorType;		///< Type of the factor
+
+	///
+	/// \brief Constructor (a constant with one lane).
+	///
+	explicit factor_lanes(value val = 1.0, size_t k = 1) :
+		m_v(), m_k(k), m_t(k, val), m_type(FactorType::Probability) {};
+
+	///
+	/// \brief Constructor with a scope and a constant value in all lanes.
+	///
+	factor_lanes(const variable_set& vs, size_t k, value val = 0.0) :
+		m_v(vs), m_k(k), m_t(vs.num_states() * k, val),
+		m_type(FactorType::Probability) {};
+
+	///
+	/// \brief Constructor from the variants of a table (same scope).
+	///
+	factor_lanes(const std::vector<factor>& lanes) :
+		m_v(lanes.at(0).vars()), m_k(lanes.size()),
+		m_t(lanes[0].numel() * lanes.size()), m_type(lanes[0].get_type()) {
+		for (size_t k = 0; k < m_k; ++k) {
+			if (lanes[k].vars() != m_v) {
+				throw std::runtime_error("Lanes of a factor must have the same scope.");
+			}
+			const value* t = lanes[k].table();
+			for (size_t i = 0; i < numel(); ++i) {
+				m_t[i * m_k + k] = t[i];
+			}
+		}
+	}
+
+	///
+	/// \brief Constructor with the same table in all lanes.
+	///
+	factor_lanes(const factor& f, size_t k) :
+		m_v(f.vars()), m_k(k), m_t(f.numel() * k), m_type(f.get_type()) {
+		const value* t = f.table();
+		for (size_t i = 0; i < f.numel(); ++i) {
+			std::fill(&m_t[i * m_k], &m_t[i * m_k] + m_k, t[i]);
+		}
+	}
+
+	// Accessors
+
+	const variable_set& vars() const { return m_v; }
+	size_t nvar() const { return m_v.nvar(); }
+	size_t numel() const { return m_t.size() / m_k; }
+	size_t lanes() const { return m_k; }
+	FactorType get_type() const { return m_type; }
+	void set_type(FactorType t) { m_type = t; }
+
+	///
+	/// \brief The K values of an entry.
+	///
+	const value* operator[](size_t i) const { return &m_t[i * m_k]; }
+	value* operator[](size_t i) { return &m_t[i * m_k]; }
+
+	///
+	/// \brief Copy of one lane as an ordinary factor.
+	///
+	factor lane(size_t k) const {
+		factor f(m_v, 0.0);
+		for (size_t i = 0; i < numel(); ++i) {
+			f[i] = m_t[i * m_k + k];
+		}
+		f.set_type(m_type);
+		return f;
+	}
+
+	// Combination (over the union of the scopes)
+
+	factor_lanes operator*(const factor_lanes& B) const {
+		return binaryOp(B, opTimes());
+	}
+	factor_lanes operator+(const factor_lanes& B) const {
+		return binaryOp(B, opPlus());
+	}
+	factor_lanes operator/(const factor_lanes& B) const {
+		return binaryOp(B, opDivide());
+	}
+	factor_lanes& operator*=(const factor_lanes& B) {
+		return *this = binaryOp(B, opTimes());
+	}
+	factor_lanes& operator+=(const factor_lanes& B) {
+		return *this = binaryOp(B, opPlus());
+	}
+	factor_lanes& operator/=(const factor_lanes& B) {
+		return *this = binaryOp(B, opDivide());
+	}
+
+	///
+	/// \brief Raise every entry to a power.
+	///
+	factor_lanes& operator^=(value p) {
+		if (p != 1.0) {
+			for (size_t i = 0; i < m_t.size(); ++i) {
+				m_t[i] = std::pow(m_t[i], p);
+			}
+		}
+		return *this;
+	}
+	factor_lanes operator^(value p) const {
+		factor_lanes F(*this);
+		return F ^= p;
+	}
+
+	///
+	/// \brief Scale lane k by s[k].
+	///
+	factor_lanes& scale(const std::vector<value>& s) {
+		const size_t K = m_k;
+		for (size_t i = 0; i < numel(); ++i) {
+			value* __restrict f = &m_t[i * K];
+			for (size_t k = 0; k < K; ++k) {
+				f[k] *= s[k];
+			}
+		}
+		return *this;
+	}
+
+	///
+	/// \brief Largest entry of each lane.
+	///
+	std::vector<value> max() const {
+		std::vector<value> mx(m_k, -infty());
+		for (size_t i = 0; i < numel(); ++i) {
+			const value* a = &m_t[i * m_k];
+			for (size_t k = 0; k < m_k; ++k) {
+				mx[k] = std::max(mx[k], a[k]);
+			}
+		}
+		return mx;
+	}
+
+	///
+	/// \brief Sum of the entries of each lane.
+	///
+	std::vector<value> sum() const {
+		std::vector<value> z(m_k, 0.0);
+		for (size_t i = 0; i < numel(); ++i) {
+			const value* a = &m_t[i * m_k];
+			for (size_t k = 0; k < m_k; ++k) {
+				z[k] += a[k];
+			}
+		}
+		return z;
+	}
+
+	// Elimination (lane by lane)
+
+	factor_lanes sum(const variable_set& vs) const {
+		return eliminate(vs, opPlus(), 0.0);
+	}
+	factor_lanes max(const variable_set& vs) const {
+		return eliminate(vs, opMax(), -infty());
+	}
+	factor_lanes marginal(const variable_set& target) const {
+		return eliminate(m_v - target, opPlus(), 0.0);
+	}
+
+	///
+	/// \brief Power sum (sum_v f^p)^(1/p) of each lane (see factor::sum_power).
+	///
+	factor_lanes sum_power(const variable_set& vs, value p) const {
+		if (p == 1.0) {
+			return sum(vs);
+		}
+		factor_lanes F = ((*this) ^ p).sum(vs);
+		return F ^= (1.0 / p);
+	}
+
+	///
+	/// \brief Condition on a value of a variable.
+	///
+	factor_lanes condition(const variable& v, size_t val) const {
+		factor_lanes F(m_v - v, m_k);
+		F.m_type = m_type;
+		size_t stride = 1, d = 1;
+		for (size_t j = 0; j < m_v.nvar(); ++j) {
+			if (m_v[j] == v) { d = m_v[j].states(); break; }
+			stride *= m_v[j].states();
+		}
+		size_t o = 0;
+		for (size_t i = 0; i < numel(); ++i) {
+			if ((i / stride) % d != val) continue;
+			std::copy(&m_t[i * m_k], &m_t[i * m_k] + m_k, &F.m_t[o * m_k]);
+			++o;
+		}
+		return F;
+	}
+
+protected:
+
+	struct opTimes {
+		value operator()(value a, value b) const { return a * b; }
+	};
+	struct opPlus {
+		value operator()(value a, value b) const { return a + b; }
+	};
+	struct opMax {
+		value operator()(value a, value b) const { return (a < b) ? b : a; }
+	};
+	struct opDivide { // 0 where the divisor is (like factor::binOpDivide)
+		value operator()(value a, value b) const { return (b != 0) ? a / b : 0; }
+	};
+
+	///
+	/// \brief Lane-wise binary operation over the union of the scopes.
+	///
+	template<typename Function>
+	factor_lanes binaryOp(const factor_lanes& B, Function Op) const {
+		assert(m_k == B.m_k);
+		variable_set v = m_v + B.m_v;
+		factor_lanes F(v, m_k);
+		F.m_type = m_type;
+		const size_t K = m_k;
+		subindex s1(v, m_v), s2(v, B.m_v);
+		for (size_t i = 0; i < F.numel(); ++i, ++s1, ++s2) {
+			const value* __restrict a = &m_t[(size_t)s1 * K];
+			const value* __restrict b = &B.m_t[(size_t)s2 * K];
+			value* __restrict f = &F.m_t[i * K];
+			for (size_t k = 0; k < K; ++k) {
+				f[k] = Op(a[k], b[k]);
+			}
+		}
+		return F;
+	}
+
+	///
+	/// \brief Lane-wise elimination of a set of variables.
+	///
+	template<typename Function>
+	factor_lanes eliminate(const variable_set& vs, Function Op, value init) const {
+		factor_lanes F(m_v - vs, m_k, init);
+		F.m_type = m_type;
+		const size_t K = m_k;
+		subindex s(m_v, F.m_v);
+		for (size_t i = 0; i < numel(); ++i, ++s) {
+			const value* __restrict a = &m_t[i * K];
+			value* __restrict f = &F.m_t[(size_t)s * K];
+			for (size_t k = 0; k < K; ++k) {
+				f[k] = Op(f[k], a[k]);
+			}
+		}
+		return F;
+	}
+
+	// Members:
+
+	variable_set m_v;					///< Scope of the factor
+	size_t m_k;							///< Number of lanes
+	std::vector<value> m_t;				///< Table (the lanes of an entry are contiguous)
+	FactorType m_type;					///< Type of the factor
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_FACTOR_LANES_H_ */
@@ -30,6 +30,7 @@
 #include "enum.h"
 #include "factor.h"
 #include "graph.h"
+#include "writer.h"
 
 
 namespace merlin {
@@ -187,6 +188,7 @@ public:
 
 		m_factors = tables;
 		fixup();
+		share_tables();
 	}
 
 	///
@@ -199,46 +201,37 @@ public:
 	///
 	virtual void write(const char* file_name) {
 
-		// Open the output stream
-		std::ofstream os(file_name);
-		if (os.fail()) {
-			std::cout << "Error while opening the output file: " << file_name << std::endl;
-			throw std::runtime_error("Output file error");
-		}
+		// Open the output file
+		writer os(file_name);
 
 		// Write the header
-		os << "MARKOV" << std::endl;
-		os << nvar() << std::endl;
+		os.text("MARKOV\n").integer(nvar()).text('\n');
 		for (size_t i = 0; i < m_dims.size(); ++i) {
-			os << m_dims[i] << " ";
+			os.integer(m_dims[i]).text(' ');
 		}
-		os << std::endl;
+		os.text('\n');
 
 		// Write the factor scopes
-		os << num_factors() << std::endl;
+		os.integer(num_factors()).text('\n');
 		for (size_t i = 0; i < m_factors.size(); ++i) {
 			const factor& f = m_factors[i];
-			os << f.nvar();
+			os.integer(f.nvar());
 			variable_set::const_iterator si = f.vars().begin();
 			for (; si != f.vars().end(); ++si) {
-				os << " " << (*si).label();
+				os.text(' ').integer((*si).label());
 			}
-			os << std::endl;
+			os.text('\n');
 		}
 
 		// Write the factor tables
-		os << std::endl;
+		os.text('\n');
 		for (size_t i = 0; i < m_factors.size(); ++i) {
 			const factor& f = m_factors[i];
-			os << f.numel() << std::endl;
-			for (size_t j = 0; j < f.numel(); ++j) {
-				os << " " << std::setiosflags(std::ios::fixed)
-					<< std::setprecision(8) << f[j];
-			}
-			os << std::endl << std::endl;
+			os.integer(f.numel()).text('\n');
+			os.table(f, 8).text("\n\n");
 		}
 
-		// Close the output stream
+		// Close the output file
 		os.close();
 	}
 
@@ -718,6 +711,51 @@ public:
 		return width;
 	}
 
+	///
+	/// \brief Find the pseudo tree induced by an elimination order.
+	/// \param order 	The variable elimination order
+	/// \return the parent of each variable in the pseudo tree (or -1 if
+	///		the variable is a root). The parent of a variable is its earliest
+	///		eliminated neighbor (in the induced graph) that follows it in the
+	///		elimination order.
+	///
+	std::vector<vindex> pseudo_tree(const variable_order_t& order) const {
+		size_t n = order.size();
+		std::vector<vindex> parents(nvar(), vindex(-1));
+		std::vector<variable_set> adj = mrf();
+		std::vector<size_t> position(nvar(), n);
+		for (size_t i = 0; i < n; ++i) {
+			position[order[i]] = i;
+		}
+
+		// eliminate variables and create induced edges
+		for (size_t i = 0; i < n; ++i) {
+			vindex x = order[i];
+
+			// find the neighbors appearing later in the ordering
+			variable_set S;
+			size_t first = n;
+			for (variable_set::const_iterator v = adj[x].begin();
+					v != adj[x].end(); ++v) {
+				size_t pos = position[_vindex(*v)];
+				if (pos > i && pos < n) {
+					S |= *v;
+					first = std::min(first, pos);
+				}
+			}
+
+			if (first == n) continue; // root of a pseudo tree
+			parents[x] = order[first];
+
+			// connect the neighbors appearing later in the ordering
+			for (variable_set::const_iterator v = S.begin(); v != S.end(); ++v) {
+				adj[_vindex(*v)] |= (S - *v);
+			}
+		}
+
+		return parents;
+	}
+
 	///
 	/// \brief Variable ordering methods.
 	///
@@ -726,17 +764,19 @@ public:
     ///
     /// \brief Find a variable elimination order.
     /// \param ord_type 	The ordering method
+    /// \param seed 		The seed of the random tie-breaks (see rand_stream)
     /// \return the variable ordering corresponding to the method, such that
     ///		the first variable in the ordering is eliminated first.
     ///
-	virtual variable_order_t order(OrderMethod ord_type) const {
+	virtual variable_order_t order(OrderMethod ord_type, uint64_t seed = 0) const {
+		rand_stream stream(seed); // ties are broken the same way on every thread
 		variable_order_t order;
 		order.resize(nvar());
 
 		if (ord_type == OrderMethod::Random) {	// random orders are treated here
 			for (size_t i = 0; i < nvar(); i++)
 				order[i] = var(i).label();	// build a list of all the variables
-			std::random_shuffle(order.begin(), order.end());// and randomly permute them
+			std::shuffle(order.begin(), order.end(), rand_engine());// and randomly permute them
 			return order;						    		// then return
 		}
 
@@ -783,10 +823,12 @@ public:
     ///
     /// \brief Find a variable elimination order.
     /// \param ord_type 	The ordering method
+    /// \param seed 		The seed of the random tie-breaks (see rand_stream)
     /// \return the variable ordering corresponding to the method, such that
     ///		the first variable in the ordering is eliminated first.
     ///
-	variable_order_t order2(OrderMethod ord_type) const {
+	variable_order_t order2(OrderMethod ord_type, uint64_t seed = 0) const {
+		rand_stream stream(seed); // ties are broken the same way on every thread
 
 		// variable order to be computed
 		variable_order_t order;
@@ -795,7 +837,7 @@ public:
 			order.resize(nvar());
 			for (size_t i = 0; i < nvar(); i++)
 				order[i] = var(i).label();	//   build a list of all the variables
-			std::random_shuffle(order.begin(), order.end());//   and randomly permute them
+			std::shuffle(order.begin(), order.end(), rand_engine());//   and randomly permute them
 			return order;											//   then return
 		}
 
@@ -932,10 +974,12 @@ public:
     /// \brief Find a constrained variable elimination order.
     /// \param ord_type		The ordering method
     /// \param var_types 	The vector containing the variable types (SUM or MAX)
+    /// \param seed 		The seed of the random tie-breaks (see rand_stream)
     /// \return the constrained variable ordering corresponding to the method,
     /// such that SUM variables are eliminated before any of the MAX variables.
     ///
-	variable_order_t order2(OrderMethod ord_type, std::vector<bool> var_types) const {
+	variable_order_t order2(OrderMethod ord_type, std::vector<bool> var_types, uint64_t seed = 0) const {
+		rand_stream stream(seed); // ties are broken the same way on every thread
 
 		// variable order to be computed
 		variable_order_t order;
@@ -1093,10 +1137,12 @@ public:
     /// \brief Find a constrained variable elimination order.
     /// \param ord_type		The ordering method
     /// \param var_types 	The vector containing the variable types (SUM or MAX)
+    /// \param seed 		The seed of the random tie-breaks (see rand_stream)
     /// \return the constrained variable ordering corresponding to the method, 
     /// such that SUM variables are eliminated before any of the MAX variables.
     ///
-	variable_order_t order(OrderMethod ord_type, std::vector<bool> var_types) const {
+	variable_order_t order(OrderMethod ord_type, std::vector<bool> var_types, uint64_t seed = 0) const {
+		rand_stream stream(seed); // ties are broken the same way on every thread
 		variable_order_t order;
 		order.resize(nvar());
 
@@ -1108,8 +1154,8 @@ public:
 				else sumOrd.push_back(var(i).label());
 			}
 
-			std::random_shuffle(sumOrd.begin(), sumOrd.end());//   and randomly permute them
-			std::random_shuffle(maxOrd.begin(), maxOrd.end());
+			std::shuffle(sumOrd.begin(), sumOrd.end(), rand_engine());//   and randomly permute them
+			std::shuffle(maxOrd.begin(), maxOrd.end(), rand_engine());
 			size_t i = 0;
 			for (size_t j = 0; j < sumOrd.size(); ++j) order[i++] = sumOrd[j];
 			for (size_t j = 0; j < maxOrd.size(); ++j) order[i++] = maxOrd[j];
@@ -1193,7 +1239,7 @@ public:
 		if (ord_type == OrderMethod::Random) {	// random orders are treated here
 			for (size_t i = 0; i < nvar(); i++)
 				order[i] = var(i).label();	//   build a list of all the variables
-			std::random_shuffle(order.begin(), order.end());//   and randomly permute them
+			std::shuffle(order.begin(), order.end(), rand_engine());//   and randomly permute them
 			// !!! what scoring mechanism to use?
 			//std::pair<size_t,size_t> newsize = pseudoTreeSize(order);
 			//if (newsize.first < width || (newsize.first == width && newsize.second < height)) {
@@ -1343,6 +1389,22 @@ public:
 		return m_global_const.max();
 	}
 
+	///
+	/// \brief Share the identical tables of the model (see factor::intern).
+	///
+	/// Repeated tables (eg the same CPT in every time slice) are stored once,
+	/// and the products and marginals computed from them can be memoized by a
+	/// solver run (see factor::memo).
+	/// \return the number of tables shared with an earlier one.
+	///
+	size_t share_tables() {
+		size_t shared = 0;
+		for (size_t i = 0; i < m_factors.size(); ++i) {
+			if (m_factors[i].intern()) ++shared;
+		}
+		return shared;
+	}
+
 protected:
 
 	///
@@ -1388,6 +1450,20 @@ protected:
 		}
 	}
 
+	///
+	/// \brief Set the domains of the variables that are not covered by any
+	///	factor (which fixup() cannot recover from the factor scopes).
+	/// \param dims 	The domain sizes of all variables in the model
+	///
+	void fixup(const std::vector<size_t>& dims) {
+		fixup();
+		m_vadj.resize(std::max(m_vadj.size(), dims.size()));
+		m_dims.resize(std::max(m_dims.size(), dims.size()), 0);
+		for (size_t i = 0; i < dims.size(); ++i) {
+			if (m_dims[i] == 0) m_dims[i] = dims[i];
+		}
+	}
+
 	// Internal helper functions:
 
 	///
@@ -1501,7 +1577,7 @@ protected:
 		order.resize(nvar());
 		for (size_t i = 0; i < nvar(); i++)
 			order[i] = var(i).label();		// build a list of all the variables
-		std::random_shuffle(order.begin(), order.end());// and randomly permute them
+		std::shuffle(order.begin(), order.end(), rand_engine());// and randomly permute them
 		return order;
 	}
 
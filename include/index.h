@@ -27,6 +27,7 @@
 #define IBM_MELRIN_INDEX_H_
 
 #include <iostream>
+#include <stdint.h>
 
 namespace merlin {
 
@@ -46,6 +47,8 @@ public:
 	vsize *m_add;				///< How much to add when we increment
 	vsize *m_subtract;			///< How much to subtract when we wrap each variable
 
+	static const size_t small_rank = 16;	///< Largest scope kept in the object itself
+
 	///
 	/// \brief Construct the sub-index.
 	///
@@ -55,10 +58,7 @@ public:
 		m_end = 1;
 		m_nd = full.nvar();
 		m_dims = full.dims();
-		m_state = new vsize[m_nd];
-		m_add = new vsize[m_nd];
-		m_subtract = new vsize[m_nd];
-		m_skipped = new bool[m_nd];
+		allocate();
 		// Compute reference index updates
 		vsize i, j;
 		for (i = 0, j = 0; i < m_nd; ++i) {
@@ -84,13 +84,10 @@ public:
 		m_idx = s.m_idx;
 		m_end = s.m_end;
 		m_nd = s.m_nd;
-		m_state = new vsize[m_nd];
+		allocate();
 		std::copy(s.m_state, s.m_state + m_nd, m_state);
-		m_add = new vsize[m_nd];
 		std::copy(s.m_add, s.m_add + m_nd, m_add);
-		m_subtract = new vsize[m_nd];
 		std::copy(s.m_subtract, s.m_subtract + m_nd, m_subtract);
-		m_skipped = new bool[m_nd];
 		std::copy(s.m_skipped, s.m_skipped + m_nd, m_skipped);
 	}
 
@@ -98,10 +95,12 @@ public:
 	/// \brief Sub-index destructor.
 	///
 	~subindex(void) {
-		delete[] m_state;
-		delete[] m_skipped;
-		delete[] m_add;
-		delete[] m_subtract;
+		if (m_nd > small_rank) {
+			delete[] m_state;
+			delete[] m_skipped;
+			delete[] m_add;
+			delete[] m_subtract;
+		}
 	}
 
 	///
@@ -125,7 +124,30 @@ public:
 	/// \brief Prefix addition operator.
 	///
 	subindex& operator++(void) {
-		for (size_t i = 0; i < m_nd; ++i) { // for each variable
+		return step(0);
+	}
+
+	///
+	/// \brief Skip the remaining values of the first variable (which must be
+	/// at its first value): move to the next block of positions that differ
+	/// only in the first variable.
+	///
+	subindex& next_block(void) {
+		return step(1);
+	}
+
+	///
+	/// \brief Stride of the first variable in the sub-index (0 if skipped).
+	///
+	size_t stride0() const {
+		return (m_nd > 0 && !m_skipped[0]) ? 1 : 0;
+	}
+
+	///
+	/// \brief Increment the variables from a given one on.
+	///
+	subindex& step(size_t first) {
+		for (size_t i = first; i < m_nd; ++i) { // for each variable
 			if (m_state[i] == m_dims[i]) { // if we reached the maximum, wrap around to 1
 				m_state[i] = 1;          // subtract wrap value from position
 				if (!m_skipped[i])
@@ -187,6 +209,97 @@ public:
 		return os;
 	}
 
+private:
+
+	///
+	/// \brief Point the arrays to the local buffers (small scopes) or the heap.
+	///
+	void allocate() {
+		if (m_nd <= small_rank) {
+			m_state = m_buf;
+			m_add = m_buf + small_rank;
+			m_subtract = m_buf + 2 * small_rank;
+			m_skipped = m_skip_buf;
+		} else {
+			m_state = new vsize[m_nd];
+			m_add = new vsize[m_nd];
+			m_subtract = new vsize[m_nd];
+			m_skipped = new bool[m_nd];
+		}
+	}
+
+	subindex& operator=(const subindex&); // not assignable
+
+	vsize m_buf[3 * small_rank];		///< Local state, add and subtract arrays
+	bool m_skip_buf[small_rank];		///< Local skipped array
+};
+
+///
+/// \brief Subindex over a scope of binary variables.
+///
+/// Same as subindex when all the variables of the full scope are binary (and
+/// there are fewer than 64 of them): a position in the full scope is then a
+/// bitfield with one bit per variable, and the position in the sub-scope is
+/// made of the bits of its variables. On an increment, the number of trailing
+/// ones of the full position (the variables that wrap around) selects a
+/// precomputed change of the sub-position, which is cheaper than extracting
+/// the bits again (pext) at every step.
+///
+class binary_subindex {
+public:
+	typedef variable_set::vsize vsize;	///< Variable index
+
+	///
+	/// \brief Check if a scope can be indexed with a binary_subindex.
+	///
+	static bool applies(const variable_set& full) {
+		if (full.nvar() >= 64) return false;
+		const vsize* d = full.dims();
+		for (size_t i = 0; i < full.nvar(); ++i) {
+			if (d[i] != 2) return false;
+		}
+		return true;
+	}
+
+	///
+	/// \brief Construct the sub-index.
+	///
+	binary_subindex(const variable_set& full, const variable_set& sub) :
+		m_pos(0), m_idx(0) {
+		assert(full >> sub && applies(full));
+		size_t n = full.nvar(), w = 1, wrapped = 0;
+		for (size_t i = 0, j = 0; i < n; ++i) {
+			bool in = (j < sub.nvar() && sub[j] == full[i]);
+			m_delta[i] = (in ? w : 0) - wrapped; // bits 0..i-1 wrap, bit i is set
+			if (in) {
+				wrapped += w;
+				w <<= 1;
+				++j;
+			}
+		}
+		m_delta[n] = 0; // past the end
+	}
+
+	///
+	/// \brief Prefix addition operator.
+	///
+	binary_subindex& operator++(void) {
+		m_idx += m_delta[__builtin_ctzll(~m_pos)];
+		++m_pos;
+		return *this;
+	}
+
+	///
+	/// \brief Conversion to index value.
+	///
+	operator size_t() const {
+		return m_idx;
+	}
+
+private:
+	uint64_t m_pos;				///< Position in the full scope
+	size_t m_idx;				///< Position in the sub-scope
+	size_t m_delta[65];			///< Change of the position by number of wrapped variables
 };
 
 ///
@@ -0,0 +1,662 @@
+/*
+ * is.h
+ *
+ *  Created on: 5 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file is.h
+/// \brief Importance sampling for the expected utility of a policy in IDs
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_IS_H_
+#define IBM_MERLIN_IS_H_
+
+#include "limid.h"
+#include "algorithm.h"
+#include "mbe.h"
+
+namespace merlin {
+
+/**
+ * Importance Sampling (IS)
+ *
+ * Models supported: ID
+ *
+ * Estimates the expected utility of a decision policy, namely a factor for
+ * each decision variable whose argmax over the decision is the decision rule
+ * (as built by BE or MBE). If no policy is given, the policy of a MBE run is
+ * evaluated, whose expected utility is a lower bound on the MEU.
+ *
+ * The samples are drawn in the reverse of the constrained elimination order
+ * used by MBE. A chance variable is drawn from the product of the probability
+ * factors and probability messages of its bucket, given the values of the
+ * variables sampled before it (mixed with a uniform distribution so that no
+ * configuration has zero proposal probability), and a decision variable is
+ * set by its decision rule. Each sample is weighted by the ratio between its
+ * probability in the model and in the proposal, and the estimate is the
+ * average of the weighted utilities, with an (approximate, normal) 95%
+ * confidence interval from the sample variance.
+ *
+ * The lower bound holds with probability at least Confidence, by Markov's
+ * inequality: the weighted utilities shifted by the smallest total utility
+ * Umin, w*(U - Umin), are non-negative and their mean has expectation
+ * EU - Umin (the probability factors of an ID are conditional probability
+ * tables, so the weights have mean 1, times the constant probability
+ * factors). Thus with probability at least Confidence the average A of the
+ * shifted samples is below (EU - Umin) / (1 - Confidence), namely
+ * EU >= (1 - Confidence) * A + Umin. The bound makes no assumption on the
+ * variance of the weights, and is loose accordingly.
+ *
+ * The samples are drawn in batches and each factor is evaluated for the whole
+ * batch at once (the values of a variable are stored contiguously across the
+ * batch). Worker threads draw an equal share of the samples, each from its
+ * own random stream derived from the seed, thus the estimate is reproducible
+ * for a given seed, number of threads and batch size.
+ *
+ */
+class is : public limid, public algorithm {
+public:
+	typedef limid::findex findex;        ///< Factor index
+	typedef limid::vindex vindex;        ///< Variable index
+	typedef limid::flist flist;          ///< Collection of factor indices
+
+	///
+	/// \brief Properties of the algorithm
+	///
+	MER_ENUM( Property , Order,iBound,Samples,BatchSize,Threads,Seed,Mixture,Confidence,TimeLimit,Debug );
+
+	///
+	/// \brief Factor table evaluated at the sampled configurations.
+	///
+	struct table_ref {
+		const double* table;			///< Factor table
+		std::vector<vindex> vars;		///< Scope (without the target variable)
+		std::vector<size_t> strides;	///< Strides of the scope variables
+		size_t stride;					///< Stride of the target variable (if any)
+	};
+
+	///
+	/// \brief Running sums over the weighted samples.
+	///
+	struct estimate_t {
+		size_t n;						///< Number of samples
+		double sw, sw2;					///< Sums of the weights (and squares)
+		double sy, sy2;					///< Sums of the weighted utilities (and squares)
+		bool timeout;					///< Time limit reached
+
+		estimate_t() : n(0), sw(0), sw2(0), sy(0), sy2(0), timeout(false) {}
+	};
+
+public:
+
+	///
+	/// \brief Default constructor.
+	///
+	is() : limid() {
+		set_properties();
+	}
+
+	///
+	/// \brief Constructor with a graphical model.
+	///
+	is(const limid& lm) : limid(lm), m_gmo(lm) {
+		clear_factors();
+		set_properties();
+	}
+
+	///
+	/// \brief Clone the algorithm.
+	/// \return the pointer to the new object containing the cloned algorithm.
+	///
+	virtual is* clone() const {
+		is* lm = new is(*this);
+		return lm;
+	}
+
+	// Lower bound on the expected utility (with probability Confidence) and
+	// upper end of its confidence interval
+	double ub() const {
+		return m_ub;
+	}
+	double lb() const {
+		return m_lb;
+	}
+	std::vector<size_t> best_config() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	double logZ() const {
+		throw std::runtime_error("Not implemented");
+	}
+	double logZub() const {
+		throw std::runtime_error("Not implemented");
+	}
+	double logZlb() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	// No beliefs defined currently
+	const factor& belief(size_t) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const factor& belief(variable) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const factor& belief(variable_set) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const vector<factor>& beliefs() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	///
+	/// \brief Set the mini-bucket i-bound of the proposal.
+	///
+	void set_ibound(size_t i) {
+		m_ibound = i ? i : std::numeric_limits<size_t>::max();
+	}
+
+	///
+	/// \brief Get the mini-bucket i-bound of the proposal.
+	///
+	size_t get_ibound() const {
+		return m_ibound;
+	}
+
+	///
+	/// \brief Set the variable elimination order.
+	///
+	void set_order(const variable_order_t& ord) {
+		m_order = ord;
+	}
+
+	///
+	/// \brief Set the policy to be evaluated (empty for the MBE policy).
+	///
+	void set_policy(const std::map<vindex, factor>& policy) {
+		m_given = policy;
+	}
+
+	///
+	/// \brief Get the estimated expected utility of the policy.
+	///
+	double get_estimate() const {
+		return m_estimate;
+	}
+
+	///
+	/// \brief Get the standard error of the estimate.
+	///
+	double get_std_error() const {
+		return m_std_error;
+	}
+
+	///
+	/// \brief Set the properties of the algorithm.
+	/// \param opt 	The string containing comma separated property value pairs
+	///
+	virtual void set_properties(std::string opt = std::string()) {
+		if (opt.length() == 0) {
+			set_properties("Order=MinFill,iBound=2,Samples=100000,BatchSize=256,Threads=0,Seed=0,Mixture=0.01,Confidence=0.95,TimeLimit=0,Debug=0");
+			return;
+		}
+		std::vector<std::string> strs = merlin::split(opt, ',');
+		for (size_t i = 0; i < strs.size(); ++i) {
+			std::vector<std::string> asgn = merlin::split(strs[i], '=');
+			switch (Property(asgn[0].c_str())) {
+			case Property::Order:
+				m_order.clear();
+				m_order_method = OrderMethod(asgn[1].c_str());
+				break;
+			case Property::iBound:
+				set_ibound(atol(asgn[1].c_str()));
+				break;
+			case Property::Samples:
+				m_samples = atol(asgn[1].c_str());
+				break;
+			case Property::BatchSize:
+				m_batch_size = std::max(1L, atol(asgn[1].c_str()));
+				break;
+			case Property::Threads:
+				m_threads = atol(asgn[1].c_str());
+				if (m_threads == 0) m_threads = std::max(1u, std::thread::hardware_concurrency());
+				break;
+			case Property::Seed:
+				m_seed = strtoul(asgn[1].c_str(), NULL, 10);
+				break;
+			case Property::Mixture:
+				m_mixture = atof(asgn[1].c_str());
+				break;
+			case Property::Confidence:
+				m_confidence = atof(asgn[1].c_str());
+				if (m_confidence <= 0.0 || m_confidence >= 1.0) {
+					throw std::runtime_error("Confidence must be in (0, 1).");
+				}
+				break;
+			case Property::TimeLimit:
+				m_time_limit = atof(asgn[1].c_str());
+				break;
+			case Property::Debug:
+				m_debug = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	///
+	/// \brief Initialize the proposal and the policy.
+	///
+	void init() {
+
+		// Start the timer and store it
+		m_start_time = timeSystem();
+
+		bool islimid = m_gmo.islimid();
+		if (islimid) {
+			throw std::runtime_error("IS is only supported for standard IDs.");
+		}
+
+		// Prologue
+		std::cout << "Initialize solver ..." << std::endl;
+		std::cout << " + models supported : ID" << std::endl;
+		std::cout << " + algorithm        : IS" << std::endl;
+		std::cout << " + i-bound          : " << m_ibound << std::endl;
+		std::cout << " + samples          : " << m_samples << std::endl;
+		std::cout << " + batch size       : " << m_batch_size << std::endl;
+		std::cout << " + threads          : " << m_threads << std::endl;
+		std::cout << " + seed             : " << m_seed << std::endl;
+		std::cout << " + confidence       : " << m_confidence << std::endl;
+		std::cout << " + time limit       : " << m_time_limit << std::endl;
+
+		if (m_order.size() == 0) { // if we need to construct an elimination ordering
+			m_order = m_gmo.order(m_order_method, m_seed);
+		}
+
+		// Get the induced width of the order
+		size_t wstar = m_gmo.induced_width(m_order);
+		std::cout << " + elimination      : ";
+		std::copy(m_order.begin(), m_order.end(),
+				std::ostream_iterator<size_t>(std::cout, " "));
+		std::cout << std::endl;
+		std::cout << " + induced width    : " << wstar << std::endl;
+
+		// Compile the mini-bucket messages (and policy) along the same order
+		std::ostringstream oss;
+		oss << "iBound=" << m_ibound << ",Debug=0";
+		mbe h(m_gmo);
+		h.set_properties(oss.str());
+		h.set_order(m_order);
+		h.run();
+		h.release_messages(m_messages);
+		m_policy = m_given;
+		if (m_policy.empty()) {
+			m_policy = h.get_policy();
+			std::cout << " + policy           : MBE" << std::endl;
+		} else {
+			std::cout << " + policy           : given" << std::endl;
+		}
+
+		size_t n = m_gmo.nvar();
+		std::vector<size_t> position(n);
+		for (size_t i = 0; i < m_order.size(); ++i) {
+			position[m_order[i]] = i;
+		}
+
+		// Proposal of each chance variable: the probability factors and
+		// messages placed in its bucket
+		m_proposal.clear();
+		m_proposal.resize(n);
+		m_prob.clear();
+		m_util.clear();
+		m_logc = 0.0;
+		m_uc = 0.0;
+		m_umin = 0.0;
+		const std::vector<factor>& fin = m_gmo.get_factors();
+		for (size_t i = 0; i < fin.size(); ++i) {
+			const variable_set& vs = fin[i].vars();
+			bool isprob = (fin[i].get_type() == factor::FactorType::Probability);
+			if (vs.size() == 0) {
+				if (isprob) m_logc += std::log(fin[i][0]);
+				else m_uc += fin[i][0];
+				continue;
+			}
+
+			if (isprob) {
+				m_prob.push_back(make_ref(fin[i], vindex(-1)));
+			} else {
+				m_util.push_back(make_ref(fin[i], vindex(-1)));
+				m_umin += fin[i].min();
+				continue;
+			}
+
+			vindex b = vs[0].label();
+			for (size_t j = 1; j < vs.size(); ++j) {
+				if (position[vs[j].label()] < position[b]) b = vs[j].label();
+			}
+			if (m_vtypes[b] == 'c') {
+				m_proposal[b].push_back(make_ref(fin[i], b));
+			}
+		}
+
+		const std::vector<vindex>& dst = h.get_message_targets();
+		for (size_t i = 0; i < m_messages.size(); ++i) {
+			vindex b = dst[i];
+			if (b == vindex(-1) || m_vtypes[b] != 'c') continue;
+			if (m_messages[i].get_type() != factor::FactorType::Probability) continue;
+			m_proposal[b].push_back(make_ref(m_messages[i], b));
+		}
+
+		// Decision rules (their scopes must be sampled before the decision)
+		m_rules.clear();
+		m_rules.resize(n);
+		for (size_t x = 0; x < n; ++x) {
+			if (m_vtypes[x] != 'd') continue;
+			std::map<vindex, factor>::const_iterator pi = m_policy.find(x);
+			if (pi == m_policy.end()) {
+				m_rules[x].table = NULL;
+				continue;
+			}
+
+			const variable_set& vs = pi->second.vars();
+			for (size_t j = 0; j < vs.size(); ++j) {
+				if (position[vs[j].label()] < position[x]) {
+					std::ostringstream err;
+					err << "Policy of decision " << x << " depends on variable "
+						<< vs[j].label() << " which is not observed before it.";
+					throw std::runtime_error(err.str());
+				}
+			}
+			m_rules[x] = make_ref(pi->second, x);
+		}
+
+		std::cout << "Initialization complete in "
+			<< (timeSystem() - m_start_time) << " seconds." << std::endl;
+	}
+
+	///
+	/// \brief Run importance sampling.
+	///
+	virtual void run() {
+
+		// Initialize the algorithm
+		init();
+
+		// Split the samples among the threads
+		std::cout << "Begin importance sampling ..." << std::endl;
+		std::vector<estimate_t> partial(m_threads);
+		std::vector<std::thread> workers;
+		for (size_t w = 0; w < m_threads; ++w) {
+			size_t ns = m_samples / m_threads + (w < m_samples % m_threads ? 1 : 0);
+			workers.push_back(std::thread(&is::worker, this, w, ns,
+					std::ref(partial[w])));
+		}
+		for (size_t w = 0; w < m_threads; ++w) {
+			workers[w].join();
+		}
+
+		estimate_t e;
+		for (size_t w = 0; w < m_threads; ++w) {
+			e.n += partial[w].n;
+			e.sw += partial[w].sw;
+			e.sw2 += partial[w].sw2;
+			e.sy += partial[w].sy;
+			e.sy2 += partial[w].sy2;
+			e.timeout = e.timeout || partial[w].timeout;
+		}
+
+		double N = (double)e.n;
+		m_estimate = (e.n > 0) ? e.sy / N : 0.0;
+		double var = (e.n > 1) ? (e.sy2 - N * m_estimate * m_estimate) / (N - 1) : 0.0;
+		m_std_error = std::sqrt(std::max(0.0, var) / std::max(1.0, N));
+		m_ub = m_estimate + 1.96 * m_std_error;
+
+		// Markov's inequality on the shifted weighted utilities
+		double umin = m_uc + m_umin;
+		double shifted = (e.n > 0) ? (e.sy - umin * e.sw) / N : 0.0;
+		m_lb = (1.0 - m_confidence) * std::max(0.0, shifted) + umin * std::exp(m_logc);
+		double ess = (e.sw2 > 0.0) ? e.sw * e.sw / e.sw2 : 0.0;
+
+		std::cout << "End importance sampling." << std::endl;
+		if (e.timeout) {
+			std::cout << "Time limit reached." << std::endl;
+		}
+		std::cout << "Samples: " << e.n << ", effective sample size: " << ess
+			<< ", mean weight: " << (e.n > 0 ? e.sw / N : 0.0) << std::endl;
+		std::cout << "Expected utility of the policy is " << m_estimate
+			<< " (standard error " << m_std_error << ")" << std::endl;
+		std::cout << "95% confidence interval is [" << m_estimate - 1.96 * m_std_error
+			<< ", " << m_ub << "]" << std::endl;
+		std::cout << "Lower bound (confidence " << m_confidence << ") is " << m_lb << std::endl;
+		std::cout << "CPU time is " << (timeSystem() - m_start_time) << " seconds" << std::endl;
+		std::cout << "Done." << std::endl << std::endl;
+	}
+
+protected:
+
+	///
+	/// \brief Reference a factor table, with the strides of its variables.
+	///
+	table_ref make_ref(const factor& f, vindex target) const {
+		table_ref r;
+		r.table = f.table();
+		r.stride = 0;
+		const variable_set& vs = f.vars();
+		size_t m = 1;
+		for (size_t j = 0; j < vs.size(); ++j) {
+			if (vs[j].label() == target) {
+				r.stride = m;
+			} else {
+				r.vars.push_back(vs[j].label());
+				r.strides.push_back(m);
+			}
+			m *= vs[j].states();
+		}
+		return r;
+	}
+
+	///
+	/// \brief Compute the table index of each sample in the batch (the
+	///	target variable excluded). Values are stored by variable, then sample.
+	///
+	static void index(const table_ref& r, const std::vector<size_t>& vals,
+			size_t B, std::vector<size_t>& idx) {
+		std::fill(idx.begin(), idx.begin() + B, 0);
+		for (size_t j = 0; j < r.vars.size(); ++j) {
+			const size_t* v = &vals[r.vars[j] * B];
+			size_t s = r.strides[j];
+			for (size_t b = 0; b < B; ++b) {
+				idx[b] += s * v[b];
+			}
+		}
+	}
+
+	///
+	/// \brief Draw a batch of samples and accumulate their weighted utilities.
+	///
+	void sample_batch(size_t B, rng& gen, std::vector<size_t>& vals,
+			std::vector<size_t>& idx, std::vector<double>& w,
+			std::vector<double>& logw, std::vector<double>& pmf,
+			estimate_t& e) {
+
+		std::fill(logw.begin(), logw.begin() + B, m_logc);
+
+		// Sample the variables (reverse elimination order)
+		for (variable_order_t::const_reverse_iterator xi = m_order.rbegin();
+				xi != m_order.rend(); ++xi) {
+			vindex x = *xi;
+			size_t K = var(x).states();
+			size_t* vx = &vals[x * B];
+
+			if (m_vtypes[x] == 'd') { // apply the decision rule
+				const table_ref& r = m_rules[x];
+				if (r.table == NULL) {
+					std::fill(vx, vx + B, 0);
+					continue;
+				}
+				index(r, vals, B, idx);
+				for (size_t b = 0; b < B; ++b) {
+					const double* t = r.table + idx[b];
+					size_t best = 0;
+					for (size_t k = 1; k < K; ++k) {
+						if (t[k * r.stride] > t[best * r.stride]) best = k;
+					}
+					vx[b] = best;
+				}
+				continue;
+			}
+
+			// Chance: product of the bucket functions, for all values at once
+			std::fill(pmf.begin(), pmf.begin() + B * K, 1.0);
+			const std::vector<table_ref>& fs = m_proposal[x];
+			for (size_t i = 0; i < fs.size(); ++i) {
+				const table_ref& r = fs[i];
+				index(r, vals, B, idx);
+				for (size_t b = 0; b < B; ++b) {
+					const double* t = r.table + idx[b];
+					double* p = &pmf[b * K];
+					for (size_t k = 0; k < K; ++k) {
+						p[k] *= t[k * r.stride];
+					}
+				}
+			}
+
+			for (size_t b = 0; b < B; ++b) {
+				double* p = &pmf[b * K];
+				double z = 0.0;
+				for (size_t k = 0; k < K; ++k) z += p[k];
+				double eps = (z > 0.0) ? m_mixture : 1.0;
+				double a = (z > 0.0) ? (1.0 - eps) / z : 0.0;
+				double u = gen.uniform(), c = 0.0;
+				size_t k = 0;
+				for (; k + 1 < K; ++k) {
+					c += a * p[k] + eps / K;
+					if (u < c) break;
+				}
+				vx[b] = k;
+				logw[b] -= std::log(a * p[k] + eps / K);
+			}
+		}
+
+		// Weights: probability of the samples over their proposal probability
+		std::fill(w.begin(), w.begin() + B, 1.0);
+		for (size_t i = 0; i < m_prob.size(); ++i) {
+			const table_ref& r = m_prob[i];
+			index(r, vals, B, idx);
+			for (size_t b = 0; b < B; ++b) {
+				w[b] *= r.table[idx[b]];
+			}
+			if (i % 8 == 7) { // avoid underflow
+				for (size_t b = 0; b < B; ++b) {
+					logw[b] += std::log(w[b]);
+					w[b] = 1.0;
+				}
+			}
+		}
+		for (size_t b = 0; b < B; ++b) {
+			w[b] = std::exp(logw[b] + std::log(w[b]));
+		}
+
+		// Utilities of the samples (reuses logw)
+		std::fill(logw.begin(), logw.begin() + B, m_uc);
+		for (size_t i = 0; i < m_util.size(); ++i) {
+			const table_ref& r = m_util[i];
+			index(r, vals, B, idx);
+			for (size_t b = 0; b < B; ++b) {
+				logw[b] += r.table[idx[b]];
+			}
+		}
+
+		for (size_t b = 0; b < B; ++b) {
+			double y = w[b] * logw[b];
+			e.sw += w[b];
+			e.sw2 += w[b] * w[b];
+			e.sy += y;
+			e.sy2 += y * y;
+		}
+		e.n += B;
+	}
+
+	///
+	/// \brief Draw a share of the samples from the stream of a worker.
+	///
+	void worker(size_t w, size_t ns, estimate_t& e) {
+		rng gen(m_seed, w);
+
+		size_t n = m_gmo.nvar(), B = m_batch_size, K = 1;
+		for (size_t x = 0; x < n; ++x) {
+			K = std::max(K, var(x).states());
+		}
+		std::vector<size_t> vals(n * B, 0), idx(B);
+		std::vector<double> wt(B), logw(B), pmf(B * K);
+
+		while (e.n < ns) {
+			if (m_time_limit > 0 && timeSystem() - m_start_time > m_time_limit) {
+				e.timeout = true;
+				break;
+			}
+
+			size_t nb = std::min(B, ns - e.n);
+			if (nb < B) { // last batch: values are stored by variable, then sample
+				vals.assign(n * nb, 0);
+			}
+			sample_batch(nb, gen, vals, idx, wt, logw, pmf, e);
+
+			if (m_debug) {
+				std::cout << "  worker " << w << ": " << e.n << " samples, estimate "
+					<< e.sy / e.n << std::endl;
+			}
+		}
+	}
+
+protected:
+	// Members:
+
+	size_t m_ibound;					///< Mini-bucket i-bound (proposal)
+	limid m_gmo; 						///< Original influence diagram
+	double m_lb;						///< Lower bound (with probability m_confidence)
+	double m_ub;						///< Upper end of the confidence interval
+	double m_estimate;					///< Estimated expected utility of the policy
+	double m_std_error;					///< Standard error of the estimate
+	OrderMethod m_order_method;			///< Variable ordering method
+	variable_order_t m_order;			///< Variable order
+	size_t m_samples;					///< Number of samples
+	size_t m_batch_size;				///< Number of samples per batch
+	size_t m_threads;					///< Number of worker threads
+	unsigned long m_seed;				///< Seed of the random streams
+	double m_mixture;					///< Weight of the uniform distribution in the proposal
+	double m_confidence;				///< Probability that the lower bound holds
+	double m_time_limit;				///< Time limit in seconds (0 for none)
+	bool m_debug;						///< Internal debugging flag
+
+	std::map<vindex, factor> m_given;	///< Policy given by the user
+	std::map<vindex, factor> m_policy;	///< Policy to be evaluated
+	std::vector<factor> m_messages;		///< Mini-bucket messages
+	std::vector<std::vector<table_ref> > m_proposal; ///< Bucket functions of each chance variable
+	std::vector<table_ref> m_rules;		///< Decision rule of each decision variable
+	std::vector<table_ref> m_prob;		///< Input probability factors
+	std::vector<table_ref> m_util;		///< Input utility factors
+	double m_logc;						///< Log of the constant probability factors
+	double m_uc;						///< Constant utility factors
+	double m_umin;						///< Sum of the smallest entries of the utility factors
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_IS_H_ */
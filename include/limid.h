@@ -189,7 +189,8 @@ public:
 
 		m_factors = tables;
 		m_ftypes = temp;
-		fixup();
+		fixup(dims); // keep the domains of variables not covered by any factor
+		size_t num_shared = share_tables();
 
 		// Log statistics
 		size_t num_prob = 0, num_util = 0;
@@ -207,6 +208,7 @@ public:
 		std::cout << " + number of factors   : " << m_factors.size() << std::endl;
 		std::cout << " + probability factors : " << num_prob << std::endl;
 		std::cout << " + utility factors     : " << num_util << std::endl;
+		std::cout << " + shared tables       : " << num_shared << std::endl;
 	}
 
 	///
@@ -233,6 +235,88 @@ public:
 		return m_forgetful;
 	}
 
+	///
+	/// \brief Shift the utility factors such that they are non-negative.
+	/// \return the total shift, namely the constant that must be added back
+	///		to each expected utility computed over the shifted model.
+	///
+	double shift_utilities() {
+		double shift = 0.0;
+		for (size_t i = 0; i < m_factors.size(); ++i) {
+			if (m_factors[i].get_type() == factor::FactorType::Utility) {
+				double m = m_factors[i].min();
+				if (m < 0.0) {
+					m_factors[i] -= m;
+					shift += m;
+				}
+			}
+		}
+		return shift;
+	}
+
+	///
+	/// \brief Copy of the model with the variables renamed.
+	///
+	/// The variable with label v becomes the variable with label to[v], eg
+	/// its position in an elimination order: since the first variable of a
+	/// scope changes the fastest, eliminating the variables in the order of
+	/// their labels then reduces contiguous runs of the tables.
+	/// \param to 	The new label of each variable (a permutation)
+	/// \return the model over the renamed variables (factors in the same order).
+	///
+	limid relabel(const std::vector<vindex>& to) const {
+		assert(to.size() == nvar());
+		limid lm(*this);
+		std::vector<factor> fs(m_factors.size());
+		for (size_t i = 0; i < m_factors.size(); ++i) {
+			fs[i] = m_factors[i].relabel(to);
+		}
+		std::vector<size_t> dims(nvar());
+		for (vindex v = 0; v < nvar(); ++v) {
+			dims[to[v]] = var(v).states();
+			lm.m_vtypes[to[v]] = m_vtypes[v];
+		}
+		for (size_t i = 0; i < m_porder.size(); ++i) {
+			lm.m_porder[i] = to[m_porder[i]];
+		}
+		lm.clear_factors();
+		lm.m_factors = fs;
+		lm.fixup(dims);
+		lm.share_tables();
+		return lm;
+	}
+
+	///
+	/// \brief Condition the model on the value of a chance variable.
+	///
+	/// The entries of a probability factor over the variable that disagree
+	/// with the value are set to 0, thus the scopes are unchanged and the
+	/// expected utilities are joint with the evidence (not normalized).
+	/// \param v 		The chance variable
+	/// \param val 	The observed value
+	///
+	void set_evidence(vindex v, size_t val) {
+		if (v >= nvar() || m_vtypes[v] != 'c' || val >= var(v).states()) {
+			throw std::runtime_error("Evidence must be a value of a chance variable.");
+		}
+		for (size_t i = 0; i < m_factors.size(); ++i) {
+			factor& f = m_factors[i];
+			if (f.get_type() != factor::FactorType::Probability) continue;
+			const variable_set& vs = f.vars();
+			if (vs.contains(var(v)) == false) continue;
+			size_t stride = 1;
+			for (size_t j = 0; vs[j].label() != v; ++j) {
+				stride *= vs[j].states();
+			}
+			size_t dim = var(v).states();
+			for (size_t j = 0; j < f.numel(); ++j) {
+				if ((j / stride) % dim != val) f[j] = 0.0;
+			}
+			return;
+		}
+		throw std::runtime_error("Evidence variable is not in any probability factor.");
+	}
+
     ///
     /// \brief Find a variable elimination order.
 	///
@@ -240,10 +324,12 @@ public:
 	/// by the temporal order of the decisions. For LIMIDs there is no such
 	/// restriction of the temporal order of the decisions.
     /// \param ord_type 	The ordering method
+    /// \param seed 		The seed of the random tie-breaks (see rand_stream)
     /// \return the variable ordering corresponding to the method, such that
     ///		the first variable in the ordering is eliminated first.
     ///
-	virtual variable_order_t order(OrderMethod ord_type) const {
+	virtual variable_order_t order(OrderMethod ord_type, uint64_t seed = 0) const {
+		rand_stream stream(seed); // ties are broken the same way on every thread
 		variable_order_t order;
 		order.resize(nvar());
 
@@ -251,7 +337,7 @@ public:
 			if (ord_type == OrderMethod::Random) {	// random orders are treated here
 				for (size_t i = 0; i < nvar(); i++)
 					order[i] = var(i).label();	//   build a list of all the variables
-				std::random_shuffle(order.begin(), order.end());//   and randomly permute them
+				std::shuffle(order.begin(), order.end(), rand_engine());//   and randomly permute them
 				return order;											//   then return
 			}
 
@@ -339,7 +425,7 @@ public:
 			order.clear();
 			if (ord_type == OrderMethod::Random) {	// random orders are treated here
 				for (size_t i = 0; i < bundles.size(); i++) {
-					std::random_shuffle(bundles[i].begin(), bundles[i].end());
+					std::shuffle(bundles[i].begin(), bundles[i].end(), rand_engine());
 					std::copy(bundles[i].begin(), bundles[i].end(),
 							std::back_inserter(order));
 					if (decisions.empty() == false) {
@@ -427,6 +513,93 @@ public:
 
 protected:
 
+	///
+	/// \brief Bucket of a scope, namely its variable that comes first in the
+	///	elimination order.
+	/// \param vs 		The scope
+	/// \param position 	The position of each variable in the order
+	/// \param none 		The position of the variables that are not eliminated
+	/// \return the variable, or -1 if the scope has no variable to eliminate.
+	///
+	static vindex bucket_of(const variable_set& vs,
+			const std::vector<size_t>& position, size_t none = size_t(-1)) {
+		vindex b = vindex(-1);
+		for (size_t j = 0; j < vs.size(); ++j) {
+			vindex v = vs[j].label();
+			if (position[v] < none && (b == vindex(-1) || position[v] < position[b])) {
+				b = v;
+			}
+		}
+		return b;
+	}
+
+	///
+	/// \brief Place a factor in its bucket (or with the constants at the root).
+	/// \param vs 		The scope of the factor
+	/// \param id 		The index of the factor
+	/// \param position 	The position of each variable in the order
+	/// \param vin 		The buckets
+	/// \param roots 	The constants
+	/// \param none 		The position of the variables that are not eliminated
+	///
+	static void place(const variable_set& vs, findex id,
+			const std::vector<size_t>& position, std::vector<flist>& vin,
+			flist& roots, size_t none = size_t(-1)) {
+		vindex b = bucket_of(vs, position, none);
+		if (b == vindex(-1)) roots |= id;
+		else vin[b] |= id;
+	}
+
+	///
+	/// \brief Eliminate the variable of a bucket, as in bucket elimination.
+	///
+	/// A chance variable is summed out of the product of the probabilities,
+	/// giving one probability message and one conditional expected utility
+	/// message per utility. A decision variable is maximized out of the sum of
+	/// the utilities, and each probability is conditioned on any of its values
+	/// (it does not depend on the decision).
+	///
+	/// \param tables 	The tables of the elimination (constant, multiply_into,
+	///	add_into and slice)
+	/// \param phi 		The probability tables of the bucket
+	/// \param psi 		The utility tables of the bucket
+	/// \param VX 		The variable
+	/// \param out 		The messages are appended there, in that order
+	///
+	template<typename Tables, typename Table>
+	void eliminate_bucket(const Tables& tables, const flist& phi, const flist& psi,
+			const variable& VX, std::vector<Table>& out) const {
+		if (m_vtypes[VX.label()] == 'c') {
+			Table comb = tables.constant(1.0);
+			for (flist::const_iterator i = phi.begin(); i != phi.end(); ++i) {
+				tables.multiply_into(comb, *i);
+			}
+			Table f = comb.sum(VX);
+			f.set_type(factor::FactorType::Probability);
+			out.push_back(f);
+			for (flist::const_iterator j = psi.begin(); j != psi.end(); ++j) {
+				Table g = comb;
+				tables.multiply_into(g, *j);
+				g = g.sum(VX) / f;
+				g.set_type(factor::FactorType::Utility);
+				out.push_back(g);
+			}
+		} else {
+			for (flist::const_iterator i = phi.begin(); i != phi.end(); ++i) {
+				Table f = tables.slice(*i, VX, 0); // any value
+				f.set_type(factor::FactorType::Probability);
+				out.push_back(f);
+			}
+			Table comb = tables.constant(0.0);
+			for (flist::const_iterator j = psi.begin(); j != psi.end(); ++j) {
+				tables.add_into(comb, *j);
+			}
+			Table g = comb.max(VX);
+			g.set_type(factor::FactorType::Utility);
+			out.push_back(g);
+		}
+	}
+
 	// Members:
 
 	vector<char> m_vtypes;				///< Variable types ('c' = chance, 'd' = decision)
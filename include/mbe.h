@@ -28,6 +28,8 @@
 
 #include "limid.h"
 #include "algorithm.h"
+#include "checkpoint.h"
+#include "compressed_factor.h"
 
 namespace merlin {
 
@@ -55,6 +57,18 @@ namespace merlin {
  * order. Moreover, the parents sets of each decision variable are fixed and
  * given as input. The valuation algebra doesn't assume division.
  *
+ * Checkpointing works as in BE (Checkpoint, CheckpointInterval and Resume);
+ * a checkpoint is only resumed with the same i-bound.
+ *
+ * Compress=<eps> works as in BE for IDs: the utilities are shifted to be
+ * non-negative, the large messages are packed (see packed_tables) and
+ * combined into their buckets block by block, and the log-domain error bounds
+ * of the root constants inflate the reported upper bound, so it remains an
+ * upper bound (the mini-bucket bound is not invariant to the shift, which may
+ * loosen it). Unlike BE, MBE keeps every message until the end of the run,
+ * so the packed ones stay packed: get_messages() is then empty (AOBB and IS,
+ * which use the messages as a heuristic, run MBE without compression).
+ *
  */
 class mbe : public limid, public algorithm {
 public:
@@ -65,7 +79,7 @@ public:
 	///
 	/// \brief Properties of the algorithm
 	///
-	MER_ENUM( Property , Order,iBound,Debug );
+	MER_ENUM( Property , Order,Seed,iBound,Debug,Checkpoint,CheckpointInterval,Resume,Memo,Compress );
 
 	MER_ENUM( Operator , Sum,Max,Min );
 
@@ -74,14 +88,14 @@ public:
 	///
 	/// \brief Default constructor.
 	///
-	mbe() : limid() {
+	mbe() : limid(), m_meu_error(0.0) {
 		set_properties();
 	}
 
 	///
 	/// \brief Constructor with a graphical model.
 	///
-	mbe(const limid& lm) : limid(lm), m_gmo(lm) {
+	mbe(const limid& lm) : limid(lm), m_gmo(lm), m_meu_error(0.0) {
 		clear_factors();
 		set_properties();
 	}
@@ -97,7 +111,7 @@ public:
 
 	// Can be an optimization algorithm or a summation algorithm....
 	double ub() const {
-		throw std::runtime_error("Not implemented");
+		return m_meu;
 	}
 	double lb() const {
 		throw std::runtime_error("Not implemented");
@@ -144,13 +158,74 @@ public:
 		return m_ibound;
 	}
 
+	///
+	/// \brief Set the variable elimination order.
+	///
+	void set_order(const variable_order_t& ord) {
+		m_order = ord;
+	}
+
+	///
+	/// \brief Get the variable elimination order.
+	///
+	const variable_order_t& get_order() const {
+		return m_order;
+	}
+
+	///
+	/// \brief Get the bound on the error of the upper bound due to compression.
+	///
+	double get_error_bound() const {
+		return m_meu_error;
+	}
+
+	///
+	/// \brief Get the messages generated by the forward pass of run().
+	///
+	const std::vector<factor>& get_messages() const {
+		return m_messages;
+	}
+
+	///
+	/// \brief Hand the messages over to the caller (without copying them);
+	///	get_messages() is empty afterwards.
+	///
+	void release_messages(std::vector<factor>& out) {
+		out.clear();
+		out.swap(m_messages);
+	}
+
+	///
+	/// \brief Get the bucket (variable) that generated each message.
+	///
+	const std::vector<vindex>& get_message_sources() const {
+		return m_msg_source;
+	}
+
+	///
+	/// \brief Get the bucket (variable) each message was placed in (-1 if
+	///	the message is a constant).
+	///
+	const std::vector<vindex>& get_message_targets() const {
+		return m_msg_target;
+	}
+
+	///
+	/// \brief Get the decision policy built by run(), namely for each decision
+	///	variable a factor whose argmax over the decision given the values of
+	///	the other variables in its scope is the decision rule.
+	///
+	const std::map<vindex, factor>& get_policy() const {
+		return m_policy;
+	}
+
 	///
 	/// \brief Set the properties of the algorithm.
 	/// \param opt 	The string containing comma separated property value pairs
 	///
 	virtual void set_properties(std::string opt = std::string()) {
 		if (opt.length() == 0) {
-			set_properties("Order=MinFill,iBound=2,Debug=1");
+			set_properties("Order=MinFill,Seed=0,iBound=2,Debug=1,CheckpointInterval=60,Resume=0,Memo=0,Compress=0");
 			return;
 		}
 		std::vector<std::string> strs = merlin::split(opt, ',');
@@ -161,12 +236,30 @@ public:
 				m_order.clear();
 				m_order_method = OrderMethod(asgn[1].c_str());
 				break;
+			case Property::Seed:
+				m_seed = strtoul(asgn[1].c_str(), NULL, 10);
+				break;
 			case Property::iBound:
 				set_ibound(atol(asgn[1].c_str()));
 				break;
 			case Property::Debug:
 				m_debug = (atol(asgn[1].c_str()) == 0) ? false : true;
 				break;
+			case Property::Memo:
+				m_memo = atof(asgn[1].c_str());
+				break;
+			case Property::Compress:
+				m_compress = atof(asgn[1].c_str());
+				break;
+			case Property::Checkpoint:
+				m_checkpoint = asgn.size() > 1 ? asgn[1] : std::string();
+				break;
+			case Property::CheckpointInterval:
+				m_checkpoint_interval = atof(asgn[1].c_str());
+				break;
+			case Property::Resume:
+				m_resume = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
 			default:
 				break;
 			}
@@ -212,7 +305,7 @@ public:
 		std::cout << " + i-bound          : " << m_ibound << std::endl;
 
 		if (m_order.size() == 0) { // if we need to construct an elimination ordering
-			m_order = m_gmo.order(m_order_method);
+			m_order = m_gmo.order(m_order_method, m_seed);
 		}
 
 		// Get the induced width of the order
@@ -261,7 +354,7 @@ public:
 	/// \return the mini-bucket partitioning such that each mini-bucket contains
 	/// at most i-bound distinct variables.
 	///
-	std::vector<flist> partition(const flist& ids, const std::vector<factor>& factors) {
+	std::vector<flist> partition(const flist& ids, const packed_tables& factors) {
 
 		if (m_debug) {
 			std::cout << "    Begin MB partitioning ..." << std::endl;
@@ -270,7 +363,7 @@ public:
 			std::cout << std::endl;
 			std::cout << "     initial factors: " << std::endl;
 			for (flist::const_iterator i = ids.begin(); i != ids.end(); ++i) {
-				std::cout << "      " << *i << " : " << factors[*i] << std::endl;
+				std::cout << "      " << *i << " : " << factors.get(*i) << std::endl;
 			}
 		}
 
@@ -280,7 +373,7 @@ public:
 		// Greedy partitioning
 		std::multimap<size_t, findex> scores;
 		for (flist::const_iterator i = ids.begin(); i < ids.end(); ++i) {
-			size_t key = factors[*i].nvar(); // scope size
+			size_t key = factors.vars(*i).nvar(); // scope size
 			scores.insert(std::make_pair(key, *i)); // (scope size, findex)
 		}
 
@@ -297,9 +390,9 @@ public:
 			top = scores.begin(); // smallest scope first
 
 			// Get the actual scopes in the current mini-bucket
-			variable_set vs = factors[top->second].vars();
+			variable_set vs = factors.vars(top->second);
 			for (flist::const_iterator j = par[pos].begin(); j != par[pos].end(); ++j)
-				vs |= factors[*j].vars();
+				vs |= factors.vars(*j);
 
 			// Check if new factor fits in the current mini-bucket
 			if (vs.size() <= m_ibound) {
@@ -330,6 +423,23 @@ public:
 	///
 	virtual void run() {
 
+		// Products over the shared tables are memoized for this run only
+		factor::memo memo((size_t)(m_memo * 1024 * 1024));
+		factor::memo::scope active(m_memo > 0 ? &memo : NULL);
+
+		// Load the checkpoint (it also fixes the elimination order)
+		std::ostringstream tag;
+		tag << "MBE i=" << m_ibound;
+		checkpoint ckpt;
+		std::vector<checkpoint::bucket> done;
+		bool resumed = false;
+		if (m_resume && !m_checkpoint.empty()) {
+			if (m_compress > 0) {
+				throw std::runtime_error("MBE cannot resume a checkpoint with compression.");
+			}
+			resumed = ckpt.load(m_checkpoint, tag.str(), m_gmo, m_order, done);
+		}
+
 		// Initialize the algorithm
 		init();
 
@@ -339,6 +449,20 @@ public:
 		flist roots; // constant factors
 		std::map<findex, int> ftypes; // factor types
 
+		// Compression: non-negative utilities and the error bound of each table
+		double shift = 0.0;
+		packed_tables packed(fin, m_compress);
+		std::vector<double> lerr(fin.size(), 0.0);
+		if (m_compress > 0) {
+			for (size_t i = 0; i < fin.size(); ++i) {
+				if (fin[i].get_type() == factor::FactorType::Utility && fin[i].min() < 0) {
+					double m = fin[i].min();
+					fin[i] -= m;
+					shift += m;
+				}
+			}
+		}
+
 		if (m_debug) {
 			std::cout << "Partition factors into buckets ..." << std::endl;
 		}
@@ -374,23 +498,56 @@ public:
 
 		// Forward pass: eliminate variables one at a time
 		size_t max_phi_scope = 0, max_psi_scope = 0;
+		size_t nfin = fin.size();
+		std::vector<vindex> source; // bucket that generated each message
+
+		// Replay the messages of the buckets completed before the checkpoint
+		size_t start = 0;
+		for (size_t k = 0; k < done.size(); ++k) {
+			vector<vindex>::const_iterator x = m_order.begin() + done[k].position;
+			for (size_t j = 0; j < done[k].messages.size(); ++j) {
+				const factor& f = done[k].messages[j];
+				fin.push_back(f);
+				lerr.push_back(0.0);
+				insert(vin, fid, f, x, m_order);
+				if (f.nvar() == 0) roots |= fid;
+				fid++;
+				if (f.get_type() == factor::FactorType::Probability) {
+					max_phi_scope = std::max(max_phi_scope, f.nvar());
+				} else {
+					max_psi_scope = std::max(max_psi_scope, f.nvar());
+				}
+			}
+			source.resize(fin.size() - nfin, *x);
+			start = done[k].position + 1;
+		}
+		if (resumed) {
+			std::cout << "Resumed from checkpoint " << m_checkpoint << " after "
+				<< start << " of " << m_order.size() << " buckets." << std::endl;
+		}
+		if (!m_checkpoint.empty()) {
+			ckpt.open(m_checkpoint, tag.str(), m_gmo, m_order,
+				m_checkpoint_interval, resumed);
+		}
+
 		std::cout << "Begin variable elimination ..." << std::endl;
-		for (vector<vindex>::const_iterator x = m_order.begin();
+		for (vector<vindex>::const_iterator x = m_order.begin() + start;
 				x != m_order.end(); ++x) {
 
 			// Get the corresponding variable object
 			variable VX = var(*x);
 			if (vin[*x].size() == 0)
 				continue;  // check that we have some factors over this variable
+			findex first = fid; // first message generated by this bucket
 
 			// Partition the factors into probabilities (phi's) and utilities (psi's)
 			flist ids = vin[*x];  // list of all factor IDs contained in this bucket
 			flist phi, psi;
 			for (flist::const_iterator i = ids.begin(); i != ids.end(); ++i) {
 				findex id = *i;
-				if (fin[id].get_type() == factor::FactorType::Probability) {
+				if (packed.get_type(id) == factor::FactorType::Probability) {
 					phi |= id;
-				} else if (fin[id].get_type() == factor::FactorType::Utility) {
+				} else if (packed.get_type(id) == factor::FactorType::Utility) {
 					psi |= id;
 				}
 			}
@@ -403,25 +560,27 @@ public:
 				if (m_debug) {
 					for (flist::const_iterator i = phi.begin();
 							i != phi.end(); ++i) {
-						std::cout << "    PHI: " << *i << " " << fin[*i] << std::endl;
+						std::cout << "    PHI: " << *i << " " << packed.get(*i) << std::endl;
 					}
 					for (flist::const_iterator i = psi.begin();
 							i != psi.end(); ++i) {
-						std::cout << "    PSI: " << *i << " " << fin[*i] << std::endl;
+						std::cout << "    PSI: " << *i << " " << packed.get(*i) << std::endl;
 					}
 				}
 
 				// Create mini-bucket partitioning of the probability factors only (phi)
-				std::vector<flist> mini_buckets = partition(phi, fin);
+				std::vector<flist> mini_buckets = partition(phi, packed);
 
 				// Combine the factors in each mini-bucket (used latter)
 				vector<factor> comb(mini_buckets.size());
 				vector<findex> temp(mini_buckets.size());
+				vector<double> lcomb(mini_buckets.size(), 0.0);
 				for (size_t i = 0; i < mini_buckets.size(); ++i) {
 					comb[i] = factor(1.0);
 					for (flist::const_iterator j = mini_buckets[i].begin();
 							j != mini_buckets[i].end(); ++j) {
-						comb[i] *= fin[*j];
+						packed.multiply_into(comb[i], *j);
+						lcomb[i] += lerr[*j];
 					}
 
 					// Eliminate the chance variable by summation
@@ -429,6 +588,7 @@ public:
 					factor f = elim(comb[i], VX, op);
 					temp[i] = fid; // store the id of the new factor
 					f.set_type(factor::FactorType::Probability); // probability factor
+					lerr.push_back(lcomb[i]);
 					fin.push_back(f); // store the new factor
 					insert(vin, fid, f, x, m_order); // insert the factor in a lower bucket
 					if (fin[fid].nvar() == 0) roots |= fid; // keep track of constants separately
@@ -449,17 +609,19 @@ public:
 
 					// Find the mini-bucket with which it shares the most variables
 					for (size_t l = 0; l < comb.size(); ++l) {
-						variable_set inter = fin[*j].vars() & comb[l].vars();
+						variable_set inter = packed.vars(*j) & comb[l].vars();
 						if (inter.size() > max_sz) {
 							max_sz = inter.size();
 							i = l;
 						}
 					}
 
-					factor g = comb[i] * fin[*j];
+					factor g = comb[i];
+					packed.multiply_into(g, *j);
 					g = elim(g, VX, Operator::Sum);	// eliminate by summation
 					g = g / fin[temp[i]];			// divide by
 					g.set_type(factor::FactorType::Utility); // utility factor
+					lerr.push_back(2 * lcomb[i] + lerr[*j]);
 					fin.push_back(g);				// store the new factor
 					insert(vin, fid, g, x, m_order); 	// recompute and update adjacency
 					if (fin[fid].nvar() == 0) roots |= fid; // keep track of constants separately
@@ -478,8 +640,9 @@ public:
 
 				// Process each probability factor separately
 				for (flist::const_iterator i = phi.begin(); i != phi.end(); ++i) {
-					factor f = fin[*i].slice(VX, 0); // condition on any value
+					factor f = packed.slice(*i, VX, 0); // condition on any value
 					f.set_type(factor::FactorType::Probability); // probability factor
+					lerr.push_back(lerr[*i]);
 					fin.push_back(f);				 // store the new factor
 					insert(vin, fid, f, x, m_order);  // recompute and update adjacency
 					if (fin[fid].nvar() == 0) roots |= fid; // keep track of constants separately
@@ -493,19 +656,22 @@ public:
 				}
 
 				// Create mini-bucket partitioning of the utility factors only (psi)
-				std::vector<flist> mini_buckets = partition(psi, fin);
+				std::vector<flist> mini_buckets = partition(psi, packed);
 
 				// Process the utility mini-buckets
 				for (size_t i = 0; i < mini_buckets.size(); ++i) {
 					flist mb = mini_buckets[i];
 					factor comb(0.0);
+					double lsum = 0.0;
 					for (flist::const_iterator j = mb.begin();
 							j != mb.end(); ++j) {
-						comb += fin[*j];
+						packed.add_into(comb, *j);
+						lsum = std::max(lsum, lerr[*j]);
 					}
 
 					factor g = comb.max(VX); 	// eliminate by maximization
 					g.set_type(factor::FactorType::Utility); // utility factor
+					lerr.push_back(lsum);
 					fin.push_back(g);			// store the new factor
 					insert(vin, fid, g, x, m_order); // recompute and update adjacency
 					if (fin[fid].nvar() == 0) roots |= fid; // keep track of constants separately
@@ -518,24 +684,65 @@ public:
 					max_psi_scope = std::max(max_psi_scope, g.nvar());
 				}
 			}
+
+			source.resize(fin.size() - nfin, *x); // new messages came from bucket *x
+
+			// Append the new messages to the checkpoint
+			ckpt.write(x - m_order.begin(), fin.begin() + first, fin.end());
+			for (findex i = first; i < fid; ++i) {
+				const compressed_factor* c = packed.pack(i);
+				if (c != NULL) lerr[i] += c->error();
+			}
 		} // end for
+		ckpt.close();
+
+		// Keep the messages, with their source and destination buckets
+		// (the packed ones are not exported)
+		if (m_compress > 0) {
+			m_messages.clear();
+		} else {
+			m_messages.assign(fin.begin() + nfin, fin.end());
+		}
+		m_msg_source = source;
+		m_msg_target.assign(fin.size() - nfin, vindex(-1));
+		for (vector<vindex>::const_iterator x = m_order.begin();
+				x != m_order.end(); ++x) {
+			for (flist::const_iterator i = vin[*x].begin(); i != vin[*x].end(); ++i) {
+				if (*i >= nfin) m_msg_target[*i - nfin] = *x;
+			}
+		}
 
 		// Collect all probability and utility factors (constants)
 		factor P(1.0), U(0.0);
+		double lp = 0.0, lu = 0.0;
 		for (size_t i = 0; i < roots.size(); ++i) {
 			findex id = roots[i];
 			if (fin[id].get_type() == factor::FactorType::Probability) {
 				P *= fin[id];
+				lp += lerr[id];
 			} else if (fin[id].get_type() == factor::FactorType::Utility) {
 				U += fin[id];
+				lu = std::max(lu, lerr[id]);
 			}
 		}
 		factor F = P*U;
 		m_meu = F.max();
 
+		// Undo the shift; the bound of the exact messages is at most the
+		// computed one inflated by the error bounds
+		m_meu_error = 0.0;
+		if (m_compress > 0) {
+			double b = P.max() * U.max();
+			m_meu_error = b * (std::exp(lp + lu) - 1.0);
+			m_meu = b + m_meu_error + shift;
+		}
+
 		std::cout << "End variable elimination." << std::endl;
 		std::cout << "Max phi and psi scopes: " << max_phi_scope << " and " << max_psi_scope << std::endl;
 		std::cout << "Upper Bound on MEU value is " << m_meu << "\n";
+		if (m_compress > 0) {
+			std::cout << "Upper bound error (compression) is " << m_meu_error << std::endl;
+		}
 		std::cout << "CPU time is " << (timeSystem() - m_start_time) << " seconds" << std::endl;
 
 		// Assemble the decision policy by going backward.
@@ -555,10 +762,10 @@ public:
 			factor P(1.0), U(0.0);
 			for (flist::const_iterator i = ids.begin(); i != ids.end(); ++i) {
 				findex id = *i;
-				if (fin[id].get_type() == factor::FactorType::Probability) {
-					P *= fin[id];
-				} else if (fin[id].get_type() == factor::FactorType::Utility) {
-					U += fin[id];
+				if (packed.get_type(id) == factor::FactorType::Probability) {
+					packed.multiply_into(P, id);
+				} else if (packed.get_type(id) == factor::FactorType::Utility) {
+					packed.add_into(U, id);
 				}
 			}
 
@@ -583,6 +790,7 @@ public:
 		// Get the input factors
 		std::vector<factor> fin(m_gmo.get_factors());
 		findex fid = fin.size();
+		packed_tables packed(fin, 0.0); // (nothing is packed)
 		flist roots; // constant factors
 		std::map<findex, int> ftypes; // factor types
 
@@ -650,7 +858,7 @@ public:
 				}
 
 				// Create mini-bucket partitioning of the factors in this bucket
-				std::vector<flist> mini_buckets = partition(ids, fin);
+				std::vector<flist> mini_buckets = partition(ids, packed);
 
 				// Process each mini-bucket
 				for (size_t i = 0; i < mini_buckets.size(); ++i) {
@@ -731,7 +939,7 @@ public:
 				}
 
 				// Create mini-bucket partitioning of the utility factors only
-				std::vector<flist> mini_buckets = partition(psi, fin);
+				std::vector<flist> mini_buckets = partition(psi, packed);
 
 				// Process the utility factors
 				for (size_t i = 0; i < mini_buckets.size(); ++i) {
@@ -814,8 +1022,18 @@ protected:
 	double m_meu;						///< Maximum expected utility (upper bound)
 	std::map<vindex, factor> m_policy;	///< Optimal decision policy
 	OrderMethod m_order_method;			///< Variable ordering method
+	unsigned long m_seed;				///< Seed of the ordering tie-breaks
 	variable_order_t m_order;			///< Variable order
 	bool m_debug;						///< Internal debugging flag
+	double m_memo;						///< Memory for memoized products (MB, 0 if off)
+	double m_compress;					///< Relative error of compressed messages (0 if off)
+	double m_meu_error;					///< Error of the upper bound (compression)
+	std::vector<factor> m_messages;		///< Messages generated by the forward pass
+	std::vector<vindex> m_msg_source;	///< Bucket that generated each message
+	std::vector<vindex> m_msg_target;	///< Bucket that received each message
+	std::string m_checkpoint;			///< Checkpoint file (empty if none)
+	double m_checkpoint_interval;		///< Seconds between checkpoint flushes
+	bool m_resume;						///< Resume from the checkpoint file
 
 };
 
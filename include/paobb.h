@@ -0,0 +1,552 @@
+/*
+ * paobb.h
+ *
+ *  Created on: 29 Sep 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file paobb.h
+/// \brief Parallel AND/OR Branch-and-Bound search for IDs
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_PAOBB_H_
+#define IBM_MERLIN_PAOBB_H_
+
+#include "aobb.h"
+
+namespace merlin {
+
+/**
+ * Parallel AND/OR Branch-and-Bound (PAOBB)
+ *
+ * Models supported: ID
+ *
+ * The AND/OR search space of AOBB is split at a cut depth of the pseudo tree:
+ * the part above the cut (the master tree) is explicated and its OR nodes at
+ * the cut are independent subproblems, which are solved by AOBB in parallel.
+ * The subproblems are distributed to the worker threads in the depth-first
+ * order of the master tree (heuristically best decision first), and an idle
+ * worker steals subproblems from the other end of a busy worker's queue.
+ *
+ * The cache tables of AOBB are shared by all workers (the entries are guarded
+ * by a pool of striped locks). The master tree keeps the value of each of its
+ * nodes, namely the exact value if solved and the heuristic upper bound
+ * otherwise, and is updated whenever a subproblem is solved. A subproblem is
+ * skipped if, for a decision node above it, the upper bound of its branch
+ * does not exceed the value of a solved sibling branch. The value of the root
+ * is reported as an upper bound as the search proceeds.
+ *
+ * The value of the best known policy (the global incumbent, found by the
+ * probe) is shared by all subproblems: before a subproblem is solved, the
+ * value of the root is bounded given that the decision nodes above take its
+ * branch (the other master nodes at their current values, which tighten as
+ * the other subproblems are solved). If that bound does not exceed the
+ * incumbent, the subproblem is skipped and the branch of the deepest decision
+ * node above it is cut from the master tree (if there is no such node, the
+ * incumbent is optimal). The incumbent is not passed into the AOBB search of
+ * a subproblem: tracking every path against it cost more than it pruned.
+ *
+ * If the cut depth is 0, the smallest depth yielding at least 16 subproblems
+ * per thread is used.
+ *
+ */
+class paobb : public aobb {
+public:
+	typedef aobb::findex findex;        ///< Factor index
+	typedef aobb::vindex vindex;        ///< Variable index
+	typedef aobb::flist flist;          ///< Collection of factor indices
+	typedef aobb::value_t value_t;      ///< Node value (probability, utility)
+
+	///
+	/// \brief Properties of the algorithm
+	///
+	MER_ENUM( Property , Order,Seed,iBound,Memory,TimeLimit,Threads,CutDepth,Debug );
+
+	///
+	/// \brief Node of the master tree.
+	///
+	struct master_node {
+		vindex var;						///< Variable (-1 for the dummy root)
+		size_t val;						///< Value (AND nodes)
+		bool is_and;					///< AND or OR node
+		bool solved;					///< Value is exact
+		bool cut;						///< Cannot improve on the incumbent (children of decision nodes)
+		size_t parent;					///< Parent node
+		value_t arc;					///< Arc weight (AND nodes)
+		value_t value;					///< Exact value (if solved) or upper bound
+		std::vector<size_t> children;	///< Child nodes
+	};
+
+public:
+
+	///
+	/// \brief Default constructor.
+	///
+	paobb() : aobb(), m_master_lock(new std::mutex()) {
+		set_properties();
+	}
+
+	///
+	/// \brief Constructor with a graphical model.
+	///
+	paobb(const limid& lm) : aobb(lm), m_master_lock(new std::mutex()) {
+		set_properties();
+	}
+
+	///
+	/// \brief Clone the algorithm.
+	/// \return the pointer to the new object containing the cloned algorithm.
+	///
+	virtual paobb* clone() const {
+		paobb* lm = new paobb(*this);
+		return lm;
+	}
+
+	///
+	/// \brief Set the properties of the algorithm.
+	/// \param opt 	The string containing comma separated property value pairs
+	///
+	virtual void set_properties(std::string opt = std::string()) {
+		if (opt.length() == 0) {
+			set_properties("Order=MinFill,Seed=0,iBound=2,Memory=1024,TimeLimit=0,Threads=0,CutDepth=0,Debug=0");
+			return;
+		}
+		std::vector<std::string> strs = merlin::split(opt, ',');
+		for (size_t i = 0; i < strs.size(); ++i) {
+			std::vector<std::string> asgn = merlin::split(strs[i], '=');
+			switch (Property(asgn[0].c_str())) {
+			case Property::Threads:
+				m_threads = atol(asgn[1].c_str());
+				if (m_threads == 0) m_threads = std::max(1u, std::thread::hardware_concurrency());
+				break;
+			case Property::CutDepth:
+				m_cut_depth = atol(asgn[1].c_str());
+				break;
+			default:
+				aobb::set_properties(strs[i]);
+				break;
+			}
+		}
+	}
+
+	///
+	/// \brief Run parallel AND/OR Branch-and-Bound search.
+	///
+	virtual void run() {
+
+		// Initialize the algorithm
+		init();
+		std::cout << " + threads          : " << m_threads << std::endl;
+		m_locks.reset(new std::vector<std::mutex>(1024));
+		m_tasks_pruned = 0;
+		m_incumbent_value = -std::numeric_limits<double>::infinity();
+
+		// Lower bound: expected utility of the heuristic (greedy) policy
+		std::cout << "Begin probing ..." << std::endl;
+		clear_cache();
+		m_probe = true;
+		value_t v = solve_parallel();
+		m_probe = false;
+		m_lb = v.second + m_shift * v.first;
+		m_ub += m_shift * v.first;
+		m_mass = v.first;
+		std::cout << "End probing." << std::endl;
+		std::cout << "[" << (timeSystem() - m_start_time) << "] "
+			<< m_lb << " (lower bound), " << m_ub << " (upper bound)" << std::endl;
+
+		// Parallel depth-first AND/OR search
+		std::cout << "Begin parallel AND/OR search ..." << std::endl;
+		clear_cache();
+		m_tasks_pruned = 0;
+		m_incumbent_value = v.second; // the probed policy (utilities shifted)
+		v = solve_parallel();
+		if (m_state.timeout == false) {
+			m_lb = m_ub = v.second + m_shift * v.first;
+		}
+
+		std::cout << "End parallel AND/OR search." << std::endl;
+		std::cout << "Subproblems: " << m_tasks << " at depth " << m_depth_used
+			<< " (" << m_tasks_pruned << " pruned)" << std::endl;
+		std::cout << "Nodes expanded: " << m_state.expanded << ", pruned: " << m_state.pruned << std::endl;
+		std::cout << "Cache hits: " << m_state.hits << ", misses: " << m_state.misses
+			<< ", hit rate: " << (m_state.hits + m_state.misses > 0 ?
+				(double)m_state.hits / (m_state.hits + m_state.misses) : 0.0)
+			<< ", memory: " << get_cache_memory() << " MB" << std::endl;
+		if (m_state.timeout) {
+			std::cout << "Time limit reached." << std::endl;
+			std::cout << "Lower Bound on MEU value is " << m_lb << "\n";
+			std::cout << "Upper Bound on MEU value is " << m_ub << "\n";
+		} else {
+			std::cout << "MEU value is " << m_lb << "\n";
+		}
+		std::cout << "CPU time is " << (timeSystem() - m_start_time) << " seconds" << std::endl;
+		std::cout << "Done." << std::endl << std::endl;
+	}
+
+protected:
+
+	///
+	/// \brief Name of the algorithm.
+	///
+	virtual const char* name() const {
+		return "PAOBB";
+	}
+
+	///
+	/// \brief Queue of subproblems owned by a worker.
+	///
+	struct task_queue {
+		std::mutex lock;				///< Guards the queue
+		std::deque<size_t> tasks;		///< Subproblems (master tree leaves)
+	};
+
+	///
+	/// \brief Solve the problem by distributing the subproblems to the workers.
+	///
+	value_t solve_parallel() {
+
+		// Build the master tree, deepening the cut until there is enough work
+		size_t height = m_depth.empty() ? 0 : *std::max_element(m_depth.begin(), m_depth.end());
+		size_t depth = (m_cut_depth > 0) ? m_cut_depth : 1;
+		std::vector<size_t> leaves;
+		while (true) {
+			leaves.clear();
+			build_master(depth, leaves);
+			if (m_cut_depth > 0 || depth >= height || leaves.size() >= 16 * m_threads) break;
+			++depth;
+		}
+		m_depth_used = depth;
+		m_tasks = leaves.size();
+		m_closed = false;
+
+		// Distribute the subproblems round-robin (depth-first order)
+		std::vector<task_queue> queues(m_threads);
+		for (size_t i = 0; i < leaves.size(); ++i) {
+			queues[i % m_threads].tasks.push_back(leaves[i]);
+		}
+
+		// Start the workers and wait for them to finish
+		std::vector<search_state> states(m_threads, search_state(m_gmo.nvar()));
+		std::vector<std::thread> workers;
+		for (size_t w = 0; w < m_threads; ++w) {
+			workers.push_back(std::thread(&paobb::worker, this, w,
+					std::ref(queues), std::ref(states[w])));
+		}
+		for (size_t w = 0; w < m_threads; ++w) {
+			workers[w].join();
+		}
+
+		for (size_t w = 0; w < m_threads; ++w) {
+			m_state.expanded += states[w].expanded;
+			m_state.pruned += states[w].pruned;
+			m_state.hits += states[w].hits;
+			m_state.misses += states[w].misses;
+			m_state.timeout = m_state.timeout || states[w].timeout;
+		}
+
+		// The branches cut could at best match the incumbent
+		if (m_closed || !(m_master[0].value.second >= m_incumbent_value)) {
+			return value_t(m_mass, m_incumbent_value);
+		}
+		return m_master[0].value;
+	}
+
+	///
+	/// \brief Solve subproblems until no work is left (own queue first).
+	///
+	void worker(size_t w, std::vector<task_queue>& queues, search_state& st) {
+		size_t nq = queues.size();
+		while (true) {
+			size_t t = size_t(-1);
+			for (size_t i = 0; i < nq && t == size_t(-1); ++i) {
+				task_queue& q = queues[(w + i) % nq];
+				std::lock_guard<std::mutex> guard(q.lock);
+				if (q.tasks.empty()) continue;
+				if (i == 0) { // own queue (depth-first)
+					t = q.tasks.front();
+					q.tasks.pop_front();
+				} else { // steal from the other end
+					t = q.tasks.back();
+					q.tasks.pop_back();
+				}
+			}
+			if (t == size_t(-1)) break; // no work left
+
+			if (st.timeout || dominated(t)) {
+				std::lock_guard<std::mutex> guard(*m_master_lock);
+				++m_tasks_pruned;
+				continue;
+			}
+
+			// Restore the assignment along the path from the root
+			for (size_t n = m_master[t].parent; n != 0; n = m_master[n].parent) {
+				if (m_master[n].is_and) {
+					st.assignment[m_master[n].var] = m_master[n].val;
+				}
+			}
+
+			value_t v = expand_or(m_master[t].var, st);
+			if (st.timeout) continue;
+
+			std::lock_guard<std::mutex> guard(*m_master_lock);
+			m_master[t].value = v;
+			m_master[t].solved = true;
+			for (size_t n = m_master[t].parent; ; n = m_master[n].parent) {
+				evaluate(n);
+				if (n == 0) break;
+			}
+
+			if (m_debug && m_probe == false) {
+				std::cout << "[" << (timeSystem() - m_start_time) << "] worker " << w
+					<< " solved subproblem " << t << ", "
+					<< m_master[0].value.second + m_shift * m_mass << " (upper bound)"
+					<< std::endl;
+			}
+		}
+	}
+
+	///
+	/// \brief Check if a subproblem is dominated by a solved sibling branch
+	///	of some decision node above it, or cannot improve on the incumbent.
+	///
+	bool dominated(size_t t) {
+		std::lock_guard<std::mutex> guard(*m_master_lock);
+		if (m_closed) return true;
+		for (size_t c = t, n = m_master[t].parent; c != 0; c = n, n = m_master[n].parent) {
+			const master_node& nd = m_master[n];
+			if (m_master[c].cut) return true;
+			if (nd.is_and || m_vtypes[nd.var] != 'd') continue;
+			if (m_master[c].solved == false && m_master[c].value.second <= incumbent(n)) {
+				return true;
+			}
+		}
+		if (to_root(t)(m_master[t].value).second <= m_incumbent_value) {
+			cut(t);
+			return true;
+		}
+		return false;
+	}
+
+	///
+	/// \brief Map from the value of a master tree node to the value of the
+	///	root, when the decision nodes above it take its branch (and the other
+	///	nodes keep their current values).
+	///
+	affine to_root(size_t t) const {
+		affine up;
+		for (size_t c = t, n = m_master[t].parent; c != 0; c = n, n = m_master[n].parent) {
+			const master_node& nd = m_master[n];
+			if (nd.is_and) {
+				value_t k = nd.arc;
+				for (size_t i = 0; i < nd.children.size(); ++i) {
+					if (nd.children[i] != c) k = combine(k, m_master[nd.children[i]].value);
+				}
+				up = affine(k.first, k.second) * up;
+			} else if (m_vtypes[nd.var] != 'd') {
+				value_t k(0.0, 0.0);
+				for (size_t i = 0; i < nd.children.size(); ++i) {
+					if (nd.children[i] == c) continue;
+					k.first += m_master[nd.children[i]].value.first;
+					k.second += m_master[nd.children[i]].value.second;
+				}
+				up = affine(1.0, 0.0, k.first, k.second) * up;
+			}
+		}
+		return up;
+	}
+
+	///
+	/// \brief Cut the branch of the deepest decision node above a subproblem
+	///	that cannot improve on the incumbent (if there is no such node, the
+	///	incumbent is optimal).
+	///
+	void cut(size_t t) {
+		for (size_t c = t, n = m_master[t].parent; c != 0; c = n, n = m_master[n].parent) {
+			const master_node& nd = m_master[n];
+			if (nd.is_and || m_vtypes[nd.var] != 'd') continue;
+			m_master[c].cut = true;
+			for (size_t m = n; ; m = m_master[m].parent) {
+				evaluate(m);
+				if (m == 0) break;
+			}
+			return;
+		}
+		m_closed = true;
+	}
+
+	///
+	/// \brief Value of the best solved child of a decision node.
+	///
+	double incumbent(size_t n) const {
+		double inc = -std::numeric_limits<double>::infinity();
+		const std::vector<size_t>& ch = m_master[n].children;
+		for (size_t i = 0; i < ch.size(); ++i) {
+			if (m_master[ch[i]].solved) inc = std::max(inc, m_master[ch[i]].value.second);
+		}
+		return inc;
+	}
+
+	///
+	/// \brief Recompute the value of a master tree node from its children.
+	///
+	void evaluate(size_t n) {
+		master_node& nd = m_master[n];
+		if (nd.is_and) {
+			nd.value = nd.arc;
+			nd.solved = true;
+			for (size_t i = 0; i < nd.children.size(); ++i) {
+				const master_node& ch = m_master[nd.children[i]];
+				nd.value = combine(nd.value, ch.value);
+				nd.solved = nd.solved && ch.solved;
+			}
+		} else if (m_vtypes[nd.var] == 'd') {
+			double inc = incumbent(n);
+			nd.solved = true;
+			nd.value = value_t(0.0, -std::numeric_limits<double>::infinity());
+			for (size_t i = 0; i < nd.children.size(); ++i) {
+				const master_node& ch = m_master[nd.children[i]];
+				if (ch.cut || (ch.solved == false && ch.value.second <= inc)) continue; // dominated
+				nd.solved = nd.solved && ch.solved;
+				if (ch.value.second > nd.value.second) nd.value = ch.value;
+			}
+		} else {
+			nd.value = value_t(0.0, 0.0);
+			nd.solved = true;
+			for (size_t i = 0; i < nd.children.size(); ++i) {
+				const master_node& ch = m_master[nd.children[i]];
+				nd.value.first += ch.value.first;
+				nd.value.second += ch.value.second;
+				nd.solved = nd.solved && ch.solved;
+			}
+		}
+	}
+
+	///
+	/// \brief Build the master tree down to a given depth.
+	///
+	void build_master(size_t depth, std::vector<size_t>& leaves) {
+		m_master.clear();
+		master_node root;
+		root.var = vindex(-1);
+		root.val = 0;
+		root.is_and = true;
+		root.solved = false;
+		root.cut = false;
+		root.parent = 0;
+		root.arc = m_const;
+		m_master.push_back(root);
+		search_state st(m_gmo.nvar());
+		for (size_t i = 0; i < m_roots.size(); ++i) {
+			size_t c = build_or(m_roots[i], 0, depth, st, leaves);
+			m_master[0].children.push_back(c);
+		}
+		evaluate(0);
+	}
+
+	///
+	/// \brief Build the master subtree rooted by an OR node.
+	///
+	size_t build_or(vindex x, size_t parent, size_t depth, search_state& st,
+			std::vector<size_t>& leaves) {
+
+		size_t n = m_master.size();
+		master_node o;
+		o.var = x;
+		o.val = 0;
+		o.is_and = false;
+		o.solved = false;
+		o.cut = false;
+		o.parent = parent;
+		m_master.push_back(o);
+
+		// Order the values by their heuristic (best first for decisions)
+		size_t k = var(x).states();
+		std::vector<std::pair<double, size_t> > succ(k);
+		std::vector<value_t> h(k);
+		for (size_t i = 0; i < k; ++i) {
+			st.assignment[x] = i;
+			h[i] = heuristic(x, st.assignment);
+			succ[i] = std::make_pair(m_vtypes[x] == 'd' ? -h[i].second : 0.0, i);
+		}
+		std::stable_sort(succ.begin(), succ.end());
+		if (m_vtypes[x] == 'd' && m_probe) {
+			succ.resize(1); // follow the heuristic policy only
+		}
+
+		// The subproblem below the cut is solved by a worker
+		if (m_depth[x] >= depth) {
+			m_master[n].value = value_t(0.0, (m_vtypes[x] == 'd') ?
+					-std::numeric_limits<double>::infinity() : 0.0);
+			for (size_t i = 0; i < succ.size(); ++i) {
+				const value_t& w = h[succ[i].second];
+				if (m_vtypes[x] == 'd') {
+					if (w.second > m_master[n].value.second) m_master[n].value = w;
+				} else {
+					m_master[n].value.first += w.first;
+					m_master[n].value.second += w.second;
+				}
+			}
+			leaves.push_back(n);
+			return n;
+		}
+
+		for (size_t i = 0; i < succ.size(); ++i) {
+			st.assignment[x] = succ[i].second;
+			size_t a = m_master.size();
+			master_node an;
+			an.var = x;
+			an.val = succ[i].second;
+			an.is_and = true;
+			an.solved = false;
+			an.cut = false;
+			an.parent = n;
+			an.arc = arc(x, st.assignment);
+			m_master.push_back(an);
+			m_master[n].children.push_back(a);
+			if (an.arc.first == 0.0) { // dead end
+				m_master[a].arc = value_t(0.0, 0.0);
+			} else {
+				for (size_t j = 0; j < m_children[x].size(); ++j) {
+					size_t c = build_or(m_children[x][j], a, depth, st, leaves);
+					m_master[a].children.push_back(c);
+					st.assignment[x] = succ[i].second;
+				}
+			}
+			evaluate(a);
+		}
+		evaluate(n);
+		return n;
+	}
+
+protected:
+	// Members:
+
+	size_t m_threads;					///< Number of worker threads
+	size_t m_cut_depth;					///< Depth of the subproblems (0 for automatic)
+	size_t m_depth_used;				///< Depth of the subproblems (last search)
+	size_t m_tasks;						///< Number of subproblems (last search)
+	size_t m_tasks_pruned;				///< Number of subproblems skipped (last search)
+	double m_mass;						///< Total probability mass
+	double m_incumbent_value;			///< Value of the best known policy (utilities shifted)
+	bool m_closed;						///< The incumbent is optimal (last search)
+	std::vector<master_node> m_master;	///< Master tree (above the cut)
+	std::shared_ptr<std::mutex> m_master_lock; ///< Guards the master tree
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_PAOBB_H_ */
@@ -0,0 +1,547 @@
+/*
+ * server.h
+ *
+ *  Created on: 12 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file server.h
+/// \brief Inference server over a Unix domain socket
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_SERVER_H_
+#define IBM_MERLIN_SERVER_H_
+
+#include "be.h"
+#include "mbe.h"
+#include "aobb.h"
+#include "aobf.h"
+#include "paobb.h"
+#include "wmbmeu.h"
+#include "evaluator.h"
+#include "is.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace merlin {
+
+/**
+ * Inference server
+ *
+ * Listens on a Unix domain socket and serves line based requests, one
+ * connection per thread. Each request is a line and each reply starts with
+ * "ok" or "error" (multi-line replies end with a line "end"):
+ *
+ *   load <name> <file>                parse a model and keep it resident
+ *   evidence <name> <var>=<val>,...   condition the model (empty to clear)
+ *   params <name> <properties>        default properties of the model
+ *   solve <name> <algorithm> [props]  run be, mbe, wmbmeu, aobb, aobf, paobb, is or eval
+ *   policy <name>                     policy of the last be/mbe solve
+ *   marginals <name>                  (not available for IDs)
+ *   unload <name>                     drop the model
+ *   stats                             request counters
+ *   quit | shutdown                   close the connection | stop the server
+ *
+ * Models are kept resident together with their elimination orders (one per
+ * ordering method and seed, computed on the first solve), which are reused by later
+ * solves. When the models exceed the memory cap, the least recently used
+ * ones are evicted. A model is shared read-only by the requests using it,
+ * so requests against the same model run concurrently; setting evidence
+ * replaces the model and does not affect the solves in progress.
+ *
+ * The solver output is discarded; the server logs the requests to stderr.
+ *
+ */
+class server {
+public:
+	typedef graphical_model::vindex vindex;	///< Variable index
+
+	///
+	/// \brief Resident model.
+	///
+	struct model_entry {
+		std::string path;					///< Model file
+		std::shared_ptr<const limid> original; ///< Parsed model
+		std::shared_ptr<const limid> model;	///< Model conditioned on the evidence
+		std::string evidence;				///< Evidence (var=val,...)
+		std::string params;					///< Default properties
+		std::map<std::string, variable_order_t> orders; ///< Orders by method and seed
+		std::map<vindex, factor> policy;	///< Policy of the last be/mbe solve
+		size_t bytes;						///< Estimated memory
+	};
+
+	///
+	/// \brief Counters of a request type.
+	///
+	struct counter {
+		size_t count;						///< Number of requests
+		size_t errors;						///< Number of failed requests
+		double total;						///< Total latency in seconds
+		double max;							///< Maximum latency in seconds
+
+		counter() : count(0), errors(0), total(0), max(0) {}
+	};
+
+public:
+
+	///
+	/// \brief Constructor.
+	/// \param path 	The socket path
+	/// \param memory 	The memory cap for the resident models (in MBytes)
+	///
+	server(const std::string& path, double memory) :
+		m_path(path), m_memory(memory), m_bytes(0), m_fd(-1), m_stop(false),
+		m_start_time(timeSystem()) {}
+
+	///
+	/// \brief Accept connections until a shutdown request.
+	///
+	void run() {
+		m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (m_fd < 0) {
+			throw std::runtime_error("Cannot create socket.");
+		}
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (m_path.size() >= sizeof(addr.sun_path)) {
+			throw std::runtime_error("Socket path too long: " + m_path);
+		}
+		strcpy(addr.sun_path, m_path.c_str());
+		unlink(m_path.c_str());
+		if (bind(m_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(m_fd, 64) != 0) {
+			throw std::runtime_error("Cannot listen on " + m_path);
+		}
+
+		// Discard the output of the solvers
+		null_buffer null;
+		std::streambuf* buf = std::cout.rdbuf(&null);
+		std::cerr << "Listening on " << m_path << std::endl;
+
+		std::vector<std::thread> workers;
+		while (m_stop == false) {
+			int fd = accept(m_fd, NULL, NULL);
+			if (fd < 0) break;
+			workers.push_back(std::thread(&server::serve, this, fd));
+		}
+		for (size_t i = 0; i < workers.size(); ++i) {
+			workers[i].join();
+		}
+
+		std::cout.rdbuf(buf);
+		unlink(m_path.c_str());
+		std::cerr << "Server stopped." << std::endl;
+	}
+
+protected:
+
+	///
+	/// \brief Stream buffer discarding its output (safe for concurrent writers).
+	///
+	struct null_buffer : public std::streambuf {
+		int overflow(int c) { return c; }
+		std::streamsize xsputn(const char*, std::streamsize n) { return n; }
+	};
+
+	///
+	/// \brief Serve the requests of a connection.
+	///
+	void serve(int fd) {
+		std::string pending;
+		char buf[4096];
+		bool done = false;
+		while (done == false) {
+			size_t eol = pending.find('\n');
+			if (eol == std::string::npos) {
+				ssize_t k = recv(fd, buf, sizeof(buf), 0);
+				if (k <= 0) break;
+				pending.append(buf, k);
+				continue;
+			}
+
+			std::string line = pending.substr(0, eol);
+			pending.erase(0, eol + 1);
+			if (line.empty() == false && line[line.size() - 1] == '\r') {
+				line.resize(line.size() - 1);
+			}
+			if (line.empty()) continue;
+
+			std::string reply = handle(line, done);
+			if (send_all(fd, reply) == false) break;
+		}
+		close(fd);
+	}
+
+	///
+	/// \brief Handle a request and return the reply.
+	///
+	std::string handle(const std::string& line, bool& done) {
+		double start = timeSystem();
+		std::istringstream in(line);
+		std::string cmd, name;
+		in >> cmd >> name;
+
+		std::ostringstream out;
+		bool ok = true;
+		try {
+			if (cmd == "load") {
+				std::string file;
+				in >> file;
+				load(name, file, out);
+			} else if (cmd == "evidence") {
+				std::string ev;
+				in >> ev;
+				evidence(name, ev, out);
+			} else if (cmd == "params") {
+				std::string prop;
+				in >> prop;
+				std::lock_guard<std::mutex> guard(m_lock);
+				find(name)->params = prop;
+				out << "ok\n";
+			} else if (cmd == "solve") {
+				std::string alg, prop;
+				in >> alg >> prop;
+				solve(name, alg, prop, out);
+			} else if (cmd == "policy") {
+				policy(name, out);
+			} else if (cmd == "marginals") {
+				throw std::runtime_error("marginals are not available for influence diagrams");
+			} else if (cmd == "unload") {
+				std::lock_guard<std::mutex> guard(m_lock);
+				find(name);
+				erase(name);
+				out << "ok\n";
+			} else if (cmd == "stats") {
+				stats(out);
+			} else if (cmd == "quit") {
+				done = true;
+				out << "ok\n";
+			} else if (cmd == "shutdown") {
+				done = true;
+				m_stop = true;
+				::shutdown(m_fd, SHUT_RDWR); // wake up accept()
+				out << "ok\n";
+			} else {
+				throw std::runtime_error("unknown request " + cmd);
+			}
+		} catch (std::exception& e) {
+			ok = false;
+			out.str("");
+			out << "error " << e.what() << "\n";
+		}
+
+		double latency = timeSystem() - start;
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			counter& c = m_counters[cmd.empty() ? "?" : cmd];
+			++c.count;
+			if (ok == false) ++c.errors;
+			c.total += latency;
+			c.max = std::max(c.max, latency);
+		}
+		std::cerr << "[" << (timeSystem() - m_start_time) << "] " << line
+			<< (ok ? " ok " : " error ") << latency << std::endl;
+		return out.str();
+	}
+
+	///
+	/// \brief Parse a model and make it resident.
+	///
+	void load(const std::string& name, const std::string& file, std::ostream& out) {
+		std::shared_ptr<limid> gm(new limid());
+		gm->read(file.c_str()); // outside of the lock
+
+		model_entry e;
+		e.path = file;
+		e.original = gm;
+		e.model = gm;
+		e.bytes = sizeof(limid);
+		for (size_t i = 0; i < gm->num_factors(); ++i) {
+			e.bytes += gm->get_factor(i).numel() * sizeof(double) + sizeof(factor);
+		}
+
+		std::lock_guard<std::mutex> guard(m_lock);
+		erase(name);
+		m_lru.push_front(name);
+		m_models[name] = std::make_pair(e, m_lru.begin());
+		m_bytes += e.bytes;
+		evict();
+		out << "ok " << gm->nvar() << " variables, " << gm->num_factors() << " factors\n";
+	}
+
+	///
+	/// \brief Condition a resident model on evidence (var=val,...).
+	///
+	void evidence(const std::string& name, const std::string& ev, std::ostream& out) {
+		std::shared_ptr<const limid> original;
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			original = find(name)->original;
+		}
+
+		std::shared_ptr<limid> gm(new limid(*original));
+		std::vector<std::string> obs = split(ev, ',');
+		for (size_t i = 0; i < obs.size(); ++i) {
+			std::vector<std::string> asgn = split(obs[i], '=');
+			if (asgn.size() != 2) {
+				throw std::runtime_error("evidence must be var=val,...");
+			}
+			gm->set_evidence(atol(asgn[0].c_str()), atol(asgn[1].c_str()));
+		}
+
+		std::lock_guard<std::mutex> guard(m_lock);
+		model_entry* e = find(name);
+		e->model = gm;
+		e->evidence = ev;
+		out << "ok " << obs.size() << " observed\n";
+	}
+
+	///
+	/// \brief Key of a cached order (the method and the seed of its tie-breaks).
+	///
+	static std::string order_key(const std::string& method, unsigned long seed) {
+		std::ostringstream key;
+		key << method << "/" << seed;
+		return key.str();
+	}
+
+	///
+	/// \brief Solve a resident model.
+	///
+	void solve(const std::string& name, const std::string& alg,
+			const std::string& prop, std::ostream& out) {
+
+		// Model, default properties and cached order (if any)
+		std::shared_ptr<const limid> gm;
+		std::string props;
+		std::string method = "MinFill";
+		unsigned long seed = 0;
+		variable_order_t order;
+		std::map<vindex, factor> last; // policy of the last be/mbe solve
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			model_entry* e = find(name);
+			gm = e->model;
+			last = e->policy;
+			props = e->params;
+			if (prop.empty() == false) {
+				props += (props.empty() ? "" : ",") + prop;
+			}
+			std::vector<std::string> strs = split(props, ',');
+			for (size_t i = 0; i < strs.size(); ++i) {
+				std::vector<std::string> asgn = split(strs[i], '=');
+				if (asgn.size() == 2 && asgn[0] == "Order") method = asgn[1];
+				if (asgn.size() == 2 && asgn[0] == "Seed") seed = strtoul(asgn[1].c_str(), NULL, 10);
+			}
+			std::map<std::string, variable_order_t>::iterator it = e->orders.find(order_key(method, seed));
+			if (it != e->orders.end()) order = it->second;
+		}
+
+		bool cached = (order.empty() == false);
+		if (cached == false) {
+			order = gm->order(graphical_model::OrderMethod(method.c_str()), seed);
+		}
+
+		double start = timeSystem();
+		double lb, ub;
+		std::map<vindex, factor> pol;
+		if (alg == "be") {
+			be s(*gm);
+			run_solver(s, props, order);
+			lb = ub = s.ub();
+			pol = s.get_policy();
+		} else if (alg == "mbe") {
+			mbe s(*gm);
+			run_solver(s, props, order);
+			lb = std::numeric_limits<double>::quiet_NaN();
+			ub = s.ub();
+			pol = s.get_policy();
+		} else if (alg == "wmbmeu") {
+			wmbmeu s(*gm);
+			run_solver(s, props, order);
+			lb = s.lb(); ub = s.ub();
+			pol = s.get_policy();
+		} else if (alg == "aobb") {
+			aobb s(*gm);
+			run_solver(s, props, order);
+			lb = s.lb(); ub = s.ub();
+		} else if (alg == "aobf") {
+			aobf s(*gm);
+			run_solver(s, props, order);
+			lb = s.lb(); ub = s.ub();
+		} else if (alg == "paobb") {
+			paobb s(*gm);
+			run_solver(s, props, order);
+			lb = s.lb(); ub = s.ub();
+		} else if (alg == "is") {
+			is s(*gm);
+			run_solver(s, props, order);
+			lb = s.lb(); ub = s.ub();
+		} else if (alg == "eval") { // the last policy (or MBE's)
+			evaluator s(*gm);
+			s.set_policy(last);
+			run_solver(s, props, order);
+			lb = s.lb();
+			ub = last.empty() ? s.ub() : std::numeric_limits<double>::quiet_NaN();
+		} else {
+			throw std::runtime_error("unknown algorithm " + alg);
+		}
+		double elapsed = timeSystem() - start;
+
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			std::map<std::string, std::pair<model_entry, lru_t::iterator> >::iterator it =
+				m_models.find(name);
+			if (it != m_models.end()) { // unless evicted meanwhile
+				it->second.first.orders[order_key(method, seed)] = order;
+				if (pol.empty() == false) it->second.first.policy = pol;
+			}
+		}
+
+		out.precision(12);
+		out << "ok " << lb << " " << ub << " " << elapsed
+			<< (cached ? " cached-order" : "") << "\n";
+	}
+
+	///
+	/// \brief Run a solver with the given properties and order.
+	///
+	template<class T>
+	void run_solver(T& s, const std::string& props, const variable_order_t& order) {
+		if (props.empty() == false) {
+			s.set_properties(props);
+		}
+		s.set_order(order);
+		s.run();
+	}
+
+	///
+	/// \brief Reply the policy of the last be/mbe solve.
+	///
+	void policy(const std::string& name, std::ostream& out) {
+		std::map<vindex, factor> pol;
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			pol = find(name)->policy;
+		}
+		if (pol.empty()) {
+			throw std::runtime_error("no policy (solve with be or mbe first)");
+		}
+		out << "ok " << pol.size() << " decisions\n";
+		for (std::map<vindex, factor>::const_iterator i = pol.begin(); i != pol.end(); ++i) {
+			out << i->first << " " << i->second << "\n";
+		}
+		out << "end\n";
+	}
+
+	///
+	/// \brief Reply the request counters.
+	///
+	void stats(std::ostream& out) {
+		std::lock_guard<std::mutex> guard(m_lock);
+		double uptime = timeSystem() - m_start_time;
+		size_t total = 0;
+		for (std::map<std::string, counter>::const_iterator i = m_counters.begin();
+				i != m_counters.end(); ++i) {
+			total += i->second.count;
+		}
+		out << "ok uptime " << uptime << " requests " << total << " throughput "
+			<< (uptime > 0 ? total / uptime : 0.0) << " models " << m_models.size()
+			<< " memory " << m_bytes / (1024.0 * 1024.0) << "\n";
+		for (std::map<std::string, counter>::const_iterator i = m_counters.begin();
+				i != m_counters.end(); ++i) {
+			const counter& c = i->second;
+			out << i->first << " count " << c.count << " errors " << c.errors
+				<< " mean " << (c.count ? c.total / c.count : 0.0)
+				<< " max " << c.max << "\n";
+		}
+		out << "end\n";
+	}
+
+	///
+	/// \brief Find a resident model and mark it as recently used (locked).
+	///
+	model_entry* find(const std::string& name) {
+		std::map<std::string, std::pair<model_entry, lru_t::iterator> >::iterator it =
+			m_models.find(name);
+		if (it == m_models.end()) {
+			throw std::runtime_error("unknown model " + name);
+		}
+		m_lru.splice(m_lru.begin(), m_lru, it->second.second);
+		return &it->second.first;
+	}
+
+	///
+	/// \brief Drop a resident model (locked).
+	///
+	void erase(const std::string& name) {
+		std::map<std::string, std::pair<model_entry, lru_t::iterator> >::iterator it =
+			m_models.find(name);
+		if (it == m_models.end()) return;
+		m_bytes -= it->second.first.bytes;
+		m_lru.erase(it->second.second);
+		m_models.erase(it);
+		factor::pool::instance().prune(); // drop the entries of the released tables
+	}
+
+	///
+	/// \brief Evict the least recently used models over the memory cap (locked).
+	///
+	void evict() {
+		double cap = m_memory * 1024.0 * 1024.0;
+		while (m_memory > 0 && m_bytes > cap && m_lru.size() > 1) {
+			std::string name = m_lru.back();
+			std::cerr << "Evicting model " << name << std::endl;
+			erase(name);
+		}
+	}
+
+	///
+	/// \brief Send a reply.
+	///
+	static bool send_all(int fd, const std::string& str) {
+		size_t sent = 0;
+		while (sent < str.size()) {
+			ssize_t k = send(fd, str.c_str() + sent, str.size() - sent, MSG_NOSIGNAL);
+			if (k <= 0) return false;
+			sent += k;
+		}
+		return true;
+	}
+
+protected:
+	// Members:
+
+	typedef std::list<std::string> lru_t;
+
+	std::string m_path;					///< Socket path
+	double m_memory;					///< Memory cap in MBytes (0 for none)
+	size_t m_bytes;						///< Memory of the resident models
+	int m_fd;							///< Listening socket
+	std::atomic<bool> m_stop;			///< Shutdown requested
+	double m_start_time;				///< Start time
+	std::mutex m_lock;					///< Guards the models and counters
+	lru_t m_lru;						///< Models, most recently used first
+	std::map<std::string, std::pair<model_entry, lru_t::iterator> > m_models; ///< Resident models
+	std::map<std::string, counter> m_counters; ///< Counters by request type
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_SERVER_H_ */
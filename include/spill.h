@@ -0,0 +1,410 @@
+/*
+ * spill.h
+ *
+ *  Created on: 14 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file spill.h
+/// \brief Out-of-core storage of large factor tables
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_SPILL_H_
+#define IBM_MERLIN_SPILL_H_
+
+#include <cstdlib>
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace merlin {
+
+/**
+ * Spill area for large tables
+ *
+ * When enabled (a scratch directory and a size threshold), every table of at
+ * least the threshold is placed in a memory-mapped file in the scratch
+ * directory instead of the heap. The file is unlinked as soon as it is
+ * mapped, so its blocks are returned to the file system when the table is
+ * released (and nothing is left behind if the process is killed). The pages
+ * are written back to the file by the kernel under memory pressure, which
+ * lets the tables grow beyond the physical memory; the factor kernels visit
+ * the largest table of each operation (the result of a product, the source
+ * of a marginal) in index order, so these tables are streamed through memory
+ * rather than accessed at random.
+ *
+ * The policy belongs to a run: it is set on the calling thread by a scope
+ * (see spill::scope) and restored when the scope ends, also when the run
+ * throws, so concurrent runs (eg the solves of the server) do not see each
+ * other's setting. The tables allocated under a scope keep their storage
+ * after it ends, and each scope counts the bytes of its own spilled tables.
+ */
+class spill {
+public:
+	///
+	/// \brief Bytes held in spill files by the tables of a scope.
+	///
+	struct usage {
+		std::atomic<size_t> bytes;					///< Bytes in spill files
+		std::atomic<size_t> peak;					///< Peak bytes in spill files
+		usage() : bytes(0), peak(0) {};
+	};
+
+	///
+	/// \brief Spill policy of the calling thread for the lifetime of the
+	///	scope: the tables of at least \p threshold bytes go to \p dir (an
+	///	empty directory name disables spilling).
+	///
+	class scope {
+	public:
+		scope(const std::string& dir, size_t threshold) :
+				m_usage(new usage()), m_prev(active_ref()) {
+			m_dir = dir;
+			m_threshold = dir.empty() ? std::numeric_limits<size_t>::max() : threshold;
+			active_ref() = this;
+		}
+		~scope() {
+			active_ref() = m_prev;
+		}
+
+		///
+		/// \brief Get the number of bytes currently held in spill files.
+		///
+		size_t bytes() const {
+			return m_usage->bytes;
+		}
+
+		///
+		/// \brief Get the peak number of bytes held in spill files.
+		///
+		size_t peak_bytes() const {
+			return m_usage->peak;
+		}
+
+	private:
+		friend class spill;
+		scope(const scope&);
+		scope& operator=(const scope&);
+		std::string m_dir;						///< Scratch directory
+		size_t m_threshold;						///< Tables from this size up are spilled
+		std::shared_ptr<usage> m_usage;			///< Bytes of the spilled tables
+		scope* m_prev;							///< Scope active before
+	};
+
+	///
+	/// \brief Get the number of bytes held in spill files (all scopes).
+	///
+	static size_t bytes() {
+		return state().bytes;
+	}
+
+	///
+	/// \brief Allocate \p n bytes, in a spill file if they reach the
+	///	threshold of the active scope of the calling thread.
+	/// \return the memory, or NULL if it must come from the heap.
+	///
+	static void* allocate(size_t n) {
+		scope* sc = active_ref();
+		if (sc == NULL || n < sc->m_threshold) {
+			return NULL;
+		}
+
+		std::string path = sc->m_dir + "/merlin-XXXXXX";
+		int fd = mkstemp(&path[0]);
+		if (fd < 0) {
+			throw std::runtime_error("Cannot create a spill file in " + sc->m_dir);
+		}
+		unlink(path.c_str());
+		if (ftruncate(fd, n) != 0) {
+			close(fd);
+			throw std::runtime_error("Cannot extend the spill file in " + sc->m_dir);
+		}
+		void* p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED) {
+			throw std::runtime_error("Cannot map the spill file in " + sc->m_dir);
+		}
+		madvise(p, n, MADV_SEQUENTIAL);
+
+		usage& u = *sc->m_usage;
+		u.bytes += n;
+		u.peak = std::max(u.peak.load(), u.bytes.load());
+		std::lock_guard<std::mutex> lock(state().mutex);
+		state().mapped[p] = sc->m_usage;
+		state().bytes += n;
+		if (n < state().smallest) state().smallest = n;
+		return p;
+	}
+
+	///
+	/// \brief Release \p n bytes at \p p if they live in a spill file.
+	/// \return true if the memory was spilled (and is now released).
+	///
+	static bool deallocate(void* p, size_t n) {
+		if (n < state().smallest) {
+			return false;	// smaller than any table ever spilled
+		}
+
+		std::shared_ptr<usage> u;
+		{
+			std::lock_guard<std::mutex> lock(state().mutex);
+			std::map<void*, std::shared_ptr<usage> >::iterator it = state().mapped.find(p);
+			if (it == state().mapped.end()) {
+				return false;
+			}
+			u = it->second;
+			state().mapped.erase(it);
+			state().bytes -= n;
+		}
+		munmap(p, n);
+		u->bytes -= n;
+		return true;
+	}
+
+private:
+	struct spill_state {
+		std::mutex mutex;
+		std::atomic<size_t> smallest;				///< Smallest table ever spilled
+		std::atomic<size_t> bytes;					///< Bytes in spill files
+		std::map<void*, std::shared_ptr<usage> > mapped;	///< Live spilled tables (and their scope's usage)
+		spill_state() : smallest(std::numeric_limits<size_t>::max()), bytes(0) {};
+	};
+
+	static spill_state& state() {
+		static spill_state s;
+		return s;
+	}
+
+	static scope*& active_ref() {
+		static thread_local scope* s = NULL;
+		return s;
+	}
+};
+
+/**
+ * Memory policy for large tables
+ *
+ * When enabled (a size threshold), every table of at least the threshold that
+ * is not spilled is mapped straight from the kernel instead of the heap. The
+ * mapping is aligned to 2 MB and advised as transparent huge pages, so that
+ * the kernels streaming through a table of many MB take a TLB miss per 2 MB
+ * rather than per 4 KB page.
+ *
+ * A NUMA policy can be set on these mappings:
+ *   - local: each page goes to the node of the thread that first writes it;
+ *   - interleave: the pages are spread over all the allowed nodes, for
+ *     tables read by workers on every socket.
+ * Nothing is written at allocation time: the pages are placed when the table
+ * is first filled, ie by the thread that computes it, so with the local
+ * policy (also the default policy of Linux) a worker gets its own tables on
+ * its own node. The policy is applied with mbind where the system has it, and
+ * a failure (eg a single node, or a container without the permission) leaves
+ * the default placement.
+ *
+ * The setting is process-wide, and the tables already allocated keep their
+ * storage when it changes.
+ */
+class table_memory {
+public:
+	///
+	/// \brief NUMA placement of the mapped tables.
+	///
+	enum numa_policy {
+		numa_default,			///< Policy of the process (usually first touch)
+		numa_local,				///< Node of the thread that first writes a page
+		numa_interleave			///< Pages spread over the allowed nodes
+	};
+
+	static const size_t huge_page = (size_t)2 << 20;	///< Alignment of the mappings
+
+	///
+	/// \brief Map the tables of at least \p threshold bytes with huge pages
+	/// and the NUMA policy \p numa (a threshold of 0 disables it).
+	///
+	static void configure(size_t threshold, numa_policy numa = numa_default) {
+		std::lock_guard<std::mutex> lock(state().mutex);
+		state().threshold = (threshold == 0) ? std::numeric_limits<size_t>::max() : threshold;
+		state().numa = numa;
+	}
+
+	///
+	/// \brief Parse a NUMA policy name (none, local or interleave).
+	///
+	static numa_policy parse_numa(const std::string& name) {
+		if (name == "none") return numa_default;
+		if (name == "local") return numa_local;
+		if (name == "interleave") return numa_interleave;
+		throw std::runtime_error("Unknown NUMA policy: " + name);
+	}
+
+	///
+	/// \brief Get the number of bytes currently held in mapped tables.
+	///
+	static size_t bytes() {
+		return state().bytes;
+	}
+
+	///
+	/// \brief Allocate \p n bytes, in a mapping of their own if they reach
+	/// the threshold.
+	/// \return the memory, or NULL if it must come from the heap.
+	///
+	static void* allocate(size_t n) {
+		if (n < state().threshold) {
+			return NULL;
+		}
+
+		// Over-allocate, then trim the mapping to a 2 MB aligned range
+		size_t len = mapped_size(n);
+		void* p = mmap(NULL, len + huge_page, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			return NULL; // the heap may still have room
+		}
+		char* first = (char*)p;
+		char* aligned = (char*)(((uintptr_t)first + huge_page - 1) & ~(uintptr_t)(huge_page - 1));
+		if (aligned > first) {
+			munmap(first, aligned - first);
+		}
+		if (aligned + len < first + len + huge_page) {
+			munmap(aligned + len, first + len + huge_page - (aligned + len));
+		}
+#ifdef MADV_HUGEPAGE
+		madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+		bind(aligned, len);
+
+		std::lock_guard<std::mutex> lock(state().mutex);
+		state().mapped.insert(aligned);
+		state().bytes += len;
+		if (n < state().smallest) state().smallest = n;
+		return aligned;
+	}
+
+	///
+	/// \brief Release \p n bytes at \p p if they live in a mapping of their own.
+	/// \return true if the memory was mapped (and is now released).
+	///
+	static bool deallocate(void* p, size_t n) {
+		if (n < state().smallest) {
+			return false;	// smaller than any table ever mapped
+		}
+
+		std::lock_guard<std::mutex> lock(state().mutex);
+		if (state().mapped.erase(p) == 0) {
+			return false;
+		}
+		munmap(p, mapped_size(n));
+		state().bytes -= mapped_size(n);
+		return true;
+	}
+
+private:
+	struct memory_state {
+		std::mutex mutex;
+		std::atomic<size_t> threshold;				///< Tables from this size up are mapped
+		std::atomic<size_t> smallest;				///< Smallest table ever mapped
+		std::atomic<size_t> bytes;					///< Bytes in mapped tables
+		numa_policy numa;							///< NUMA policy of the mappings
+		std::set<void*> mapped;						///< Live mapped tables
+		memory_state() : threshold(std::numeric_limits<size_t>::max()),
+				smallest(std::numeric_limits<size_t>::max()), bytes(0),
+				numa(numa_default) {};
+	};
+
+	static memory_state& state() {
+		static memory_state s;
+		return s;
+	}
+
+	static size_t mapped_size(size_t n) {
+		return (n + huge_page - 1) & ~(huge_page - 1);
+	}
+
+	///
+	/// \brief Set the NUMA policy of a mapping (before its pages are touched).
+	///
+	static void bind(void* p, size_t len) {
+#if defined(SYS_mbind) && defined(SYS_get_mempolicy)
+		const int mpol_interleave = 3, mpol_local = 4;		// see numaif.h
+		const unsigned long mpol_f_mems_allowed = 1 << 2;
+		const unsigned long max_node = 1024;
+		switch (state().numa) {
+		case numa_local:
+			syscall(SYS_mbind, p, len, mpol_local, NULL, 0, 0);
+			break;
+		case numa_interleave: {
+			unsigned long nodes[max_node / (8 * sizeof(unsigned long))] = { 0 };
+			if (syscall(SYS_get_mempolicy, NULL, nodes, max_node, NULL,
+					mpol_f_mems_allowed) == 0) {
+				syscall(SYS_mbind, p, len, mpol_interleave, nodes, max_node, 0);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+#endif
+	}
+};
+
+///
+/// \brief Allocator of factor tables (spills the large ones, see spill, and
+/// maps those of the table_memory policy).
+///
+template<typename T>
+class spill_allocator {
+public:
+	typedef T value_type;
+
+	spill_allocator() {};
+	template<typename U> spill_allocator(const spill_allocator<U>&) {};
+
+	T* allocate(size_t n) {
+		void* p = spill::allocate(n * sizeof(T));
+		if (p == NULL) p = table_memory::allocate(n * sizeof(T));
+		return (p != NULL) ? static_cast<T*>(p) : std::allocator<T>().allocate(n);
+	}
+
+	void deallocate(T* p, size_t n) {
+		if (!spill::deallocate(p, n * sizeof(T)) &&
+				!table_memory::deallocate(p, n * sizeof(T))) {
+			std::allocator<T>().deallocate(p, n);
+		}
+	}
+
+	template<typename U> bool operator==(const spill_allocator<U>&) const {
+		return true;
+	}
+	template<typename U> bool operator!=(const spill_allocator<U>&) const {
+		return false;
+	}
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_SPILL_H_ */
@@ -0,0 +1,337 @@
+/*
+ * table_pool.h
+ *
+ *  Created on: 21 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file table_pool.h
+/// \brief Pool of shared (hash-consed) factor tables and memoized operations
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_TABLE_POOL_H_
+#define IBM_MERLIN_TABLE_POOL_H_
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstring>
+#include <stdint.h>
+
+namespace merlin {
+
+/**
+ * Table pool
+ *
+ * The pool keeps track of one copy of each distinct table it is given
+ * (intern): a table whose values are equal to a pooled one is replaced by a
+ * shared reference to it, and pooled tables are marked (see cow_vector::mark),
+ * so they are never modified.
+ *
+ * The pool only holds weak references: a pooled table lives as long as some
+ * factor uses it, and its entry is dropped by the next lookup that finds it
+ * expired (or by prune). There is one pool per table type (instance), shared
+ * by all threads; it is split into shards with a lock each, and the content
+ * hash that selects the shard is computed before taking any lock.
+ */
+template<typename Storage>
+class table_pool {
+public:
+	typedef Storage storage;						///< Type of the tables
+	typedef typename storage::value_type value;		///< Type of the values
+	typedef typename storage::weak_type weak;		///< Weak reference to a table
+
+	///
+	/// \brief The pool of tables.
+	///
+	static table_pool& instance() {
+		static table_pool p;
+		return p;
+	}
+
+	///
+	/// \brief Share a table with an equal pooled one (or add it to the pool).
+	/// \return true if the table is now shared with an equal pooled table.
+	///
+	bool intern(storage& t) {
+		if (t.empty()) return false;
+		const storage& ct = t;
+		uint64_t h = content_hash(ct);
+		shard& s = m_shards[h % num_shards];
+
+		// Live candidates with the same hash (compared outside the lock)
+		std::vector<storage> same;
+		{
+			std::lock_guard<std::mutex> lock(s.mutex);
+			typename std::unordered_map<uint64_t, std::vector<weak> >::iterator
+				it = s.tables.find(h);
+			if (it != s.tables.end()) {
+				std::vector<weak>& ws = it->second;
+				size_t k = 0;
+				for (size_t i = 0; i < ws.size(); ++i) {
+					storage c = storage::lock(ws[i]);
+					if (c.empty()) continue; // expired
+					ws[k++] = ws[i];
+					same.push_back(c);
+				}
+				ws.resize(k);
+			}
+		}
+		for (size_t i = 0; i < same.size(); ++i) {
+			const storage& c = same[i];
+			if (c.id() == ct.id()) {
+				t.mark();
+				return false;
+			}
+			if (c.size() == ct.size() &&
+					memcmp(c.data(), ct.data(), ct.size() * sizeof(value)) == 0) {
+				t = c; // share the pooled table
+				t.mark();
+				return true;
+			}
+		}
+
+		// Two threads adding equal tables at once may both add them: they
+		// are then not shared, which is harmless
+		t.mark();
+		std::lock_guard<std::mutex> lock(s.mutex);
+		s.tables[h].push_back(t.weak());
+		return false;
+	}
+
+	///
+	/// \brief Drop the entries of the tables that are no longer used.
+	///
+	void prune() {
+		for (size_t j = 0; j < num_shards; ++j) {
+			shard& s = m_shards[j];
+			std::lock_guard<std::mutex> lock(s.mutex);
+			typename std::unordered_map<uint64_t, std::vector<weak> >::iterator it;
+			for (it = s.tables.begin(); it != s.tables.end(); ) {
+				std::vector<weak>& ws = it->second;
+				size_t k = 0;
+				for (size_t i = 0; i < ws.size(); ++i) {
+					if (ws[i].expired() == false) ws[k++] = ws[i];
+				}
+				ws.resize(k);
+				if (k == 0) it = s.tables.erase(it);
+				else ++it;
+			}
+		}
+	}
+
+	///
+	/// \brief Forget all tables (they stay shared by the factors using them).
+	///
+	void clear() {
+		for (size_t j = 0; j < num_shards; ++j) {
+			std::lock_guard<std::mutex> lock(m_shards[j].mutex);
+			m_shards[j].tables.clear();
+		}
+	}
+
+	///
+	/// \brief Content hash of a table (FNV-1a over the bits of the values).
+	///
+	static uint64_t content_hash(const storage& t) {
+		uint64_t h = 14695981039346656037ULL;
+		const value* x = t.data();
+		for (size_t i = 0; i < t.size(); ++i) {
+			uint64_t bits = 0;
+			memcpy(&bits, &x[i], std::min(sizeof(bits), sizeof(value)));
+			h = (h ^ bits) * 1099511628211ULL;
+		}
+		return h ^ t.size();
+	}
+
+protected:
+	static const size_t num_shards = 16;				///< Number of shards
+
+	struct shard {
+		std::mutex mutex;													///< Lock of the shard
+		std::unordered_map<uint64_t, std::vector<weak> > tables;			///< Pooled tables by content hash
+	};
+
+	table_pool() {};
+
+	// Members:
+
+	shard m_shards[num_shards];					///< Shards (by content hash)
+};
+
+/**
+ * Memoized operations over pooled tables
+ *
+ * Since a pooled table is never modified, the result of an operation on
+ * pooled tables depends only on their identities and on the shape of the
+ * operation (how the scopes line up and the domain sizes), not on the
+ * variables themselves. A memo remembers such results (find/insert) and
+ * interns them in turn, so a chain of products over repeated tables (eg the
+ * same CPT in every time slice) is computed once.
+ *
+ * A memo belongs to one run of a solver: the solver creates it and makes it
+ * the active memo of its thread for the duration of the run (scope), and the
+ * factor operations of that thread use it. The results it holds are bounded
+ * by a capacity in bytes, beyond which the least recently used ones are
+ * evicted; everything is released with the memo.
+ */
+template<typename Storage>
+class table_memo {
+public:
+	typedef Storage storage;						///< Type of the tables
+	typedef typename storage::value_type value;		///< Type of the values
+
+	///
+	/// \brief Key of a memoized operation.
+	///
+	struct key {
+		int op;							///< Operation (set by the caller)
+		const void* a;					///< Identity of the first table
+		const void* b;					///< Identity of the second table (or null)
+		std::vector<size_t> shape;		///< Shape of the operation
+
+		key() : op(0), a(NULL), b(NULL) {};
+		bool operator==(const key& k) const {
+			return op == k.op && a == k.a && b == k.b && shape == k.shape;
+		}
+	};
+
+	///
+	/// \brief Make a memo the active one of the calling thread (RAII).
+	///
+	class scope {
+	public:
+		explicit scope(table_memo* m) : m_prev(active_ref()) {
+			active_ref() = m;
+		}
+		~scope() {
+			active_ref() = m_prev;
+		}
+	private:
+		scope(const scope&);
+		scope& operator=(const scope&);
+		table_memo* m_prev;				///< Memo active before
+	};
+
+	///
+	/// \brief Constructor.
+	/// \param capacity 	The largest number of bytes held by the results
+	///
+	explicit table_memo(size_t capacity) :
+		m_capacity(capacity), m_bytes(0), m_hits(0), m_misses(0) {};
+
+	///
+	/// \brief The active memo of the calling thread (or NULL).
+	///
+	static table_memo* active() {
+		return active_ref();
+	}
+
+	///
+	/// \brief Look up the result of an operation.
+	/// \return true and the pooled result if the operation is memoized.
+	///
+	bool find(const key& k, storage& out) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		typename map_t::iterator it = m_memo.find(k);
+		if (it == m_memo.end()) {
+			++m_misses;
+			return false;
+		}
+		++m_hits;
+		m_lru.splice(m_lru.begin(), m_lru, it->second.pos);
+		out = it->second.result;
+		return true;
+	}
+
+	///
+	/// \brief Memoize the result of an operation (and intern it).
+	/// \param k 	The key of the operation
+	/// \param a 	The first operand (kept alive while the key is used)
+	/// \param b 	The second operand (or an empty table)
+	/// \param out 	The result, which is replaced by its pooled copy
+	///
+	void insert(const key& k, const storage& a, const storage& b, storage& out) {
+		size_t bytes = out.size() * sizeof(value);
+		if (bytes > m_capacity) return;
+		table_pool<storage>::instance().intern(out); // (not locked here)
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_memo.count(k) > 0) return;
+		while (m_bytes + bytes > m_capacity && m_lru.empty() == false) {
+			typename map_t::iterator old = m_memo.find(m_lru.back());
+			m_bytes -= old->second.bytes;
+			m_memo.erase(old);
+			m_lru.pop_back();
+		}
+		m_lru.push_front(k);
+		entry& e = m_memo[k];
+		e.a = a;
+		e.b = b;
+		e.result = out;
+		e.bytes = bytes;
+		e.pos = m_lru.begin();
+		m_bytes += bytes;
+	}
+
+	size_t hits() const { return m_hits; }
+	size_t misses() const { return m_misses; }
+	size_t bytes() const { return m_bytes; }
+
+protected:
+
+	struct key_hash {
+		size_t operator()(const key& k) const {
+			size_t h = (size_t)k.op * 0x9e3779b97f4a7c15ULL;
+			h ^= std::hash<const void*>()(k.a) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			h ^= std::hash<const void*>()(k.b) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			for (size_t i = 0; i < k.shape.size(); ++i) {
+				h ^= k.shape[i] + 0x9e3779b9 + (h << 6) + (h >> 2);
+			}
+			return h;
+		}
+	};
+
+	struct entry {
+		storage a, b;					///< Operands (keep their identities valid)
+		storage result;					///< Pooled result
+		size_t bytes;					///< Size of the result
+		typename std::list<key>::iterator pos;	///< Place in the LRU list
+		entry() : bytes(0) {};
+	};
+
+	typedef std::unordered_map<key, entry, key_hash> map_t;
+
+	static table_memo*& active_ref() {
+		static thread_local table_memo* m = NULL;
+		return m;
+	}
+
+	// Members:
+
+	std::mutex m_lock;								///< Lock (a memo may be shared by threads)
+	map_t m_memo;									///< Memoized results
+	std::list<key> m_lru;							///< Keys of the results, most recently used first
+	size_t m_capacity;								///< Largest number of bytes of results
+	size_t m_bytes;									///< Bytes held by results
+	size_t m_hits;									///< Number of memoized results found
+	size_t m_misses;								///< Number of lookups that failed
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_TABLE_POOL_H_ */
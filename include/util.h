@@ -35,6 +35,7 @@
 #include<cstdlib>
 #include<stdint.h>
 #include<limits>
+#include<atomic>
 
 #include<string>
 #include<sstream>
@@ -129,22 +130,146 @@ inline std::vector<std::string> split(const std::string &s, char delim) {
 //
 // Random number classes
 //
-inline void rand_seed() { srand(time(0)); }
-inline void rand_seed(size_t s) { srand(s); }
+
+///
+/// \brief Pseudo-random number generator (xoshiro256**).
+///
+/// The state is seeded by splitmix64 from a seed and a stream number, thus
+/// parallel workers (or tasks) draw from independent streams derived from a
+/// single seed, and the sequence of each stream is identical on all platforms.
+/// Satisfies the UniformRandomBitGenerator requirements (eg, std::shuffle).
+///
+class rng {
+public:
+	typedef uint64_t result_type;
+
+	explicit rng(uint64_t seed = 0, uint64_t stream = 0) {
+		this->seed(seed, stream);
+	}
+
+	///
+	/// \brief Reset the state to the beginning of a stream.
+	///
+	void seed(uint64_t seed, uint64_t stream = 0) {
+		uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ULL);
+		for (int i = 0; i < 4; ++i) {
+			x += 0x9E3779B97F4A7C15ULL; // splitmix64
+			uint64_t z = x;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			m_s[i] = z ^ (z >> 31);
+		}
+	}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~(result_type)0; }
+
+	///
+	/// \brief Next 64 random bits.
+	///
+	result_type operator()() {
+		uint64_t r = rotl(m_s[1] * 5, 7) * 9;
+		uint64_t t = m_s[1] << 17;
+		m_s[2] ^= m_s[0]; m_s[3] ^= m_s[1];
+		m_s[1] ^= m_s[2]; m_s[0] ^= m_s[3];
+		m_s[2] ^= t;
+		m_s[3] = rotl(m_s[3], 45);
+		return r;
+	}
+
+	///
+	/// \brief Uniform double in [0,1) (53 random bits).
+	///
+	double uniform() {
+		return ((*this)() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	///
+	/// \brief Uniform integer in 0..n-1.
+	///
+	size_t below(size_t n) {
+		return (size_t)(((unsigned __int128)(*this)() * n) >> 64);
+	}
+
+private:
+	static uint64_t rotl(uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+	uint64_t m_s[4];
+};
+
+///
+/// \brief Seed of the process, from which the stream of each thread is derived.
+///
+inline std::atomic<uint64_t>& rand_process_seed() {
+	static std::atomic<uint64_t> seed(0);
+	return seed;
+}
+
+///
+/// \brief Index of the calling thread (in the order of their first draw).
+///
+inline uint64_t rand_thread_index() {
+	static std::atomic<uint64_t> next(0);
+	static thread_local uint64_t index = next++;
+	return index;
+}
+
+///
+/// \brief Generator of the calling thread, used by the functions below.
+///
+/// Each thread draws from the stream rng(process seed, thread index), unless
+/// a rand_stream scope gives it the stream of a task.
+///
+inline rng& rand_engine() {
+	static thread_local rng engine(rand_process_seed(), rand_thread_index());
+	return engine;
+}
+
+///
+/// \brief Stream of a task for the lifetime of the scope: the calling thread
+///	draws from rng(seed, task), so the draws of the task do not depend on
+///	which thread runs it or on what that thread drew before. The stream of
+///	the thread is restored when the scope ends.
+///
+class rand_stream {
+public:
+	explicit rand_stream(uint64_t seed, uint64_t task = 0) : m_saved(rand_engine()) {
+		rand_engine().seed(seed, task);
+	}
+	~rand_stream() {
+		rand_engine() = m_saved;
+	}
+private:
+	rand_stream(const rand_stream&);
+	rand_stream& operator=(const rand_stream&);
+	rng m_saved;						///< Generator of the thread before the scope
+};
+
+///
+/// \brief Set the seed of the process and restart the stream of the calling
+///	thread (the threads that draw for the first time afterwards also derive
+///	their streams from the new seed).
+///
+inline void rand_seed(size_t s) {
+	rand_process_seed() = s;
+	rand_engine().seed(s, rand_thread_index());
+}
+inline void rand_seed() { rand_seed(time(0)); }
 inline double randu()  {
-	return rand() / double(RAND_MAX); 
+	return rand_engine().uniform();
 }
 // randi returns a random integer in 0..imax-1
 inline int randi(int imax) { 
  assert(imax>0);
- imax--;
- if (imax==0) return 0;
- int guard = (int) (randu()*imax)+1;
- return (guard > imax)? imax : guard;
+ return (int) rand_engine().below(imax);
 }
 inline double randn() {  // Marsaglia polar method
   double u,v,s; 
-	u=2*randu()-1; v=2*randu()-1; s=u*u+v*v;
+	do {
+		u=2*randu()-1; v=2*randu()-1; s=u*u+v*v;
+	} while (s >= 1.0 || s == 0.0);
 	return u*std::sqrt(-2*std::log(s)/s);
 } 
 
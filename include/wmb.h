@@ -27,6 +27,9 @@
 #define IBM_MERLIN_WMB_H_
 
 #include "graphical_model.h"
+#include "algorithm.h"
+#include "factor_lanes.h"
+#include "compressed_factor.h"
 
 namespace merlin {
 
@@ -42,6 +45,20 @@ namespace merlin {
  * or max) in order to tighten the upper-bound. Tightening is not guaranteed in
  * general, but it typically happens in practice.
  *
+ * With Compress=<eps> the large messages are stored in compressed form (see
+ * compressed_factor.h) and are decoded block by block into the beliefs that
+ * use them, without ever being decompressed as a whole. The
+ * reparameterizations still multiply to one in each bucket, so the bound is
+ * not affected by the backward messages; each compressed forward message
+ * moves the logZ of a pass by at most its log-domain error, and the sum of
+ * these errors is reported as the logZ error bound.
+ *
+ * When the i-bound is at least the induced width and the task is PR or MAR,
+ * the mini-buckets are exact and the weights are all 1, so the join graph is
+ * replaced by a clique tree built from the elimination order (non-maximal
+ * cliques are merged into their children) and a single collect/distribute
+ * pass of sum-product messages gives logZ and the marginals.
+ *
  */
 class wmb: public graphical_model, public algorithm {
 public:
@@ -54,14 +71,14 @@ public:
 	///
 	/// \brief Default constructor.
 	///
-	wmb() : graphical_model() {
+	wmb() : graphical_model(), m_exact_path(true) {
 		set_properties();
 	}
 
 	///
 	/// \brief Constructor with a graphical model.
 	///
-	wmb(const graphical_model& gm) : graphical_model(gm), m_gmo(gm) {
+	wmb(const graphical_model& gm) : graphical_model(gm), m_gmo(gm), m_exact_path(true) {
 		clear_factors();
 		set_properties();
 	}
@@ -96,6 +113,13 @@ public:
 		return m_log_z;
 	}
 
+	///
+	/// \brief Get the bound on the error of logZ due to compression.
+	///
+	double get_error_bound() const {
+		return m_log_z_error;
+	}
+
 	// No beliefs defined currently
 	const factor& belief(size_t f) const {
 		return m_beliefs[f];
@@ -119,97 +143,113 @@ public:
 
 	///
 	/// \brief Write the solution to the output file.
+	///
+	/// The binary file starts with the tag "MSOL" and the task (as in Task),
+	/// followed by the values of the text format: logZ and, for each variable,
+	/// its number of states and its marginal (PR, MAR), or the number of
+	/// variables and their values (MAP, MMAP).
+	///
 	/// \param filename 	The output file name
 	/// \param evidence 	The evidence variable value pairs
 	/// \param old2new		The mapping between old and new variable indexing
 	/// \param orig 		The graphical model prior to asserting evidence
+	/// \param binary 		True for the binary format
 	///
 	void write_solution(const char* file_name, const std::map<size_t, size_t>& evidence,
-			const std::map<size_t, size_t>& old2new, const graphical_model& orig ) {
+			const std::map<size_t, size_t>& old2new, const graphical_model& orig,
+			bool binary = false) {
 
 		// Open the output file
-		std::ofstream out(file_name);
-		if (out.fail()) {
-			throw std::runtime_error("Error while opening the output file.");
+		writer out(file_name, binary);
+		if (binary) {
+			out.tag("MSOL").integer((Task::Type)m_task);
 		}
 
 		switch (m_task) {
 		case Task::PR:
 		case Task::MAR:
 			{
-				out << "PR" << std::endl;
-				out << std::fixed << std::setprecision(6)
-					<< (m_log_z + std::log(orig.get_global_const())) << " (" << std::scientific << std::setprecision(6)
-					<< std::exp(m_log_z + std::log(orig.get_global_const())) << ")" << std::endl;
+				double logz = m_log_z + std::log(orig.get_global_const());
+				out.text("PR\n").real(logz, 6);
+				if (!binary) {
+					out.text(" (").scientific(std::exp(logz), 6).text(")\n");
+				}
 
-				out << "MAR" << std::endl;
-				out << orig.nvar();
+				out.text("MAR\n").integer(orig.nvar());
 				for (vindex i = 0; i < orig.nvar(); ++i) {
 					variable v = orig.var(i);
-					try { // evidence variable
-						size_t val = evidence.at(i);
-						out << " " << v.states();
+					std::map<size_t, size_t>::const_iterator ei = evidence.find(i);
+					if (ei != evidence.end()) { // evidence variable
+						out.text(' ').integer(v.states());
 						for (size_t k = 0; k < v.states(); ++k) {
-							out << " " << std::fixed << std::setprecision(6)
-								<< (k == val ? 1.0 : 0.0);
+							out.text(' ').real(k == ei->second ? 1.0 : 0.0, 6);
 						}
-					} catch(std::out_of_range& e) { // non-evidence variable
-						vindex vx = old2new.at(i);
-						variable VX = var(vx);
-						out << " " << VX.states();
-						for (size_t j = 0; j < VX.states(); ++j)
-							out << " " << std::fixed << std::setprecision(6) << belief(VX)[j];
+					} else { // non-evidence variable
+						variable VX = var(old2new.find(i)->second);
+						out.text(' ').integer(VX.states());
+						out.table(belief(VX), 6);
 					}
 				} // end for
-				out << std::endl;
+				out.text('\n');
 
 				break;
 			}
 		case Task::MAP:
 			{
-				out << "MAP" << std::endl;
-				out << orig.nvar();
+				out.text("MAP\n").integer(orig.nvar());
 				for (vindex i = 0; i < orig.nvar(); ++i) {
-					try { // evidence variable
-						size_t val = evidence.at(i);
-						out << " " << val;
-					} catch(std::out_of_range& e) { // non-evidence variable
-						vindex j = old2new.at(i);
-						out << " " << m_best_config[j];
+					std::map<size_t, size_t>::const_iterator ei = evidence.find(i);
+					if (ei != evidence.end()) { // evidence variable
+						out.text(' ').integer(ei->second);
+					} else { // non-evidence variable
+						vindex j = old2new.find(i)->second;
+						out.text(' ').integer(m_best_config[j]);
 					}
 				}
-				out << std::endl;
+				out.text('\n');
 
 				break;
 			}
 		case Task::MMAP:
 			{
 				// evidence variables are a disjoint set from the query variables
-				out << "MMAP" << std::endl;
-				out << m_query.size();
+				out.text("MMAP\n").integer(m_query.size());
 				for (vindex i = 0; i < m_query.size(); ++i) {
 					vindex j = m_query[i];
 					assert(m_var_types[j] == true);
-					out << " " << m_best_config[j];
+					out.text(' ').integer(m_best_config[j]);
 				}
-
-				out << std::endl;
+				out.text('\n');
 
 				break;
 			}
 		}
+
+		out.close();
 	}
 
 	///
 	/// \brief Run the weighted mini-buckets algorithm.
 	///
 	virtual void run() {
+
+		// Products over the shared tables are memoized for this run only
+		factor::memo memo((size_t)(m_memo * 1024 * 1024));
+		factor::memo::scope active(m_memo > 0 ? &memo : NULL);
+
 		init();
-		tighten(m_num_iter);
+		if (m_jt_order.empty() == false) {
+			propagate_jt();
+		} else {
+			tighten(m_num_iter);
+		}
 
 		// Output solution (UAI output format)
 		std::cout << "Converged after " << m_num_iter << " iterations in "
 				<< (timeSystem() - m_start_time) << " seconds" << std::endl;
+		if (m_compress > 0) {
+			std::cout << "logZ error bound (compression) is " << m_log_z_error << std::endl;
+		}
 
 		switch (m_task) {
 		case Task::PR:
@@ -283,7 +323,7 @@ public:
 	///
 	/// \brief Properties of the algorithm
 	///
-	MER_ENUM( Property , iBound,Order,Task,Iter,Debug );
+	MER_ENUM( Property , iBound,Order,Seed,Task,Iter,Debug,Compress,Memo );
 
 
 	// Setting properties (directly or through property string):
@@ -366,6 +406,41 @@ public:
 		return m_query;
 	}
 
+	///
+	/// \brief Get the mini-buckets of each variable (after init).
+	///
+	const vector<flist>& get_clusters() const {
+		return m_clusters;
+	}
+
+	///
+	/// \brief Get the original factors of each mini-bucket (after init).
+	///
+	const vector<flist>& get_originals() const {
+		return m_originals;
+	}
+
+	///
+	/// \brief Get the weight of each mini-bucket (after init).
+	///
+	const vector<double>& get_weights() const {
+		return m_weights;
+	}
+
+	///
+	/// \brief Get the mini-buckets sending a message to each one (after init).
+	///
+	const vector<flist>& get_incoming() const {
+		return m_in;
+	}
+
+	///
+	/// \brief Get the mini-bucket receiving the message of each one (after init).
+	///
+	const vector<flist>& get_outgoing() const {
+		return m_out;
+	}
+
 	///
 	/// \brief Set the graphical model.
 	///
@@ -386,10 +461,11 @@ public:
 	///	
 	virtual void set_properties(std::string opt = std::string()) {
 		if (opt.length() == 0) {
-			set_properties("iBound=4,Order=MinFill,Iter=100,Task=MMAP,Debug=0");
+			set_properties("iBound=4,Order=MinFill,Seed=0,Iter=100,Task=MMAP,Debug=0,Memo=0");
 			return;
 		}
 		m_debug = false;
+		m_compress = 0;
 		std::vector<std::string> strs = merlin::split(opt, ',');
 		for (size_t i = 0; i < strs.size(); ++i) {
 			std::vector<std::string> asgn = merlin::split(strs[i], '=');
@@ -402,6 +478,9 @@ public:
 				m_parents.clear();
 				m_order_method = graphical_model::OrderMethod(asgn[1].c_str());
 				break;
+			case Property::Seed:
+				m_seed = strtoul(asgn[1].c_str(), NULL, 10);
+				break;
 			case Property::Task:
 				m_task = Task(asgn[1].c_str());
 				break;
@@ -411,6 +490,13 @@ public:
 			case Property::Debug:
 				if (atol(asgn[1].c_str()) == 0) m_debug = false;
 				else m_debug = true;
+				break;
+			case Property::Memo:
+				m_memo = atof(asgn[1].c_str());
+				break;
+			case Property::Compress:
+				m_compress = atof(asgn[1].c_str());
+				break;
 			default:
 				break;
 			}
@@ -511,7 +597,7 @@ public:
 
 		if (m_order.size() == 0) { // if we need to construct an elimination ordering
 			//m_order = m_gmo.order(m_order_method, m_var_types);
-			m_order = m_gmo.order2(m_order_method, m_var_types);
+			m_order = m_gmo.order2(m_order_method, m_var_types, m_seed);
 			m_parents.clear(); // (new elim order => need new pseudotree)
 			std::copy(m_order.begin(), m_order.end(),
 				std::ostream_iterator<size_t>(std::cout, " "));
@@ -526,6 +612,14 @@ public:
 		std::cout << "+ exact inference  : " << (m_ibound >= wstar ? "Yes" : "No") << std::endl;
 		if (m_ibound >= wstar) m_num_iter = 1; // exact inference requires 1 iteration over the join-tree
 
+		// Exact sum-product: use a clique tree instead of the join graph
+		m_jt_order.clear();
+		if (m_ibound >= wstar && m_query.empty() && m_exact_path &&
+				(m_task == Task::PR || m_task == Task::MAR)) {
+			init_jt();
+			return;
+		}
+
 		// Get the factors scopes
 		vector<variable_set> fin;
 		for (vector<factor>::const_iterator i = m_gmo.get_factors().begin();
@@ -618,9 +712,15 @@ public:
 			int pos = 0;
 			for (flistIt i = ids.begin(); i != ids.end(); ++i) {
 				//
-				// Create new cluster alpha over this set of variables; save function parameters also
-				findex alpha = findex(-1);
-				alpha = add_factor(factor(fin[*i]));
+				// Create new cluster alpha over this set of variables; its potential
+				// is the product of its original factors only (the cluster scope
+				// also covers the incoming messages, see m_scopes)
+				factor pot(1.0);
+				for (flistIt j = Orig[*i].begin(); j != Orig[*i].end(); ++j) {
+					pot *= m_gmo.get_factor(*j);
+				}
+				findex alpha = add_factor(pot);
+				m_scopes.push_back(fin[*i]);
 				alphas.push_back(alpha);
 				m_clusters[*x] |= alpha;
 
@@ -660,10 +760,11 @@ public:
 		size_t C = m_factors.size(), max_clique_size = 0, max_sep_size = 0;
 		m_separators.resize(C);
 		for (size_t i = 0; i < C; ++i) m_separators[i].resize(C);
-		m_scopes.resize(C);
+		double mem_clusters = 0, mem_potentials = 0, mem_messages = 0;
 		for (size_t i = 0; i < C; ++i) {
-			m_scopes[i] = m_factors[i].vars();
 			max_clique_size = std::max(max_clique_size, m_scopes[i].size());
+			mem_clusters = std::max(mem_clusters, (double)m_scopes[i].num_states());
+			mem_potentials += m_factors[i].numel();
 		}
 
 		const std::vector<edge_id>& elist = edges();
@@ -672,10 +773,11 @@ public:
 			a = elist[i].first;
 			b = elist[i].second;
 			if (a > b) continue;
-			variable_set sep = m_factors[a].vars() & m_factors[b].vars();
+			variable_set sep = m_scopes[a] & m_scopes[b];
 			m_separators[a][b] = sep;
 			m_separators[b][a] = sep;
 			max_sep_size = std::max(max_sep_size, sep.size());
+			mem_messages += 2.0 * sep.num_states(); // forward and backward
 		}
 
 		// incoming and outgoing
@@ -699,6 +801,8 @@ public:
 		size_t N = m_schedule.size();
 		m_forward.resize(N);
 		m_backward.resize(N);
+		m_cforward.assign(N, compressed_factor());
+		m_cbackward.assign(N, compressed_factor());
 		m_edge_indeces.resize(C);
 		for (size_t i = 0; i < C; ++i) m_edge_indeces[i].resize(C);
 		for (size_t i = 0; i < N; ++i) {
@@ -707,23 +811,12 @@ public:
 			m_edge_indeces[from][to] = i;
 		}
 
-		// init clique potentials
-		for (size_t i = 0; i < m_factors.size(); ++i) {
-			m_factors[i] = factor(1.0); //get_factor(1.0); // init
-
-			// clique potential
-			for (flist::const_iterator j = m_originals[i].begin();
-					j != m_originals[i].end(); ++j) {
-				m_factors[i] *= m_gmo.get_factor(*j);
-			}
-
-		}
-
 		// initialize beliefs (marginals)
 		m_log_z = 0;
+		m_log_z_error = 0;
 		m_beliefs.clear();
 		m_beliefs.resize(m_gmo.nvar(), factor(1.0));
-		m_reparam.resize( m_factors.size(), factor(1.0) );
+		m_reparam.assign( m_factors.size(), factor(1.0) ); // identity (shared)
 		m_best_config.resize(m_gmo.nvar(), -1);
 
 		// Output the join graph statistics
@@ -732,6 +825,9 @@ public:
 		std::cout << " - number of edges:    " << elist.size() << std::endl;
 		std::cout << " - max clique size:    " << max_clique_size << std::endl;
 		std::cout << " - max separator size: " << max_sep_size << std::endl;
+		std::cout << " - potentials memory:  " << mem_potentials * sizeof(double) / (1024 * 1024) << " MBytes" << std::endl;
+		std::cout << " - messages memory:    " << mem_messages * sizeof(double) / (1024 * 1024) << " MBytes" << std::endl;
+		std::cout << " - largest belief:     " << mem_clusters * sizeof(double) / (1024 * 1024) << " MBytes" << std::endl;
 
 		if (m_debug) {
 			std::cout << "[MERLIN DEBUG]\n";
@@ -816,6 +912,76 @@ public:
 		} // end if debug
 	}
 
+	///
+	/// \brief Multiply a message into a belief; a compressed message is
+	/// decoded block by block (see compressed_factor::apply).
+	/// \param bel 		The belief (its scope grows if needed)
+	/// \param msgs 	The messages (by edge)
+	/// \param packed	The compressed messages (by edge)
+	/// \param i 		The edge index
+	///
+	void multiply_message(factor& bel, const vector<factor>& msgs,
+			const vector<compressed_factor>& packed, size_t i) const {
+		if (i >= packed.size() || packed[i].empty()) {
+			bel *= msgs[i];
+			return;
+		}
+		const compressed_factor& c = packed[i];
+		if (!(bel.vars() >> c.vars())) bel = bel.embed(bel.vars() + c.vars());
+		c.apply(bel, std::multiplies<double>());
+	}
+
+	///
+	/// \brief Divide a belief by a message raised to a power, m^p (the
+	/// scope of the message is included in that of the belief).
+	///
+	void divide_message(factor& bel, const vector<factor>& msgs,
+			const vector<compressed_factor>& packed, size_t i, double p) const {
+		if (i < packed.size() && packed[i].empty() == false) {
+			packed[i].apply(bel, divide_power(p));
+		} else if (p == 1.0) {
+			bel /= msgs[i];
+		} else {
+			bel /= (msgs[i]^p);
+		}
+	}
+
+	///
+	/// \brief Division by a power of a value (0 where the value is 0).
+	///
+	struct divide_power {
+		double p;
+		explicit divide_power(double p) : p(p) {};
+		double operator()(double a, double m) const {
+			double d = (p == 1.0) ? m : std::pow(m, p);
+			return d ? a / d : 0;
+		}
+	};
+
+	///
+	/// \brief Store a message, compressing it if it is large enough.
+	/// \return the log-domain error of the stored message.
+	///
+	double store(vector<factor>& msgs, vector<compressed_factor>& packed, size_t i) {
+		if (m_compress > 0 && msgs[i].numel() >= compressed_factor::block_size) {
+			packed[i] = compressed_factor(msgs[i], m_compress);
+			msgs[i] = factor();
+			return packed[i].error();
+		}
+		packed[i] = compressed_factor();
+		return 0.0;
+	}
+
+	///
+	/// \brief Potential of a cluster with its reparameterization (if any).
+	///
+	factor potential(findex a) const {
+		if (m_reparam[a].nvar() == 0) { // identity, until moment matching
+			return m_factors[a];
+		}
+		return m_factors[a] * m_reparam[a];
+	}
+
 	///
 	/// \brief Compute the belief of a cluster.
 	/// \param a 	The index of the cluster
@@ -823,14 +989,14 @@ public:
 	///
 	factor calc_belief(findex a) {
 
-		factor bel = m_factors[a] * m_reparam[a];
+		factor bel = potential(a);
 
 		// forward messages to 'a'
 		for (flist::const_iterator ci = m_in[a].begin();
 				ci != m_in[a].end(); ++ci) {
 			findex p = (*ci);
 			size_t j = m_edge_indeces[p][a];
-			bel *= m_forward[j];
+			multiply_message(bel, m_forward, m_cforward, j);
 		}
 
 		// backward message to 'a'
@@ -838,7 +1004,7 @@ public:
 				ci != m_out[a].end(); ++ci) {
 			findex p = (*ci);
 			size_t j = m_edge_indeces[a][p];
-			bel *= m_backward[j];
+			multiply_message(bel, m_backward, m_cbackward, j);
 		}
 
 		return bel;
@@ -853,14 +1019,14 @@ public:
 	///
 	factor incoming(findex a, size_t i) {
 
-		factor bel = m_factors[a] * m_reparam[a];
+		factor bel = potential(a);
 
 		// forward messages to 'a'
 		for (flist::const_iterator ci = m_in[a].begin();
 				ci != m_in[a].end(); ++ci) {
 			findex p = (*ci);
 			size_t j = m_edge_indeces[p][a];
-			bel *= m_forward[j];
+			multiply_message(bel, m_forward, m_cforward, j);
 			//_norm[i] += _norm[j];
 		}
 
@@ -875,14 +1041,14 @@ public:
 	///
 	factor incoming(findex a) {
 
-		factor bel = m_factors[a] * m_reparam[a];
+		factor bel = potential(a);
 
 		// forward messages to 'a'
 		for (flist::const_iterator ci = m_in[a].begin();
 				ci != m_in[a].end(); ++ci) {
 			findex p = (*ci);
 			size_t j = m_edge_indeces[p][a];
-			bel *= m_forward[j];
+			multiply_message(bel, m_forward, m_cforward, j);
 		}
 
 		return bel;
@@ -896,6 +1062,7 @@ public:
 		if (m_debug) std::cout << "Begin forward (top-down) pass ..." << std::endl;
 
 		m_log_z = 0;
+		m_log_z_error = 0;
 		for (variable_order_t::const_iterator x = m_order.begin(); x != m_order.end(); ++x) {
 
 			if (m_debug) {
@@ -931,6 +1098,7 @@ public:
 						std::cout << "  forward msg (" << a << "," << b << "): elim = " << VX << " -> ";
 						std::cout << m_forward[ei] << std::endl;
 					}
+					m_log_z_error += store(m_forward, m_cforward, ei);
 				} // end if
 			} // end for
 		} // end for
@@ -985,7 +1153,7 @@ public:
 			if (m_types[b] == false && m_types[a] == false) { // SUM-SUM
 
 				bel ^= 1.0/m_weights[b];
-				bel /= (m_forward[i]^(1.0/m_weights[a])); // divide out m(a->b)
+				divide_message(bel, m_forward, m_cforward, i, 1.0/m_weights[a]); // divide out m(a->b)
 
 				//_backward[i] = elim(bel, VX, 1);
 				m_backward[i] = bel.sum(VX);
@@ -993,17 +1161,26 @@ public:
 
 			} else if (m_types[b] == true && m_types[a] == true) { // MAX-MAX
 
-				bel /= m_forward[i]; // divide out m(a->b)
+				divide_message(bel, m_forward, m_cforward, i, 1.0); // divide out m(a->b)
 				m_backward[i] = bel.max(VX);
 
 			} else if (m_types[b] == true && m_types[a] == false) { // MAX-SUM
 
 				bel = bel.sigma(iter); // the sigma operator that focuses on max
-				bel /= (m_forward[i]^(1.0/m_weights[a])); // divide out m(a->b)
+				divide_message(bel, m_forward, m_cforward, i, 1.0/m_weights[a]); // divide out m(a->b)
 
 				m_backward[i] = bel.sum(VX);
 				m_backward[i] ^= (m_weights[a]);
 
+			} else if (m_types[b] == false && m_types[a] == true) { // SUM-MAX
+
+				// a max cluster below a sum one (eg, decisions in an ID)
+				divide_message(bel, m_forward, m_cforward, i, 1.0); // divide out m(a->b)
+				bel ^= 1.0/m_weights[b];
+
+				m_backward[i] = bel.sum(VX);
+				m_backward[i] ^= (m_weights[b]);
+
 			} else {
 				assert(false); // cannot reach this case!!
 			}
@@ -1016,6 +1193,7 @@ public:
 				std::cout << "  backward msg (" << b << "," << a << "): elim = " << VX << " -> ";
 				std::cout << m_backward[i] << std::endl;
 			}
+			store(m_backward, m_cbackward, i);
 
 		}
 
@@ -1111,18 +1289,21 @@ public:
 		std::cout << " + stopTime : " << stopTime << std::endl;
 		std::cout << " + stopIter : " << nIter << std::endl;
 
-		double minZ = infty();
+		double minZ = infty(), minErr = 0;
 		for (size_t iter = 1; iter <= nIter; ++iter) {
 			double step = 1.0/(double)iter;
 			double prevZ = m_log_z;
 
 			forward(step);
 			backward(iter);
-			update();
+			if (m_task != Task::MAR && m_task != Task::PR) {
+				update();
+			}
 
 			// keep track of tightest upper bound
 			if (m_log_z < minZ) {
 				minZ = m_log_z;
+				minErr = m_log_z_error;
 			}
 
 			double dObj = fabs(m_log_z - prevZ);
@@ -1140,7 +1321,13 @@ public:
 				break;
 		} // end for
 
+		// the marginals are only needed after the last iteration
+		if (m_task == Task::MAR || m_task == Task::PR) {
+			update();
+		}
+
 		m_log_z = minZ; // keep tightest upper bound
+		m_log_z_error = minErr;
 	}
 
 	///
@@ -1163,17 +1350,22 @@ public:
 
 		// update beliefs (marginals) or compute the MAP/MMAP assignment
 		if (m_task == Task::MAR || m_task == Task::PR) {
+			// group the variables by their first cluster, so that each cluster
+			// belief is computed once and gives all of its marginals at once
+			std::vector<variable_set> assigned(m_factors.size());
 			for (vindex v = 0; v < m_gmo.nvar(); ++v) {
-				findex c = m_clusters[v][0]; // get a cluster corresp. to current variable
-				double w = m_weights[c];
-				variable_set vars = m_scopes[c];
-				variable VX = m_gmo.var(v);
-				variable_set out = vars - VX;
-
+				assigned[m_clusters[v][0]] |= m_gmo.var(v);
+			}
+			for (findex c = 0; c < m_factors.size(); ++c) {
+				if (assigned[c].nvar() == 0) continue;
 				factor bel = calc_belief(c);
-				m_beliefs[v] = marg(bel, VX, w);
-				//m_beliefs[v] /= std::exp(m_log_z); // normalize by logZ
-				m_beliefs[v].normalize();
+				std::vector<factor> mar = bel.marginals(assigned[c], m_weights[c]);
+				for (size_t k = 0; k < mar.size(); ++k) {
+					vindex v = assigned[c][k].label();
+					m_beliefs[v] = mar[k];
+					//m_beliefs[v] /= std::exp(m_log_z); // normalize by logZ
+					m_beliefs[v].normalize();
+				}
 			}
 		} else if (m_task == Task::MAP) {
 			for (variable_order_t::const_reverse_iterator x = m_order.rbegin();
@@ -1219,12 +1411,384 @@ public:
 
 	}
 
+	///
+	/// \brief Run WMB on a batch of evidence cases at once (PR and MAR).
+	///
+	/// The join graph is built once over all the variables (the first call
+	/// runs init) and the evidence of each case enters as indicator factors
+	/// on the first cluster of each observed variable, so that every table of
+	/// the message passing holds one lane per case (see factor_lanes.h) and
+	/// each operation is done for all cases at once. The result is a log
+	/// partition function and the marginals of all variables for each case.
+	/// The bounds may differ slightly from those obtained by conditioning the
+	/// model on the evidence first (the mini-buckets are not re-partitioned
+	/// around the observed variables), and are equal when the i-bound makes
+	/// the join graph a join tree.
+	/// \param cases 	The evidence (variable, value) of each case
+	///
+	void run_batch(const std::vector<std::map<vindex, size_t> >& cases) {
+
+		if (m_query.empty() == false) {
+			throw std::runtime_error("Batched WMB supports only the PR and MAR tasks.");
+		}
+		if (m_clusters.empty()) {
+			m_exact_path = false; // the lanes run over the join graph
+			init();
+			m_exact_path = true;
+		}
+
+		const size_t K = cases.size();
+		const size_t C = m_factors.size(), N = m_schedule.size();
+		std::cout << "Begin batched message passing over " << K << " cases ..." << std::endl;
+
+		// Cluster potentials with the evidence indicators of each case
+		m_batch_factors.clear();
+		for (size_t a = 0; a < C; ++a) {
+			m_batch_factors.push_back(factor_lanes(m_factors[a], K));
+		}
+		std::map<vindex, factor_lanes> indicators;
+		for (size_t k = 0; k < K; ++k) {
+			for (std::map<vindex, size_t>::const_iterator ei = cases[k].begin();
+					ei != cases[k].end(); ++ei) {
+				vindex v = ei->first;
+				if (v >= m_gmo.nvar() || ei->second >= var(v).states()) {
+					throw std::runtime_error("Evidence is out of range.");
+				}
+				std::map<vindex, factor_lanes>::iterator ii = indicators.find(v);
+				if (ii == indicators.end()) {
+					ii = indicators.insert(std::make_pair(v,
+							factor_lanes(variable_set(var(v)), K, 1.0))).first;
+				}
+				for (size_t j = 0; j < var(v).states(); ++j) {
+					ii->second[j][k] = (j == ei->second) ? 1.0 : 0.0;
+				}
+			}
+		}
+		for (std::map<vindex, factor_lanes>::const_iterator ii = indicators.begin();
+				ii != indicators.end(); ++ii) {
+			findex a = m_clusters[ii->first][0];
+			m_batch_factors[a] *= ii->second;
+		}
+
+		m_batch_forward.assign(N, factor_lanes(1.0, K));
+		m_batch_backward.assign(N, factor_lanes(1.0, K));
+		m_batch_reparam.assign(C, factor_lanes(1.0, K));
+
+		// Iterative tightening, keeping the tightest bound of each case
+		m_batch_log_z.assign(K, infty());
+		std::vector<double> logz;
+		for (size_t iter = 1; iter <= m_num_iter; ++iter) {
+			forward_batch(1.0 / (double)iter, logz);
+			backward_batch();
+			for (size_t k = 0; k < K; ++k) {
+				m_batch_log_z[k] = std::min(m_batch_log_z[k], logz[k]);
+			}
+		}
+
+		// Marginals of each case
+		m_batch_beliefs.assign(K, std::vector<factor>(m_gmo.nvar()));
+		for (vindex v = 0; v < m_gmo.nvar(); ++v) {
+			findex c = m_clusters[v][0];
+			factor_lanes bel = (calc_belief_batch(c) ^ (1.0 / m_weights[c])).marginal(var(v));
+			std::vector<double> z = bel.sum();
+			for (size_t k = 0; k < K; ++k) {
+				z[k] = (z[k] > 0) ? 1.0 / z[k] : 0.0;
+			}
+			bel.scale(z);
+			for (size_t k = 0; k < K; ++k) {
+				m_batch_beliefs[k][v] = bel.lane(k);
+			}
+		}
+
+		std::cout << "Finished batched message passing in "
+			<< (timeSystem() - m_start_time) << " seconds" << std::endl;
+	}
+
+	///
+	/// \brief Get the log partition function of each case (see run_batch).
+	///
+	const std::vector<double>& get_batch_logz() const {
+		return m_batch_log_z;
+	}
+
+	///
+	/// \brief Get the marginals of each case (see run_batch).
+	///
+	const std::vector<std::vector<factor> >& get_batch_beliefs() const {
+		return m_batch_beliefs;
+	}
+
+	///
+	/// \brief Belief of a cluster, for all cases of the batch.
+	///
+	factor_lanes calc_belief_batch(findex a) const {
+		factor_lanes bel = m_batch_factors[a] * m_batch_reparam[a];
+		for (flist::const_iterator ci = m_in[a].begin(); ci != m_in[a].end(); ++ci) {
+			bel *= m_batch_forward[m_edge_indeces[*ci][a]];
+		}
+		for (flist::const_iterator ci = m_out[a].begin(); ci != m_out[a].end(); ++ci) {
+			bel *= m_batch_backward[m_edge_indeces[a][*ci]];
+		}
+		return bel;
+	}
+
+	///
+	/// \brief Forward pass of the batch (the SUM case of forward).
+	///
+	void forward_batch(double step, std::vector<double>& logz) {
+
+		const size_t K = m_batch_factors.empty() ? 0 : m_batch_factors[0].lanes();
+		logz.assign(K, 0.0);
+		for (variable_order_t::const_iterator x = m_order.begin(); x != m_order.end(); ++x) {
+
+			// Moment-match the clusters of this bucket (weighted marginals)
+			const flist& cl = m_clusters[*x];
+			variable VX = var(*x);
+			if (cl.size() > 1) {
+				std::vector<factor_lanes> ftmp;
+				factor_lanes fmatch(variable_set(VX), K, 1.0);
+				for (flist::const_iterator it = cl.begin(); it != cl.end(); ++it) {
+					factor_lanes bel = calc_belief_batch(*it) ^ (1.0 / m_weights[*it]);
+					ftmp.push_back(bel.marginal(VX));
+					fmatch *= (ftmp.back() ^ m_weights[*it]);
+				}
+				size_t i = 0;
+				for (flist::const_iterator it = cl.begin(); it != cl.end(); ++it, ++i) {
+					m_batch_reparam[*it] *= ((fmatch / ftmp[i]) ^ (step * m_weights[*it]));
+				}
+			}
+
+			// Forward messages, normalized for numerical stability
+			for (flist::const_iterator it = cl.begin(); it != cl.end(); ++it) {
+				findex a = *it;
+				if (m_out[a].empty()) continue;
+				size_t ei = m_edge_indeces[a][*(m_out[a].begin())];
+				factor_lanes bel = m_batch_factors[a] * m_batch_reparam[a];
+				for (flist::const_iterator ci = m_in[a].begin(); ci != m_in[a].end(); ++ci) {
+					bel *= m_batch_forward[m_edge_indeces[*ci][a]];
+				}
+				m_batch_forward[ei] = bel.sum_power(VX, 1.0 / m_weights[a]);
+				std::vector<double> mx = m_batch_forward[ei].max();
+				for (size_t k = 0; k < K; ++k) {
+					logz[k] += std::log(mx[k]);
+					mx[k] = (mx[k] > 0) ? 1.0 / mx[k] : 1.0;
+				}
+				m_batch_forward[ei].scale(mx);
+			}
+		}
+
+		// Log partition function of each case
+		for (flist::const_iterator ci = m_roots.begin(); ci != m_roots.end(); ++ci) {
+			std::vector<double> z = calc_belief_batch(*ci).sum();
+			for (size_t k = 0; k < K; ++k) {
+				logz[k] += std::log(z[k]);
+			}
+		}
+	}
+
+	///
+	/// \brief Backward pass of the batch (the SUM-SUM case of backward).
+	///
+	void backward_batch() {
+
+		vector<std::pair<findex, findex> >::reverse_iterator ri = m_schedule.rbegin();
+		for (; ri != m_schedule.rend(); ++ri) {
+			findex a = ri->first, b = ri->second;
+			size_t i = m_edge_indeces[a][b];
+			variable_set VX = m_scopes[b] - m_separators[a][b];
+
+			factor_lanes bel = calc_belief_batch(b) ^ (1.0 / m_weights[b]);
+			bel /= (m_batch_forward[i] ^ (1.0 / m_weights[a]));
+			m_batch_backward[i] = bel.sum(VX) ^ m_weights[b];
+
+			std::vector<double> mx = m_batch_backward[i].max();
+			for (size_t k = 0; k < mx.size(); ++k) {
+				mx[k] = (mx[k] > 0) ? 1.0 / mx[k] : 1.0;
+			}
+			m_batch_backward[i].scale(mx);
+		}
+	}
+
+	///
+	/// \brief Build the clique tree for exact inference.
+	///
+	/// The buckets of the elimination order are the cliques and the message of
+	/// a bucket goes to the bucket of the first variable of its scope. A parent
+	/// included in its child is merged into it (the merged clique takes the
+	/// place of the parent, so children still come before their parents).
+	///
+	void init_jt() {
+
+		const size_t n = m_gmo.nvar();
+		std::vector<size_t> pos(n, n);
+		for (size_t i = 0; i < m_order.size(); ++i) {
+			pos[m_order[i]] = i;
+		}
+
+		// Bucket scopes (by position) and the home bucket of each factor
+		const std::vector<factor>& fs = m_gmo.get_factors();
+		std::vector<variable_set> bucket(n);
+		std::vector<size_t> home(fs.size(), n);
+		for (size_t i = 0; i < fs.size(); ++i) {
+			const variable_set& vs = fs[i].vars();
+			for (variable_set::const_iterator vi = vs.begin(); vi != vs.end(); ++vi) {
+				home[i] = std::min(home[i], pos[vi->label()]);
+			}
+			if (home[i] < n) bucket[home[i]] |= vs;
+		}
+
+		// Eliminate; once a bucket is complete, it is merged with a child
+		// clique that includes it (the clique then holds the child's scope)
+		std::vector<size_t> parent(n, n), alias(n, n);
+		std::vector<variable_set> clique(n);
+		std::vector<std::vector<size_t> > kids(n);
+		for (size_t p = 0; p < n; ++p) {
+			if (bucket[p].nvar() == 0) continue;
+			clique[p] = bucket[p];
+			for (size_t k = 0; k < kids[p].size(); ++k) {
+				size_t c = kids[p][k];
+				if (bucket[p] << clique[c]) {
+					clique[p] = clique[c];
+					alias[c] = p; // the children of c now hang from p
+					break;
+				}
+			}
+			variable_set sep = bucket[p] - var(m_order[p]);
+			if (sep.nvar() == 0) continue; // root
+			size_t q = n;
+			for (variable_set::const_iterator vi = sep.begin(); vi != sep.end(); ++vi) {
+				q = std::min(q, pos[vi->label()]);
+			}
+			bucket[q] |= sep;
+			parent[p] = q;
+			kids[q].push_back(p);
+		}
+
+		// Cliques (children before parents), potentials and homes of the variables
+		std::vector<size_t> id(n, n);
+		for (size_t p = 0; p < n; ++p) {
+			if (bucket[p].nvar() > 0 && alias[p] == n) {
+				id[p] = m_jt_order.size();
+				m_jt_order.push_back(p);
+			}
+		}
+		size_t C = m_jt_order.size();
+		m_jt_scopes.resize(C);
+		m_jt_parent.assign(C, C);
+		m_jt_potentials.assign(C, factor(1.0));
+		m_jt_up.assign(C, factor(1.0));
+		m_jt_down.assign(C, factor(1.0));
+		m_jt_home.assign(n, C);
+		size_t max_clique_size = 0, max_sep_size = 0;
+		double mem_potentials = 0, mem_messages = 0, mem_clusters = 0;
+		for (size_t c = 0; c < C; ++c) {
+			size_t p = m_jt_order[c];
+			m_jt_scopes[c] = clique[p];
+			size_t q = parent[p];
+			while (q < n && alias[q] < n) q = alias[q];
+			if (q < n) {
+				m_jt_parent[c] = id[q];
+				variable_set sep = clique[p] & clique[q];
+				max_sep_size = std::max(max_sep_size, sep.size());
+				mem_messages += 2.0 * sep.num_states();
+			}
+			max_clique_size = std::max(max_clique_size, clique[p].size());
+			mem_clusters = std::max(mem_clusters, (double)clique[p].num_states());
+		}
+		for (size_t i = 0; i < fs.size(); ++i) {
+			size_t p = home[i];
+			if (p == n) continue; // constant (as in the join graph)
+			while (alias[p] < n) p = alias[p];
+			m_jt_potentials[id[p]] *= fs[i];
+		}
+		for (vindex v = 0; v < n; ++v) {
+			size_t p = pos[v];
+			if (p == n || bucket[p].nvar() == 0) continue;
+			while (alias[p] < n) p = alias[p];
+			m_jt_home[v] = id[p];
+		}
+		for (size_t c = 0; c < C; ++c) {
+			mem_potentials += m_jt_potentials[c].numel();
+		}
+
+		m_log_z = 0;
+		m_beliefs.clear();
+		m_beliefs.resize(n, factor(1.0));
+		m_best_config.resize(n, -1);
+
+		std::cout << "Created junction tree with " << std::endl;
+		std::cout << " - number of cliques:  " << C << std::endl;
+		std::cout << " - max clique size:    " << max_clique_size << std::endl;
+		std::cout << " - max separator size: " << max_sep_size << std::endl;
+		std::cout << " - potentials memory:  " << mem_potentials * sizeof(double) / (1024 * 1024) << " MBytes" << std::endl;
+		std::cout << " - messages memory:    " << mem_messages * sizeof(double) / (1024 * 1024) << " MBytes" << std::endl;
+		std::cout << " - largest belief:     " << mem_clusters * sizeof(double) / (1024 * 1024) << " MBytes" << std::endl;
+	}
+
+	///
+	/// \brief Collect and distribute over the clique tree (logZ and marginals).
+	///
+	void propagate_jt() {
+
+		const size_t C = m_jt_order.size();
+		std::vector<flist> children(C);
+		for (size_t c = 0; c < C; ++c) {
+			if (m_jt_parent[c] < C) children[m_jt_parent[c]] |= c;
+		}
+
+		// Collect (leaves to roots), normalizing the messages by their maximum
+		m_log_z = 0;
+		for (size_t c = 0; c < C; ++c) {
+			factor bel = m_jt_potentials[c];
+			for (flist::const_iterator k = children[c].begin(); k != children[c].end(); ++k) {
+				bel *= m_jt_up[*k];
+			}
+			size_t p = m_jt_parent[c];
+			if (p < C) {
+				m_jt_up[c] = bel.marginal(m_jt_scopes[c] & m_jt_scopes[p]);
+				double mx = m_jt_up[c].max();
+				m_jt_up[c] /= mx;
+				m_log_z += std::log(mx);
+			} else {
+				m_log_z += std::log(bel.sum());
+			}
+		}
+
+		// Distribute (roots to leaves) and read off the marginals
+		for (size_t c = C; c-- > 0; ) {
+			factor bel = m_jt_potentials[c];
+			for (flist::const_iterator k = children[c].begin(); k != children[c].end(); ++k) {
+				bel *= m_jt_up[*k];
+			}
+			if (m_jt_parent[c] < C) {
+				bel *= m_jt_down[c];
+			}
+			for (flist::const_iterator k = children[c].begin(); k != children[c].end(); ++k) {
+				m_jt_down[*k] = bel.marginal(m_jt_scopes[*k] & m_jt_scopes[c]);
+				m_jt_down[*k] /= m_jt_up[*k]; // divide out the message of the child
+				m_jt_down[*k] /= m_jt_down[*k].max();
+			}
+			const variable_set& vs = m_jt_scopes[c];
+			for (variable_set::const_iterator vi = vs.begin(); vi != vs.end(); ++vi) {
+				if (m_jt_home[vi->label()] == c) {
+					m_beliefs[vi->label()] = bel.marginal(*vi);
+					m_beliefs[vi->label()].normalize();
+				}
+			}
+		}
+
+		if (m_debug) {
+			std::cout << "Finished junction tree propagation with logZ: " << m_log_z << std::endl;
+		}
+	}
+
 protected:
 	// Members:
 
 	graphical_model m_gmo; 				///< Original graphical model
 	Task m_task;						///< Inference task
 	OrderMethod m_order_method;			///< Variable ordering method
+	unsigned long m_seed;				///< Seed of the ordering tie-breaks
 	size_t m_ibound;					///< Mini-bucket i-bound
 	double m_log_z;						///< Log partition function value
 	variable_order_t m_order;			///< Variable order
@@ -1235,6 +1799,8 @@ protected:
 	std::vector<vindex> m_query; 		///< MAX variables for the MMAP task
 	size_t m_num_iter; 					///< Number of iterations to be executed
 	double m_lb;						///< Lower bound (ie, value of MAP assignment)
+	double m_compress;					///< Relative error of compressed messages (0 if off)
+	double m_log_z_error;				///< Error bound on logZ (compression)
 
 private:
 	// JG local structures:
@@ -1249,14 +1815,35 @@ private:
 	flist m_roots;						///< Root cluster(s)
 	vector<factor> m_forward; 			///< Forward messages (by edge)
 	vector<factor> m_backward; 			///< Backward messages (by edge)
-	vector<factor> m_reparam; 			///< Reparameterization function (by cluster)
+	vector<factor> m_reparam; 			///< Reparameterization function (by cluster, constant 1 if none)
+	vector<compressed_factor> m_cforward;	///< Compressed forward messages (by edge)
+	vector<compressed_factor> m_cbackward;	///< Compressed backward messages (by edge)
 
 	vector<std::pair<findex, findex> > m_schedule;	///< Propagation schedule
 	vector<vector<size_t> > m_edge_indeces;			///< Edge indeces
 	vector<vector<variable_set> > m_separators; 	///< Separators between clusters
 	std::map<size_t, size_t> m_cluster2var;			///< Maps cluster id to a variable id
 
+	// Batched evidence (one lane per case, see run_batch)
+	vector<factor_lanes> m_batch_factors;	///< Cluster potentials with the evidence
+	vector<factor_lanes> m_batch_forward;	///< Forward messages (by edge)
+	vector<factor_lanes> m_batch_backward;	///< Backward messages (by edge)
+	vector<factor_lanes> m_batch_reparam;	///< Reparameterization function (by cluster)
+	std::vector<double> m_batch_log_z;		///< Log partition function of each case
+	std::vector<std::vector<factor> > m_batch_beliefs;	///< Marginals of each case
+
+	// Clique tree (exact PR and MAR, see init_jt)
+	bool m_exact_path;						///< Use the clique tree when exact
+	std::vector<size_t> m_jt_order;			///< Bucket position of each clique
+	vector<variable_set> m_jt_scopes;		///< Scope of each clique
+	std::vector<size_t> m_jt_parent;		///< Parent of each clique (none if a root)
+	std::vector<size_t> m_jt_home;			///< Clique holding each variable's marginal
+	vector<factor> m_jt_potentials;			///< Potential of each clique
+	vector<factor> m_jt_up;					///< Message from each clique to its parent
+	vector<factor> m_jt_down;				///< Message to each clique from its parent
+
 	bool m_debug;						///< Internal debugging flag
+	double m_memo;						///< Memory for memoized products (MB, 0 if off)
 
 };
 
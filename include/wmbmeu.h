@@ -0,0 +1,548 @@
+/*
+ * wmbmeu.h
+ *
+ *  Created on: 15 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file wmbmeu.h
+/// \brief Weighted mini-buckets for the MEU of IDs
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_WMBMEU_H_
+#define IBM_MERLIN_WMBMEU_H_
+
+#include "limid.h"
+#include "algorithm.h"
+#include "wmb.h"
+#include "evaluator.h"
+
+namespace merlin {
+
+/**
+ * Weighted Mini-Buckets for the MEU (WMB-MEU)
+ *
+ * Models supported: ID
+ *
+ * The MEU of an ID is a max-sum expression over the product of the
+ * probabilities and the sum of the utilities. WMB-MEU bounds it on the join
+ * graph of the weighted mini-buckets (see wmb.h), built along the constrained
+ * elimination order of the ID, with a (probability, utility) valuation: each
+ * mini-bucket holds the product of its probabilities and the sum of its
+ * utilities, and sends its parent a probability message and a utility message
+ * that are combined by product and by sum, respectively. A chance variable is
+ * eliminated by the weighted sum of its mini-bucket (Holder's inequality), a
+ * decision by maximization, and the utility message is the eliminated
+ * expected utility divided by the eliminated probability. The cost-shifting
+ * of WMB reparameterizes the probabilities of the mini-buckets of a variable
+ * (so that their product is unchanged) by matching their marginals, here
+ * mixed in proportion to the expected utility of each mini-bucket, over
+ * `Iter` forward passes; the bound is the tightest one.
+ *
+ * The utilities are shifted to be non-negative and the shift is added back,
+ * multiplied by a lower bound on the probability mass (exactly 1 without
+ * evidence and within the i-bound): the mini-bucket elimination that sums the
+ * first mini-bucket of a chance variable and minimizes the others.
+ *
+ * The policy of each decision is the argmax of the expected utility of its
+ * mini-buckets, and its value, computed by the policy evaluator (see
+ * evaluator.h), is a lower bound on the MEU.
+ */
+class wmbmeu : public limid, public algorithm {
+public:
+	typedef limid::findex findex;        ///< Factor index
+	typedef limid::vindex vindex;        ///< Variable index
+	typedef limid::flist flist;          ///< Collection of factor indices
+
+	///
+	/// \brief Properties of the algorithm
+	///
+	MER_ENUM( Property , iBound,Order,Seed,Iter,Debug,Memo );
+
+public:
+
+	///
+	/// \brief Default constructor.
+	///
+	wmbmeu() : limid() {
+		set_properties();
+	}
+
+	///
+	/// \brief Constructor with a graphical model.
+	///
+	wmbmeu(const limid& lm) : limid(lm), m_gmo(lm) {
+		clear_factors();
+		set_properties();
+	}
+
+	///
+	/// \brief Clone the algorithm.
+	/// \return the pointer to the new object containing the cloned algorithm.
+	///
+	virtual wmbmeu* clone() const {
+		wmbmeu* lm = new wmbmeu(*this);
+		return lm;
+	}
+
+	// Upper bound on the maximum expected utility
+	double ub() const {
+		return m_meu;
+	}
+	// Lower bound (value of the policy)
+	double lb() const {
+		return m_lb;
+	}
+	std::vector<size_t> best_config() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	double logZ() const {
+		throw std::runtime_error("Not implemented");
+	}
+	double logZub() const {
+		throw std::runtime_error("Not implemented");
+	}
+	double logZlb() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	// No beliefs defined currently
+	const factor& belief(size_t) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const factor& belief(variable) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const factor& belief(variable_set) const {
+		throw std::runtime_error("Not implemented");
+	}
+	const vector<factor>& beliefs() const {
+		throw std::runtime_error("Not implemented");
+	}
+
+	///
+	/// \brief Set the variable elimination order (of the ID's variables).
+	///
+	void set_order(const variable_order_t& ord) {
+		m_order = ord;
+	}
+
+	///
+	/// \brief Get the decision policy (expected utilities of the mini-buckets).
+	///
+	const std::map<vindex, factor>& get_policy() const {
+		return m_policy;
+	}
+
+	///
+	/// \brief Set the properties of the algorithm.
+	/// \param opt 	The string containing comma separated property value pairs
+	///
+	virtual void set_properties(std::string opt = std::string()) {
+		if (opt.length() == 0) {
+			set_properties("iBound=4,Order=MinFill,Seed=0,Iter=10,Debug=0,Memo=0");
+			return;
+		}
+		std::vector<std::string> strs = merlin::split(opt, ',');
+		for (size_t i = 0; i < strs.size(); ++i) {
+			std::vector<std::string> asgn = merlin::split(strs[i], '=');
+			switch (Property(asgn[0].c_str())) {
+			case Property::iBound:
+				m_ibound = atol(asgn[1].c_str());
+				break;
+			case Property::Order:
+				m_order.clear();
+				m_order_method = OrderMethod(asgn[1].c_str());
+				break;
+			case Property::Seed:
+				m_seed = strtoul(asgn[1].c_str(), NULL, 10);
+				break;
+			case Property::Iter:
+				m_num_iter = atol(asgn[1].c_str());
+				break;
+			case Property::Debug:
+				m_debug = (atol(asgn[1].c_str()) == 0) ? false : true;
+				break;
+			case Property::Memo:
+				m_memo = atof(asgn[1].c_str());
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	///
+	/// \brief Initialize the algorithm.
+	///
+	void init() {
+
+		// Start the timer and store it
+		m_start_time = timeSystem();
+
+		// Check if LIMID
+		if (m_gmo.islimid()) {
+			throw std::runtime_error("WMB-MEU is only supported for standard IDs.");
+		}
+
+		// Prologue
+		std::cout << "Initialize solver ..." << std::endl;
+		std::cout << " + models supported : ID" << std::endl;
+		std::cout << " + algorithm        : WMB-MEU" << std::endl;
+		std::cout << " + i-bound          : " << m_ibound << std::endl;
+		std::cout << " + iterations       : " << m_num_iter << std::endl;
+
+		// Construct the elimination ordering (unless given)
+		if (m_order.size() == 0) {
+			m_order = m_gmo.order(m_order_method, m_seed);
+		}
+		std::cout << " + elimination      : ";
+		std::copy(m_order.begin(), m_order.end(),
+				std::ostream_iterator<size_t>(std::cout, " "));
+		std::cout << std::endl;
+		std::cout << " + induced width    : " << m_gmo.induced_width(m_order) << std::endl;
+	}
+
+	///
+	/// \brief Run weighted mini-buckets on the ID.
+	///
+	virtual void run() {
+
+		// Products over the shared tables are memoized for this run only
+		factor::memo memo((size_t)(m_memo * 1024 * 1024));
+		factor::memo::scope active(m_memo > 0 ? &memo : NULL);
+
+		// Initialize the algorithm
+		init();
+
+		// Non-negative utilities
+		limid gm(m_gmo);
+		double shift = gm.shift_utilities();
+		std::cout << " + utility shift    : " << shift << std::endl;
+
+		size_t m = 0;
+		for (size_t i = 0; i < gm.num_factors(); ++i) {
+			if (gm.get_factor(i).get_type() == factor::FactorType::Utility) ++m;
+		}
+		m_policy.clear();
+		if (m == 0) {
+			m_meu = m_lb = 0.0;
+			std::cout << "No utility factors, MEU value is 0" << std::endl;
+			return;
+		}
+
+		// Join graph of the mini-buckets, the decisions are the MAX variables
+		std::vector<vindex> decisions;
+		for (size_t i = 0; i < m_order.size(); ++i) {
+			if (m_vtypes[m_order[i]] == 'd') decisions.push_back(m_order[i]);
+		}
+		std::ostringstream oss;
+		oss << "iBound=" << m_ibound << ",Iter=1,Task=MMAP,Debug=0";
+		wmb jg(gm);
+		jg.set_properties(oss.str());
+		jg.set_query(decisions);
+		jg.set_order(m_order);
+		jg.init();
+		m_clusters = jg.get_clusters();
+		m_weights = jg.get_weights();
+		m_in = jg.get_incoming();
+		m_out = jg.get_outgoing();
+
+		// Probabilities and utilities of the mini-buckets (the probabilities
+		// cover the variable of the bucket, its sum counts its states)
+		const std::vector<flist>& orig = jg.get_originals();
+		size_t C = orig.size();
+		m_prob.assign(C, factor(1.0));
+		for (size_t x = 0; x < m_clusters.size(); ++x) {
+			for (flist::const_iterator it = m_clusters[x].begin();
+					it != m_clusters[x].end(); ++it) {
+				m_prob[*it] = factor(variable_set(m_gmo.var(x)), 1.0);
+			}
+		}
+		m_util.assign(C, factor(0.0));
+		m_reparam.assign(C, factor(1.0));
+		m_msg_prob.assign(C, factor(1.0));
+		m_msg_util.assign(C, factor(0.0));
+		for (size_t a = 0; a < C; ++a) {
+			for (flist::const_iterator it = orig[a].begin(); it != orig[a].end(); ++it) {
+				const factor& f = gm.get_factor(*it);
+				if (f.get_type() == factor::FactorType::Utility) {
+					m_util[a] += f;
+				} else {
+					m_prob[a] *= f;
+				}
+			}
+		}
+
+		// Forward passes with cost-shifting, keep the tightest bound
+		std::cout << "Begin message passing over join graph ..." << std::endl;
+		double best = infty();
+		for (size_t iter = 1; iter <= std::max(m_num_iter, (size_t)1); ++iter) {
+			double eu = forward(1.0/(double)iter);
+			if (eu < best) {
+				best = eu;
+				update_policy(decisions);
+			}
+			if (m_debug) {
+				std::cout << "  WMB-MEU: " << eu << "\ti=" << iter << std::endl;
+			}
+		}
+
+		double mass = mass_lb();
+		std::cout << " + probability mass : " << mass << " (lower bound)" << std::endl;
+		m_meu = best + shift * mass;
+
+		// Evaluate the policy of the mini-buckets
+		evaluator ev(m_gmo);
+		ev.set_order(m_order);
+		ev.set_policy(m_policy);
+		ev.run();
+		m_lb = ev.lb();
+
+		std::cout << "MEU lower bound is " << m_lb << " (policy of the mini-buckets)" << std::endl;
+		std::cout << "MEU upper bound is " << m_meu << std::endl;
+		std::cout << "CPU time is " << timeSystem() - m_start_time << " seconds" << std::endl;
+		std::cout << "Done." << std::endl << std::endl;
+	}
+
+protected:
+
+	///
+	/// \brief Belief of a mini-bucket (probability and utility).
+	///
+	void pair_belief(size_t a, factor& lam, factor& eta) const {
+		lam = m_prob[a] * m_reparam[a];
+		eta = m_util[a];
+		for (flist::const_iterator it = m_in[a].begin(); it != m_in[a].end(); ++it) {
+			lam *= m_msg_prob[*it];
+			eta += m_msg_util[*it];
+		}
+	}
+
+	///
+	/// \brief Match the mini-buckets of a variable (cost-shifting).
+	///
+	/// The marginal of each mini-bucket mixes the marginals of its probability
+	/// and of its expected utility, weighted by the share of the mini-bucket in
+	/// the expected utility of the bucket (the gradient of the bound).
+	///
+	void match_clusters(vindex x, double step) {
+
+		const flist& cl = m_clusters[x];
+		size_t R = cl.size();
+		variable_set VX(m_gmo.var(x));
+		std::vector<factor> marg(R), emarg(R);
+		std::vector<double> share(R, 0.0);
+		double total = 0.0;
+
+		size_t i = 0;
+		for (flist::const_iterator it = cl.begin(); it != cl.end(); ++it, ++i) {
+			findex a = *it;
+			factor lam, eta;
+			pair_belief(a, lam, eta);
+			double mx = lam.max();
+			if (mx > 0) lam /= mx;
+			factor eu = lam * eta;
+			double w = m_weights[a];
+			double L, U;
+			if (w == infty()) { // max-marginals
+				L = lam.max();
+				U = eu.max();
+				marg[i] = lam.maxmarginal(VX);
+				emarg[i] = eu.maxmarginal(VX);
+			} else { // weighted marginals
+				lam ^= (1.0/w);
+				eu ^= (1.0/w);
+				L = lam.sum();
+				U = eu.sum();
+				marg[i] = lam.marginal(VX);
+				emarg[i] = eu.marginal(VX);
+			}
+			if (L > 0) {
+				marg[i] /= L;
+				share[i] = (w == infty()) ? U/L : std::pow(U/L, w);
+			}
+			if (U > 0) emarg[i] /= U;
+			total += share[i];
+		}
+
+		factor fmatch(VX, 1.0);
+		i = 0;
+		for (flist::const_iterator it = cl.begin(); it != cl.end(); ++it, ++i) {
+			if (total > 0) {
+				marg[i] = (emarg[i] * share[i] + marg[i] * (total - share[i])) / total;
+			}
+			double w = m_weights[*it];
+			fmatch *= (marg[i] ^ ((w == infty()) ? 1.0/R : w));
+		}
+
+		i = 0;
+		for (flist::const_iterator it = cl.begin(); it != cl.end(); ++it, ++i) {
+			findex a = *it;
+			double w = m_weights[a];
+			if (w == infty()) {
+				m_reparam[a] *= (fmatch/marg[i]);
+			} else {
+				m_reparam[a] *= ((fmatch/marg[i])^(step*w));
+			}
+		}
+	}
+
+	///
+	/// \brief Forward pass over the join graph.
+	/// \return the upper bound on the (shifted) MEU.
+	///
+	double forward(double step) {
+
+		double log_z = 0.0, eu = 0.0;
+		for (size_t i = 0; i < m_order.size(); ++i) {
+			vindex x = m_order[i];
+			const flist& cl = m_clusters[x];
+			if (cl.size() > 1) match_clusters(x, step);
+
+			variable_set VX(m_gmo.var(x));
+			for (flist::const_iterator it = cl.begin(); it != cl.end(); ++it) {
+				findex a = *it;
+				factor lam, eta;
+				pair_belief(a, lam, eta);
+				factor e = lam * eta;
+				double w = m_weights[a];
+				if (w == infty()) {
+					lam = lam.max(VX);
+					e = e.max(VX);
+				} else {
+					lam = lam.sum_power(VX, 1.0/w);
+					e = e.sum_power(VX, 1.0/w);
+				}
+
+				// the utility message is the expected utility per unit of
+				// probability, normalize the probability message
+				m_msg_util[a] = e / lam;
+				double mx = lam.max();
+				log_z += std::log(mx);
+				if (mx > 0) lam /= mx;
+				m_msg_prob[a] = lam;
+				if (m_out[a].empty()) eu += m_msg_util[a].max();
+			}
+		}
+
+		return std::exp(log_z) * eu;
+	}
+
+	///
+	/// \brief Lower bound on the probability mass of any policy.
+	///
+	/// One mini-bucket of a chance variable is summed out (the one that gains
+	/// most over its minimum), the others and those of the decisions are
+	/// minimized out.
+	///
+	double mass_lb() const {
+
+		std::vector<factor> msg(m_prob.size());
+		double log_z = 0.0;
+		for (size_t i = 0; i < m_order.size(); ++i) {
+			vindex x = m_order[i];
+			variable_set VX(m_gmo.var(x));
+			const flist& cl = m_clusters[x];
+			findex sum = cl.size();
+			double gain = 0.0;
+			std::vector<factor> lo(cl.size()), hi(cl.size());
+			size_t k = 0;
+			for (flist::const_iterator it = cl.begin(); it != cl.end(); ++it, ++k) {
+				findex a = *it;
+				factor f = m_prob[a];
+				for (flist::const_iterator jt = m_in[a].begin(); jt != m_in[a].end(); ++jt) {
+					f *= msg[*jt];
+				}
+				lo[k] = f.min(VX);
+				if (m_weights[a] != infty()) {
+					hi[k] = f.sum(VX);
+					double g = hi[k].sum() / lo[k].sum();
+					if (sum == cl.size() || g > gain) {
+						sum = k;
+						gain = g;
+					}
+				}
+			}
+
+			k = 0;
+			for (flist::const_iterator it = cl.begin(); it != cl.end(); ++it, ++k) {
+				factor& f = (k == sum) ? hi[k] : lo[k];
+				double mx = f.max();
+				log_z += std::log(mx);
+				if (mx > 0) f /= mx;
+				msg[*it] = f;
+			}
+		}
+
+		return std::exp(log_z);
+	}
+
+	///
+	/// \brief Policy of the decisions from the current messages.
+	///
+	/// The expected utility of the mini-buckets of each decision: the product
+	/// of their probabilities times the sum of their utilities.
+	///
+	void update_policy(const std::vector<vindex>& decisions) {
+		for (size_t i = 0; i < decisions.size(); ++i) {
+			vindex d = decisions[i];
+			factor lam(1.0), eta(0.0);
+			for (flist::const_iterator it = m_clusters[d].begin();
+					it != m_clusters[d].end(); ++it) {
+				factor l, e;
+				pair_belief(*it, l, e);
+				lam *= l;
+				eta += e;
+			}
+			m_policy[d] = lam * eta;
+		}
+	}
+
+protected:
+	// Members:
+
+	limid m_gmo; 						///< Original influence diagram
+	double m_meu;						///< Maximum expected utility (upper bound)
+	double m_lb;						///< Lower bound on the MEU (value of the policy)
+	std::map<vindex, factor> m_policy;	///< Decision policy (expected utilities)
+	size_t m_ibound;					///< Mini-bucket i-bound
+	size_t m_num_iter;					///< Number of cost-shifting iterations
+	OrderMethod m_order_method;			///< Variable ordering method
+	unsigned long m_seed;				///< Seed of the ordering tie-breaks
+	variable_order_t m_order;			///< Variable order
+	bool m_debug;						///< Internal debugging flag
+	double m_memo;						///< Memory for memoized products (MB, 0 if off)
+
+	// Join graph of the mini-buckets (see wmb.h):
+
+	std::vector<flist> m_clusters;		///< Mini-buckets of each variable
+	std::vector<double> m_weights;		///< Weight of each mini-bucket (infinite if MAX)
+	std::vector<flist> m_in;			///< Incoming to each mini-bucket
+	std::vector<flist> m_out;			///< Outgoing from each mini-bucket
+	std::vector<factor> m_prob;			///< Product of the probabilities of each mini-bucket
+	std::vector<factor> m_util;			///< Sum of the utilities of each mini-bucket
+	std::vector<factor> m_reparam;		///< Reparameterization (cost-shifting) of each mini-bucket
+	std::vector<factor> m_msg_prob;		///< Probability message of each mini-bucket
+	std::vector<factor> m_msg_util;		///< Utility message of each mini-bucket
+
+};
+
+} // end namespace
+
+#endif /* IBM_MERLIN_WMBMEU_H_ */
@@ -0,0 +1,254 @@
+/*
+ * writer.h
+ *
+ *  Created on: 19 Oct 2015
+ *      Author: radu
+ *
+ * Copyright (c) 2015, International Business Machines Corporation
+ * and University of California Irvine. All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/// \file writer.h
+/// \brief Buffered writer for the output files
+/// \author Radu Marinescu
+
+#ifndef IBM_MERLIN_WRITER_H_
+#define IBM_MERLIN_WRITER_H_
+
+#include "factor.h"
+
+#include <cstdio>
+#include <charconv>
+#include <stdint.h>
+
+namespace merlin {
+
+/**
+ * Buffered output file
+ *
+ * Numbers are formatted with std::to_chars straight into a large buffer that
+ * is handed to fwrite when full, so there is no stream state or locale
+ * lookup per value. A double written with a given precision is the same text
+ * as `std::fixed << std::setprecision(p)` produces.
+ *
+ * In binary mode the same calls write fixed-width records in the native
+ * byte order instead: integers as uint64_t, reals as IEEE doubles, and text (keywords
+ * and separators) is skipped, except for tag() which always writes its
+ * 4 bytes so that a binary file starts with a magic number.
+ */
+class writer {
+public:
+
+	///
+	/// \brief Open the output file.
+	/// \param file_name 	The output file name
+	/// \param binary 		True for binary records, false for text
+	///
+	writer(const char* file_name, bool binary = false) :
+		m_binary(binary), m_buf(1 << 20), m_pos(0) {
+		m_file = fopen(file_name, binary ? "wb" : "w");
+		if (m_file == NULL) {
+			std::cout << "Error while opening the output file: " << file_name << std::endl;
+			throw std::runtime_error("Output file error");
+		}
+	}
+
+	///
+	/// \brief Destructor (flushes and closes the file, ignoring errors).
+	///
+	~writer() {
+		if (m_file != NULL) {
+			fwrite(&m_buf[0], 1, m_pos, m_file);
+			fclose(m_file);
+		}
+	}
+
+	///
+	/// \brief Flush and close the file.
+	///
+	void close() {
+		flush();
+		if (fclose(m_file) != 0) {
+			m_file = NULL;
+			throw std::runtime_error("Error while writing the output file.");
+		}
+		m_file = NULL;
+	}
+
+	bool binary() const { return m_binary; }
+
+	///
+	/// \brief Write a 4 character tag (text or binary).
+	///
+	writer& tag(const char* s) {
+		char* p = reserve(4);
+		memcpy(p, s, 4);
+		m_pos += 4;
+		return *this;
+	}
+
+	///
+	/// \brief Write text (skipped in binary mode).
+	///
+	writer& text(const char* s) {
+		if (!m_binary) {
+			size_t n = strlen(s);
+			char* p = reserve(n);
+			memcpy(p, s, n);
+			m_pos += n;
+		}
+		return *this;
+	}
+	writer& text(char c) {
+		if (!m_binary) {
+			*reserve(1) = c;
+			++m_pos;
+		}
+		return *this;
+	}
+
+	///
+	/// \brief Write an integer.
+	///
+	writer& integer(size_t v) {
+		if (m_binary) {
+			uint64_t x = v;
+			return raw(&x, sizeof(x));
+		}
+		char* p = reserve(32);
+		m_pos = std::to_chars(p, p + 32, v).ptr - &m_buf[0];
+		return *this;
+	}
+
+	///
+	/// \brief Write a real number with a fixed number of decimals.
+	///
+	writer& real(double v, int precision = 6) {
+		if (m_binary) {
+			return raw(&v, sizeof(v));
+		}
+		size_t n = 320 + precision; // longest fixed notation of a double
+		char* p = reserve(n);
+		m_pos = std::to_chars(p, p + n, v, std::chars_format::fixed, precision).ptr - &m_buf[0];
+		return *this;
+	}
+
+	///
+	/// \brief Write a real number in scientific notation.
+	///
+	writer& scientific(double v, int precision = 6) {
+		if (m_binary) {
+			return raw(&v, sizeof(v));
+		}
+		size_t n = 32 + precision;
+		char* p = reserve(n);
+		m_pos = std::to_chars(p, p + n, v, std::chars_format::scientific, precision).ptr - &m_buf[0];
+		return *this;
+	}
+
+	///
+	/// \brief Write the table of a factor (" v0 v1 ..." or the raw doubles).
+	///
+	writer& table(const factor& f, int precision = 6) {
+		if (m_binary) {
+			return raw(f.table(), f.numel() * sizeof(double));
+		}
+		for (size_t j = 0; j < f.numel(); ++j) {
+			text(' ').real(f[j], precision);
+		}
+		return *this;
+	}
+
+	///
+	/// \brief Write raw bytes.
+	///
+	writer& raw(const void* data, size_t n) {
+		const char* s = (const char*)data;
+		while (n > 0) {
+			if (m_pos == m_buf.size()) flush();
+			size_t k = std::min(n, m_buf.size() - m_pos);
+			memcpy(&m_buf[m_pos], s, k);
+			m_pos += k;
+			s += k;
+			n -= k;
+		}
+		return *this;
+	}
+
+	///
+	/// \brief Write the buffer to the file.
+	///
+	void flush() {
+		if (m_pos > 0 && fwrite(&m_buf[0], 1, m_pos, m_file) != m_pos) {
+			throw std::runtime_error("Error while writing the output file.");
+		}
+		m_pos = 0;
+	}
+
+private:
+
+	///
+	/// \brief Make room for n bytes in the buffer.
+	///
+	char* reserve(size_t n) {
+		if (m_pos + n > m_buf.size()) {
+			flush();
+		}
+		return &m_buf[m_pos];
+	}
+
+	// Members:
+
+	FILE* m_file;						///< Output file
+	bool m_binary;						///< Binary records
+	std::vector<char> m_buf;			///< Output buffer
+	size_t m_pos;						///< Bytes used in the buffer
+};
+
+///
+/// \brief Write a decision policy (one factor per decision).
+///
+/// The text format lists the number of decisions and then, for each one, the
+/// decision, the scope of its factor (number of variables and labels), the
+/// number of entries and the table; the binary format starts with the tag
+/// "MPOL" and holds the same values.
+///
+/// \param file_name 	The output file name
+/// \param policy 		The policy factor of each decision
+/// \param binary 		True for the binary format
+///
+inline void write_policy(const char* file_name,
+		const std::map<size_t, factor>& policy, bool binary = false) {
+	writer out(file_name, binary);
+	if (binary) {
+		out.tag("MPOL");
+	}
+	out.text("POLICY\n").integer(policy.size()).text('\n');
+	for (std::map<size_t, factor>::const_iterator pi = policy.begin();
+			pi != policy.end(); ++pi) {
+		const factor& f = pi->second;
+		out.integer(pi->first).text(' ').integer(f.nvar());
+		for (variable_set::const_iterator si = f.vars().begin();
+				si != f.vars().end(); ++si) {
+			out.text(' ').integer((*si).label());
+		}
+		out.text('\n').integer(f.numel()).text('\n');
+		out.table(f, 8).text("\n\n");
+	}
+	out.close();
+}
+
+} // end namespace
+
+#endif /* IBM_MERLIN_WRITER_H_ */
@@ -4,27 +4,449 @@
  Author      : Radu Marinescu
  Version     :
  Copyright   : Copyright (c) IBM Corp. 2015
- Description :
+ Description : Solve a batch of influence diagrams, one process per model.
  ============================================================================
  */
 
 #include "be.h"
+#include "bebatch.h"
 #include "mbe.h"
+#include "aobb.h"
+#include "aobf.h"
+#include "paobb.h"
+#include "wmbmeu.h"
+#include "evaluator.h"
+#include "is.h"
+#include "server.h"
 
-int main(void) {
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
-	std::cout << VERSIONINFO << std::endl << COPYRIGHT << std::endl;
+///
+/// \brief Options of a batch run.
+///
+struct options {
+	std::string algorithm;				///< Algorithm name
+	std::string properties;				///< Algorithm properties
+	size_t jobs;						///< Number of concurrent jobs
+	std::string output;					///< Output directory
+	std::string summary;				///< Summary file
+	double time_limit;					///< Time limit per job in seconds (0 for none)
+	size_t memory_limit;				///< Memory limit per job in MB (0 for none)
+	std::vector<std::string> models;	///< Input models
+	std::string socket;					///< Socket path (server mode)
+	double server_memory;				///< Memory cap of the server in MB
+	size_t huge_pages;					///< Tables mapped with huge pages from this size in MB (0 for none)
+	std::string numa;					///< NUMA policy of the mapped tables
+};
 
-	merlin::limid gm;
-	gm.read("/home/radu/git/limid/examples/car.uai");
-	merlin::be s(gm);
-	s.run();
+///
+/// \brief Model parsed ahead of being solved.
+///
+struct model_job {
+	size_t id;							///< Position in the input list
+	std::string path;					///< Model file
+	merlin::limid* model;				///< Parsed model (NULL if parsing failed)
+	double read_time;					///< Parsing time in seconds
+	std::string log;					///< Output of the parser
+};
 
-	merlin::mbe m(gm);
-	m.run();
-	m.run2();
+///
+/// \brief Job being solved by a child process.
+///
+struct running_job {
+	model_job job;						///< The model
+	int fd;								///< Read end of the result pipe
+	double start;						///< Start time (before the fork)
+};
 
-	return 0;
+///
+/// \brief Result of a job.
+///
+struct job_result {
+	std::string path;					///< Model file
+	std::string status;					///< ok, timeout, memout or error
+	double lb, ub;						///< Bounds on the MEU (equal if solved)
+	double read_time;					///< Parsing time in seconds
+	double solve_time;					///< Wall clock time of the solver (measured by the child)
+	double cpu_time;					///< CPU time of the solver
+	double max_rss;						///< Peak resident memory in MB
+};
+
+static void usage(const char* prog) {
+	std::cout << "Usage: " << prog << " [options] <model.uai|directory> ..." << std::endl
+		<< "  -a <algorithm>   be, bebatch, mbe, wmbmeu, aobb, aobf, paobb, is or eval (default be)" << std::endl
+		<< "  -p <properties>  algorithm properties, eg \"iBound=4,Memory=512\"" << std::endl
+		<< "  -l <file>        file listing the models (one path per line)" << std::endl
+		<< "  -j <jobs>        number of models solved concurrently (default 1)" << std::endl
+		<< "  -o <directory>   output directory (default .)" << std::endl
+		<< "  -s <file>        summary file (default <output>/summary.txt)" << std::endl
+		<< "  -t <seconds>     time limit per model (default none)" << std::endl
+		<< "  -m <MB>          memory limit per model (default none)" << std::endl
+		<< "  -H <MB>          map tables of at least MB with huge pages (default none)" << std::endl
+		<< "  -N <policy>      NUMA policy of the mapped tables: none, local or interleave" << std::endl
+		<< "Server mode: " << prog << " -S <socket> [-M <MB>]" << std::endl
+		<< "  -S <socket>      serve requests on a Unix domain socket" << std::endl
+		<< "  -M <MB>          memory cap of the resident models (default none)" << std::endl;
+}
+
+///
+/// \brief Collect the models of a directory (*.uai files, sorted).
+///
+static void list_directory(const std::string& dir, std::vector<std::string>& models) {
+	DIR* d = opendir(dir.c_str());
+	if (d == NULL) {
+		throw std::runtime_error("Cannot open directory " + dir);
+	}
+	std::vector<std::string> files;
+	struct dirent* e;
+	while ((e = readdir(d)) != NULL) {
+		std::string name(e->d_name);
+		if (name.size() > 4 && name.compare(name.size() - 4, 4, ".uai") == 0) {
+			files.push_back(dir + "/" + name);
+		}
+	}
+	closedir(d);
+	std::sort(files.begin(), files.end());
+	models.insert(models.end(), files.begin(), files.end());
 }
 
+///
+/// \brief Create the solver for a model.
+///
+template<class T>
+static merlin::algorithm* make_solver(const merlin::limid& gm, const std::string& prop) {
+	T* s = new T(gm);
+	if (prop.empty() == false) {
+		s->set_properties(prop);
+	}
+	return s;
+}
+
+static merlin::algorithm* create_solver(const std::string& name,
+		const merlin::limid& gm, const std::string& prop) {
+	if (name == "be") return make_solver<merlin::be>(gm, prop);
+	if (name == "bebatch") return make_solver<merlin::bebatch>(gm, prop);
+	if (name == "mbe") return make_solver<merlin::mbe>(gm, prop);
+	if (name == "wmbmeu") return make_solver<merlin::wmbmeu>(gm, prop);
+	if (name == "aobb") return make_solver<merlin::aobb>(gm, prop);
+	if (name == "aobf") return make_solver<merlin::aobf>(gm, prop);
+	if (name == "paobb") return make_solver<merlin::paobb>(gm, prop);
+	if (name == "is") return make_solver<merlin::is>(gm, prop);
+	if (name == "eval") return make_solver<merlin::evaluator>(gm, prop);
+	throw std::runtime_error("Unknown algorithm " + name);
+}
+
+///
+/// \brief Base name of a model file (for the output files).
+///
+static std::string base_name(const std::string& path) {
+	size_t pos = path.find_last_of('/');
+	std::string name = (pos == std::string::npos) ? path : path.substr(pos + 1);
+	if (name.size() > 4 && name.compare(name.size() - 4, 4, ".uai") == 0) {
+		name.resize(name.size() - 4);
+	}
+	return name;
+}
 
+///
+/// \brief Solve a model in the child process: the solver output goes to
+///	<output>/<model>.<id>.out, and the status, the wall clock time of the
+///	solver and the bounds are written to the result pipe.
+///
+static void solve_child(const options& opt, const model_job& job, int fd) {
+
+	// Per-job limits (the time limit is enforced by SIGALRM)
+	if (opt.memory_limit > 0) {
+		struct rlimit rl;
+		rl.rlim_cur = rl.rlim_max = (rlim_t)opt.memory_limit * 1024 * 1024;
+		setrlimit(RLIMIT_AS, &rl);
+	}
+	if (opt.time_limit > 0) {
+		alarm((unsigned)std::ceil(opt.time_limit));
+	}
+
+	std::ostringstream out;
+	out << opt.output << "/" << base_name(job.path) << "." << job.id << ".out";
+	if (freopen(out.str().c_str(), "w", stdout) == NULL) {
+		_exit(2);
+	}
+	std::cout << job.log;
+
+	int code = 0;
+	std::string status;
+	double lb = std::numeric_limits<double>::quiet_NaN(), ub = lb;
+	double start = merlin::timeSystem();
+	try {
+		if (job.model == NULL) {
+			throw std::runtime_error("Cannot read model " + job.path);
+		}
+		merlin::algorithm* s = create_solver(opt.algorithm, *job.model, opt.properties);
+		s->run();
+		try { lb = s->lb(); } catch (std::runtime_error&) {}
+		try { ub = s->ub(); } catch (std::runtime_error&) {}
+		status = "ok";
+		delete s;
+	} catch (std::bad_alloc&) {
+		status = "memout";
+		code = 3;
+	} catch (std::exception& e) {
+		std::cout << "Error: " << e.what() << std::endl;
+		status = "error";
+		code = 1;
+	}
+
+	std::ostringstream res;
+	res.precision(12);
+	res << status << " " << (merlin::timeSystem() - start) << " " << lb << " " << ub;
+	std::cout.flush();
+	std::string str = res.str();
+	if (write(fd, str.c_str(), str.size()) < 0) code = 2;
+	close(fd);
+	_exit(code); // skip the exit handlers of the parent
+}
+
+///
+/// \brief Collect the result of a finished job.
+///
+static job_result finish_job(const running_job& rj, int status, const struct rusage& ru) {
+	job_result r;
+	r.path = rj.job.path;
+	r.read_time = rj.job.read_time;
+	r.cpu_time = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6
+		+ ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+	r.max_rss = ru.ru_maxrss / 1024.0;
+	r.lb = r.ub = std::numeric_limits<double>::quiet_NaN();
+
+	std::string str;
+	char buf[256];
+	ssize_t k;
+	while ((k = read(rj.fd, buf, sizeof(buf))) > 0) {
+		str.append(buf, k);
+	}
+	close(rj.fd);
+
+	std::istringstream in(str);
+	in >> r.status;
+	if (r.status.empty() == false) {
+		std::string t, lb, ub; // nan is not parsed by operator>>
+		in >> t >> lb >> ub;
+		r.solve_time = atof(t.c_str());
+		if (r.status == "ok") {
+			r.lb = atof(lb.c_str());
+			r.ub = atof(ub.c_str());
+		}
+	} else {
+		// Killed before reporting: the time of the job since the fork
+		r.solve_time = merlin::timeSystem() - rj.start;
+		if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM) {
+			r.status = "timeout";
+		} else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL) {
+			r.status = "memout"; // out-of-memory killer
+		} else {
+			r.status = "error";
+		}
+	}
+	return r;
+}
+
+int main(int argc, char** argv) {
+
+	std::cout << VERSIONINFO << std::endl << COPYRIGHT << std::endl;
+
+	options opt;
+	opt.algorithm = "be";
+	opt.jobs = 1;
+	opt.output = ".";
+	opt.time_limit = 0;
+	opt.memory_limit = 0;
+	opt.server_memory = 0;
+	opt.huge_pages = 0;
+	opt.numa = "none";
+
+	int c;
+	while ((c = getopt(argc, argv, "a:p:l:j:o:s:t:m:H:N:S:M:h")) != -1) {
+		switch (c) {
+		case 'a': opt.algorithm = optarg; break;
+		case 'p': opt.properties = optarg; break;
+		case 'l': {
+			std::ifstream in(optarg);
+			if (!in) {
+				std::cerr << "Cannot open model list " << optarg << std::endl;
+				return 1;
+			}
+			std::string line;
+			while (std::getline(in, line)) {
+				if (line.empty() == false && line[0] != '#') opt.models.push_back(line);
+			}
+			break;
+		}
+		case 'j': opt.jobs = std::max(1L, atol(optarg)); break;
+		case 'o': opt.output = optarg; break;
+		case 's': opt.summary = optarg; break;
+		case 't': opt.time_limit = atof(optarg); break;
+		case 'm': opt.memory_limit = atol(optarg); break;
+		case 'H': opt.huge_pages = atol(optarg); break;
+		case 'N': opt.numa = optarg; break;
+		case 'S': opt.socket = optarg; break;
+		case 'M': opt.server_memory = atof(optarg); break;
+		default:
+			usage(argv[0]);
+			return (c == 'h') ? 0 : 1;
+		}
+	}
+
+	// Memory policy of the large tables (inherited by the child processes);
+	// a NUMA policy alone applies to the tables of 2 MB and more
+	try {
+		merlin::table_memory::numa_policy numa = merlin::table_memory::parse_numa(opt.numa);
+		size_t threshold = opt.huge_pages << 20;
+		if (threshold == 0 && numa != merlin::table_memory::numa_default) {
+			threshold = merlin::table_memory::huge_page;
+		}
+		merlin::table_memory::configure(threshold, numa);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	if (opt.socket.empty() == false) {
+		try {
+			merlin::server srv(opt.socket, opt.server_memory);
+			srv.run();
+		} catch (std::exception& e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	try {
+		for (int i = optind; i < argc; ++i) {
+			struct stat st;
+			if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+				list_directory(argv[i], opt.models);
+			} else {
+				opt.models.push_back(argv[i]);
+			}
+		}
+		merlin::limid gm;
+		delete create_solver(opt.algorithm, gm, std::string()); // check the name
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	if (opt.models.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+	mkdir(opt.output.c_str(), 0755);
+	if (opt.summary.empty()) {
+		opt.summary = opt.output + "/summary.txt";
+	}
+
+	std::cout << "Solving " << opt.models.size() << " model(s) with " << opt.algorithm
+		<< " (" << opt.jobs << " job(s))" << std::endl;
+
+	// The next models are parsed while the current ones are being solved by
+	// the child processes (which inherit the parsed model)
+	double start = merlin::timeSystem();
+	std::deque<model_job> ready;
+	std::map<pid_t, running_job> running;
+	std::vector<job_result> results(opt.models.size());
+	size_t next = 0;
+	while (next < opt.models.size() || ready.empty() == false || running.empty() == false) {
+
+		if (running.size() < opt.jobs && ready.empty() == false) {
+			model_job job = ready.front();
+			ready.pop_front();
+			int fds[2];
+			if (pipe(fds) != 0) {
+				throw std::runtime_error("Cannot create pipe.");
+			}
+			double forked = merlin::timeSystem();
+			pid_t pid = fork();
+			if (pid < 0) {
+				throw std::runtime_error("Cannot fork.");
+			} else if (pid == 0) {
+				close(fds[0]);
+				solve_child(opt, job, fds[1]);
+			}
+			close(fds[1]);
+			running_job rj;
+			rj.job = job;
+			rj.fd = fds[0];
+			rj.start = forked;
+			running[pid] = rj;
+			delete job.model; // the child has its own copy
+			continue;
+		}
+
+		if (ready.size() < opt.jobs && next < opt.models.size()) {
+			model_job job;
+			job.id = next;
+			job.path = opt.models[next++];
+			double t = merlin::timeSystem();
+			job.model = new merlin::limid();
+			std::ostringstream log; // goes to the output of the job
+			std::streambuf* buf = std::cout.rdbuf(log.rdbuf());
+			try {
+				job.model->read(job.path.c_str());
+			} catch (std::exception& e) {
+				std::cout << "Error: " << e.what() << std::endl;
+				delete job.model;
+				job.model = NULL;
+			}
+			std::cout.rdbuf(buf);
+			job.log = log.str();
+			job.read_time = merlin::timeSystem() - t;
+			ready.push_back(job);
+		}
+
+		// Reap the finished jobs (wait only if there is nothing to parse)
+		bool block = (ready.size() >= opt.jobs || next >= opt.models.size())
+				&& running.empty() == false;
+		int status;
+		struct rusage ru;
+		pid_t pid;
+		while ((pid = wait4(-1, &status, block ? 0 : WNOHANG, &ru)) > 0) {
+			std::map<pid_t, running_job>::iterator it = running.find(pid);
+			if (it == running.end()) continue;
+			job_result r = finish_job(it->second, status, ru);
+			std::cout << "[" << (merlin::timeSystem() - start) << "] " << r.path
+				<< ": " << r.status << " " << r.lb << " " << r.ub
+				<< " (" << r.solve_time << " seconds, " << r.max_rss << " MB)" << std::endl;
+			results[it->second.job.id] = r;
+			running.erase(it);
+			block = false;
+		}
+	}
+
+	// Summary (one line per model, in the input order)
+	std::ofstream out(opt.summary.c_str());
+	out << "# model\tstatus\tlb\tub\tread_time\tsolve_time\tcpu_time\tmax_rss_mb" << std::endl;
+	size_t solved = 0;
+	double cpu = 0.0, rss = 0.0;
+	for (size_t i = 0; i < results.size(); ++i) {
+		const job_result& r = results[i];
+		out << r.path << "\t" << r.status << "\t" << r.lb << "\t" << r.ub << "\t"
+			<< r.read_time << "\t" << r.solve_time << "\t" << r.cpu_time << "\t"
+			<< r.max_rss << std::endl;
+		if (r.status == "ok") ++solved;
+		cpu += r.cpu_time;
+		rss = std::max(rss, r.max_rss);
+	}
+	out.close();
+
+	std::cout << "Solved " << solved << " of " << results.size() << " model(s) in "
+		<< (merlin::timeSystem() - start) << " seconds (" << cpu << " CPU seconds, "
+		<< rss << " MB peak per job)" << std::endl;
+	std::cout << "Summary written to " << opt.summary << std::endl;
+
+	return 0;
+}